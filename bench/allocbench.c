@@ -0,0 +1,493 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * allocbench: microbenchmark for NVMM_Malloc/Calloc/Realloc/Free
+ *
+ * patterns
+ *   churn    : fixed-size (min) malloc/free replacing random live slot
+ *   random   : random-size [min, max] malloc/calloc/free replacing random live slot
+ *   prodcons : producer threads malloc, consumer threads free (threads in pairs)
+ *   larson   : like random, but live slots are handed to next thread every round
+ *              (most frees are for regions allocated by other thread)
+ *   growth   : realloc from min to max (doubling), then free
+ *
+ * backends
+ *   nvmm : libnvmm (ZC706 or emulation, selected by NVMM_FLAGS at build)
+ *   libc : malloc/calloc/realloc/free of libc (reference)
+ *
+ * -F fills and flushes every allocated region (untimed) to record wear
+ * (see NVMM_WEAR and NVMM_POLICY of libnvmm)
+ *
+ * -Z checks NVMM_Prezero after the run (nvmm): dirty 8 MB is freed, and
+ * second NVMM_Prezero must find nothing to zero
+ *
+ * output
+ *   CSV: pattern,backend,policy,threads,op,throughput[Mops/s],count,avg,p50,p99,p999,max
+ *   throughput is total ops of all kinds per wall clock time
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "libnvmm.h"
+#include "benchutil.h"
+
+
+/******************** Backend ***********************/
+typedef struct _backend {
+    const char *name;
+    void *(*malloc)(size_t);
+    void *(*calloc)(size_t, size_t);
+    void *(*realloc)(void *, size_t);
+    void  (*free)(void *);
+} backend;
+
+static const backend backends[] = {
+    { "nvmm", NVMM_Malloc, NVMM_Calloc, NVMM_Realloc, NVMM_Free },
+    { "libc", malloc,      calloc,      realloc,      free      },
+};
+
+
+/******************** Parameters ********************/
+enum { OP_MALLOC, OP_CALLOC, OP_REALLOC, OP_FREE, NOPS };
+static const char *op_name[NOPS] = { "malloc", "calloc", "realloc", "free" };
+
+static const char *pattern = "churn";
+static const backend *be   = &backends[0];
+static int    nthread = 1;
+static long   nops    = 1000000; /* per thread */
+static size_t minsize = 64;
+static size_t maxsize = 4 * KB;
+static int    nslot   = 1000;    /* live regions per thread */
+static int    nround  = 10;      /* handoff rounds (larson) */
+static int    dump    = 0;       /* dump all buckets */
+static int    persist = 0;       /* fill & flush allocated region */
+static int    prezero = 0;       /* check NVMM_Prezero after run */
+
+typedef struct _worker {
+    pthread_t th;
+    int id;
+    uint32_t rng;
+    void **slot;
+    hist h[NOPS];
+} worker;
+
+static worker *workers;
+static pthread_barrier_t barrier;
+
+
+/******************** Timed operations **************/
+static inline void
+touch(void *p, size_t size)
+{
+    if (!persist) {
+        *((volatile char *) p) = 1;
+        return;
+    }
+
+    memset(p, 1, size);
+    if (be == &backends[0])
+        NVMM_FlushRange(p, size);
+}
+
+static inline size_t
+rand_size(worker *w)
+{
+    return minsize + xorshift32(&w->rng) % (maxsize - minsize + 1);
+}
+
+static inline void *
+t_malloc(worker *w, size_t size)
+{
+    uint64_t t0 = now_ns();
+    void *p = be->malloc(size);
+    hist_add(&w->h[OP_MALLOC], now_ns() - t0);
+    touch(p, size);
+    return p;
+}
+
+static inline void *
+t_calloc(worker *w, size_t size)
+{
+    uint64_t t0 = now_ns();
+    void *p = be->calloc(1, size);
+    hist_add(&w->h[OP_CALLOC], now_ns() - t0);
+    if (persist)
+        touch(p, size);
+    return p;
+}
+
+static inline void *
+t_realloc(worker *w, void *ptr, size_t size)
+{
+    uint64_t t0 = now_ns();
+    void *p = be->realloc(ptr, size);
+    hist_add(&w->h[OP_REALLOC], now_ns() - t0);
+    touch(p, size);
+    return p;
+}
+
+static inline void
+t_free(worker *w, void *ptr)
+{
+    uint64_t t0 = now_ns();
+    be->free(ptr);
+    hist_add(&w->h[OP_FREE], now_ns() - t0);
+}
+
+
+/******************** Patterns **********************/
+static void
+fill_slots(worker *w, int fixed)
+{
+    int i;
+
+    for (i = 0; i < nslot; ++i)
+        w->slot[i] = be->malloc(fixed ? minsize : rand_size(w));
+}
+
+static void
+free_slots(worker *w)
+{
+    int i;
+
+    for (i = 0; i < nslot; ++i)
+        be->free(w->slot[i]);
+}
+
+static void
+run_churn(worker *w)
+{
+    long i;
+    int k;
+
+    fill_slots(w, 1);
+    for (i = 0; i < nops; ++i) {
+        k = xorshift32(&w->rng) % nslot;
+        t_free(w, w->slot[k]);
+        w->slot[k] = t_malloc(w, minsize);
+    }
+    free_slots(w);
+}
+
+static void
+run_random(worker *w)
+{
+    long i;
+    int k;
+
+    fill_slots(w, 0);
+    for (i = 0; i < nops; ++i) {
+        k = xorshift32(&w->rng) % nslot;
+        t_free(w, w->slot[k]);
+        if (xorshift32(&w->rng) % 4 == 0)
+            w->slot[k] = t_calloc(w, rand_size(w));
+        else
+            w->slot[k] = t_malloc(w, rand_size(w));
+    }
+    free_slots(w);
+}
+
+static void
+run_larson(worker *w)
+{
+    void **tmp;
+    long i, per_round;
+    int r, k;
+
+    fill_slots(w, 0);
+    per_round = nops / nround;
+    for (r = 0; r < nround; ++r) {
+        for (i = 0; i < per_round; ++i) {
+            k = xorshift32(&w->rng) % nslot;
+            t_free(w, w->slot[k]);
+            w->slot[k] = t_malloc(w, rand_size(w));
+        }
+
+        /* hand live slots to next thread */
+        pthread_barrier_wait(&barrier);
+        tmp = workers[(w->id + 1) % nthread].slot;
+        pthread_barrier_wait(&barrier);
+        w->slot = tmp;
+        pthread_barrier_wait(&barrier);
+    }
+    free_slots(w);
+}
+
+static void
+run_growth(worker *w)
+{
+    void *p;
+    size_t size;
+    long i;
+
+    for (i = 0; i < nops; ) {
+        p = NULL;
+        for (size = minsize; size <= maxsize && i < nops; size *= 2, ++i)
+            p = t_realloc(w, p, size);
+        t_free(w, p);
+    }
+}
+
+/* bounded queue between producer (even id) and consumer (odd id) */
+typedef struct _queue {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    void **buf;
+    int head, tail, cnt;
+} queue;
+
+static queue *queues;
+
+static void
+queue_push(queue *q, void *p)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->cnt == nslot)
+        pthread_cond_wait(&q->cond, &q->lock);
+    q->buf[q->tail] = p;
+    q->tail = (q->tail + 1) % nslot;
+    q->cnt++;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void *
+queue_pop(queue *q)
+{
+    void *p;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->cnt == 0)
+        pthread_cond_wait(&q->cond, &q->lock);
+    p = q->buf[q->head];
+    q->head = (q->head + 1) % nslot;
+    q->cnt--;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+
+    return p;
+}
+
+static void
+run_prodcons(worker *w)
+{
+    queue *q = &queues[w->id / 2];
+    void *p;
+    long i;
+
+    if (w->id % 2 == 0) {
+        for (i = 0; i < nops; ++i)
+            queue_push(q, t_malloc(w, rand_size(w)));
+        queue_push(q, NULL);
+    } else {
+        while ((p = queue_pop(q)) != NULL)
+            t_free(w, p);
+    }
+}
+
+typedef struct _pattern_def {
+    const char *name;
+    void (*run)(worker *);
+} pattern_def;
+
+static const pattern_def patterns[] = {
+    { "churn",    run_churn    },
+    { "random",   run_random   },
+    { "prodcons", run_prodcons },
+    { "larson",   run_larson   },
+    { "growth",   run_growth   },
+};
+#define NPATTERN ((int) (sizeof(patterns) / sizeof(patterns[0])))
+
+static const pattern_def *pat;
+
+static void *
+worker_main(void *arg)
+{
+    worker *w = (worker *) arg;
+
+    pthread_barrier_wait(&barrier);
+    pat->run(w);
+
+    return NULL;
+}
+
+
+/******************** Prezero check ****************/
+#define PREZERO_DIRTY (8 * MB)
+
+static int
+check_prezero()
+{
+    size_t budget = PREZERO_DIRTY + 2 * 4096;
+    size_t first, second;
+    void *p;
+
+    /* zero all free pages, then dirty 8 MB and zero it with (almost) exact budget */
+    NVMM_Prezero(NULL, SIZE_MAX);
+    p = NVMM_Malloc(PREZERO_DIRTY);
+    memset(p, 1, PREZERO_DIRTY);
+    NVMM_Free(p);
+    first  = NVMM_Prezero(NULL, budget);
+    second = NVMM_Prezero(NULL, budget);
+
+    printf("# prezero: %zu B, then %zu B\n", first, second);
+    if (second != 0) {
+        fprintf(stderr, "NVMM_Prezero did not converge\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+/******************** Main **************************/
+static void
+usage()
+{
+    fprintf(stderr,
+            "Usage: ./allocbench [-p pattern] [-b backend] [-t threads] [-n ops]\n"
+            "                    [-m minsize] [-M maxsize] [-w slots] [-r rounds] [-H] [-F] [-Z]\n"
+            "  pattern: churn, random, prodcons, larson, growth\n"
+            "  backend: nvmm, libc\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    hist total[NOPS];
+    const char *policy;
+    uint64_t t0, t1, allops;
+    double sec;
+    int i, j, opt;
+
+    while ((opt = getopt(argc, argv, "p:b:t:n:m:M:w:r:HFZ")) != -1) {
+        switch (opt) {
+        case 'p': pattern = optarg;                      break;
+        case 't': nthread = atoi(optarg);                break;
+        case 'n': nops    = atol(optarg);                break;
+        case 'm': minsize = (size_t) atol(optarg);       break;
+        case 'M': maxsize = (size_t) atol(optarg);       break;
+        case 'w': nslot   = atoi(optarg);                break;
+        case 'r': nround  = atoi(optarg);                break;
+        case 'H': dump    = 1;                           break;
+        case 'F': persist = 1;                           break;
+        case 'Z': prezero = 1;                           break;
+        case 'b':
+            if (strcmp(optarg, "nvmm") == 0)
+                be = &backends[0];
+            else if (strcmp(optarg, "libc") == 0)
+                be = &backends[1];
+            else
+                usage();
+            break;
+        default:
+            usage();
+        }
+    }
+
+    pat = NULL;
+    for (i = 0; i < NPATTERN; ++i) {
+        if (strcmp(pattern, patterns[i].name) == 0)
+            pat = &patterns[i];
+    }
+    if (pat == NULL || nthread < 1 || nops < 1 || nslot < 1 || nround < 1 ||
+        minsize < 1 || maxsize < minsize)
+        usage();
+    if (pat->run == run_prodcons && nthread % 2 != 0) {
+        fprintf(stderr, "prodcons requires even number of threads\n");
+        exit(1);
+    }
+
+    /* setup */
+    workers = (worker *) calloc(nthread, sizeof(worker));
+    queues  = (queue *) calloc(nthread, sizeof(queue));
+    if (workers == NULL || queues == NULL) {
+        perror("failed to calloc");
+        exit(1);
+    }
+    for (i = 0; i < nthread; ++i) {
+        workers[i].id   = i;
+        workers[i].rng  = 2463534242U + i * 7919;
+        workers[i].slot = (void **) calloc(nslot, sizeof(void *));
+        queues[i].buf   = (void **) calloc(nslot, sizeof(void *));
+        if (workers[i].slot == NULL || queues[i].buf == NULL) {
+            perror("failed to calloc");
+            exit(1);
+        }
+        pthread_mutex_init(&queues[i].lock, NULL);
+        pthread_cond_init(&queues[i].cond, NULL);
+        for (j = 0; j < NOPS; ++j)
+            hist_init(&workers[i].h[j]);
+    }
+    pthread_barrier_init(&barrier, NULL, nthread);
+
+    /* run */
+    t0 = now_ns();
+    for (i = 0; i < nthread; ++i)
+        pthread_create(&workers[i].th, NULL, worker_main, &workers[i]);
+    for (i = 0; i < nthread; ++i)
+        pthread_join(workers[i].th, NULL);
+    t1 = now_ns();
+
+    /* report */
+    allops = 0;
+    for (j = 0; j < NOPS; ++j) {
+        hist_init(&total[j]);
+        for (i = 0; i < nthread; ++i)
+            hist_merge(&total[j], &workers[i].h[j]);
+        allops += total[j].n;
+    }
+    sec = (t1 - t0) / 1e9;
+
+    policy = getenv("NVMM_POLICY");
+    if (be != &backends[0])
+        policy = "-";
+    else if (policy == NULL || *policy == '\0')
+        policy = "first";
+
+    printf("pattern,backend,policy,threads,op,throughput[Mops/s],");
+    hist_print_header(stdout);
+    printf("\n");
+    for (j = 0; j < NOPS; ++j) {
+        if (total[j].n == 0)
+            continue;
+        printf("%s,%s,%s,%d,%s,%.3f,", pat->name, be->name, policy, nthread, op_name[j],
+               allops / sec / 1e6);
+        hist_print(stdout, &total[j]);
+        printf("\n");
+        if (dump)
+            hist_dump(stdout, op_name[j], &total[j]);
+    }
+
+    if (prezero && be == &backends[0])
+        return check_prezero();
+
+    return 0;
+}
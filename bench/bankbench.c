@@ -0,0 +1,216 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bankbench: effect of bank-aware placement on row conflicts
+ *
+ * stream : K arrays are read together (a[K-1][i] = a[0][i] + ... + a[K-2][i])
+ *   default : NVMM_Malloc
+ *   same    : NVMM_MallocAligned, every array starts at bank 0 (worst case)
+ *   spread  : NVMM_MallocSpread, arrays start at different banks
+ *
+ * pair   : pairs of small objects (A, B) are accessed together in random order
+ *          other allocations are made between A and B
+ *   default : B = NVMM_Malloc
+ *   near    : B = NVMM_MallocNear(A) (same row as A)
+ *
+ * output
+ *   CSV: test,mode,time[ms],read,write,act,pre,bdr,bdw
+ *   (memory requests are 0 for emulation)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libnvmm.h"
+#include "benchutil.h"
+
+#define MAXN_STREAM (16)
+
+static int    nstream = 4;
+static size_t length  = 8 * MB; /* bytes per array */
+static int    npair   = 100000;
+static size_t objsize = 64;
+static int    repeat  = 4;
+
+static void
+print_result(const char *test, const char *mode, uint64_t ns, memreq *s, memreq *e)
+{
+    printf("%s,%s,%.3f,%lld,%lld,%lld,%lld,%lld,%lld\n", test, mode, ns / 1e6,
+           (long long) (e->read  - s->read),  (long long) (e->write - s->write),
+           (long long) (e->act   - s->act),   (long long) (e->pre   - s->pre),
+           (long long) (e->bdr   - s->bdr),   (long long) (e->bdw   - s->bdw));
+}
+
+
+/******************** stream ************************/
+static void
+run_stream(const char *mode)
+{
+    uint32_t *a[MAXN_STREAM];
+    memreq s, e;
+    uint64_t t0, t1;
+    size_t i, n;
+    uint32_t sum;
+    int k, r;
+
+    for (k = 0; k < nstream; ++k) {
+        if (strcmp(mode, "same") == 0)
+            a[k] = (uint32_t *) NVMM_MallocAligned(length, 1 * MB, 0);
+        else if (strcmp(mode, "spread") == 0)
+            a[k] = (uint32_t *) NVMM_MallocSpread(length);
+        else
+            a[k] = (uint32_t *) NVMM_Malloc(length);
+        memset(a[k], k, length);
+    }
+
+    n = length / sizeof(uint32_t);
+    NVMM_StartRequestStat(&s);
+    t0 = now_ns();
+    for (r = 0; r < repeat; ++r) {
+        for (i = 0; i < n; ++i) {
+            sum = 0;
+            for (k = 0; k < nstream - 1; ++k)
+                sum += a[k][i];
+            a[nstream - 1][i] = sum;
+        }
+    }
+    t1 = now_ns();
+    NVMM_EndRequestStat(&e);
+
+    print_result("stream", mode, t1 - t0, &s, &e);
+
+    for (k = 0; k < nstream; ++k)
+        NVMM_Free(a[k]);
+}
+
+
+/******************** pair **************************/
+static void
+run_pair(const char *mode)
+{
+    volatile uint32_t **pa, **pb;
+    void **filler;
+    uint32_t *order, rng, tmp, j;
+    memreq s, e;
+    uint64_t t0, t1;
+    uint32_t sum;
+    int i, r;
+
+    pa     = (volatile uint32_t **) malloc(sizeof(void *) * npair);
+    pb     = (volatile uint32_t **) malloc(sizeof(void *) * npair);
+    filler = (void **) malloc(sizeof(void *) * npair);
+    order  = (uint32_t *) malloc(sizeof(uint32_t) * npair);
+    if (pa == NULL || pb == NULL || filler == NULL || order == NULL) {
+        perror("failed to malloc");
+        exit(1);
+    }
+
+    /* A, (filler), B */
+    for (i = 0; i < npair; ++i) {
+        pa[i] = (volatile uint32_t *) NVMM_Malloc(objsize);
+        filler[i] = NVMM_Malloc(objsize * 4);
+        if (strcmp(mode, "near") == 0)
+            pb[i] = (volatile uint32_t *) NVMM_MallocNear((void *) pa[i], objsize);
+        else
+            pb[i] = (volatile uint32_t *) NVMM_Malloc(objsize);
+        pa[i][0] = i;
+        pb[i][0] = i;
+    }
+
+    /* random order */
+    rng = 2463534242U;
+    for (i = 0; i < npair; ++i)
+        order[i] = i;
+    for (i = npair - 1; i > 0; --i) {
+        j = xorshift32(&rng) % (i + 1);
+        tmp = order[i], order[i] = order[j], order[j] = tmp;
+    }
+
+    sum = 0;
+    NVMM_StartRequestStat(&s);
+    t0 = now_ns();
+    for (r = 0; r < repeat; ++r) {
+        for (i = 0; i < npair; ++i)
+            sum += pa[order[i]][0] + pb[order[i]][0];
+    }
+    t1 = now_ns();
+    NVMM_EndRequestStat(&e);
+
+    print_result("pair", mode, t1 - t0, &s, &e);
+    if (sum == 0x12345678)
+        printf("# %u\n", sum);
+
+    for (i = 0; i < npair; ++i) {
+        NVMM_Free((void *) pa[i]);
+        NVMM_Free((void *) pb[i]);
+        NVMM_Free(filler[i]);
+    }
+    free(pa);
+    free(pb);
+    free(filler);
+    free(order);
+}
+
+
+/******************** Main **************************/
+static void
+usage()
+{
+    fprintf(stderr,
+            "Usage: ./bankbench [-k streams] [-l length_MiB] [-p pairs] [-o objsize] [-r repeat]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:l:p:o:r:")) != -1) {
+        switch (opt) {
+        case 'k': nstream = atoi(optarg);                   break;
+        case 'l': length  = (size_t) atol(optarg) * MB;     break;
+        case 'p': npair   = atoi(optarg);                   break;
+        case 'o': objsize = (size_t) atol(optarg);          break;
+        case 'r': repeat  = atoi(optarg);                   break;
+        default:
+            usage();
+        }
+    }
+    if (nstream < 2 || nstream > MAXN_STREAM || length < 4 || npair < 1 ||
+        objsize < sizeof(uint32_t) || repeat < 1)
+        usage();
+
+    printf("test,mode,time[ms],read,write,act,pre,bdr,bdw\n");
+    run_stream("default");
+    run_stream("same");
+    run_stream("spread");
+    run_pair("default");
+    run_pair("near");
+
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _BENCHUTIL_H_INCLUDED
+#define _BENCHUTIL_H_INCLUDED
+
+/*
+ * Common utilities for benchmarks (options, latency, timer, random number, histogram)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "nvmm_latency.h"
+
+#define KB (1024)
+#define MB (1024*KB)
+
+#define MAXN_LIST (64)
+
+
+/******************** Options ***********************/
+/**
+ * Parse comma-separated list of integers (K/M suffix)
+ *
+ * @return number of elements (0 if malformed)
+ *
+ */
+static inline int
+parse_list(const char *str, long *list)
+{
+    char *end;
+    int n;
+
+    n = 0;
+    while (*str != '\0' && n < MAXN_LIST) {
+        list[n] = strtol(str, &end, 0);
+        if (end == str)
+            return 0;
+        if (*end == 'K' || *end == 'k')
+            list[n] *= KB, end++;
+        else if (*end == 'M' || *end == 'm')
+            list[n] *= MB, end++;
+        n++;
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return 0;
+        str = end;
+    }
+
+    return n;
+}
+
+
+/******************** Latency ***********************/
+/* latency (fine mode) before the rlat/wlat sweep */
+typedef struct _lat_saved {
+    int rlat;
+    int wlat;
+} lat_saved;
+
+/**
+ * Save current latency before the rlat/wlat sweep
+ * rlat/wlat are only programmable on ZC706 (warn if given for emulation)
+ *
+ */
+static inline void
+lat_save(lat_saved *orig, int n_rlat, const long *rlat, int n_wlat, const long *wlat)
+{
+#if !defined(ZC706)
+    if (n_rlat > 1 || n_wlat > 1 || rlat[0] != 0 || wlat[0] != 0)
+        fprintf(stderr, "rlat/wlat are ignored for emulation\n");
+#endif
+
+    NVMM_LatencyGet(&orig->rlat, &orig->wlat, NVMM_LAT_FINE);
+}
+
+/* restore latency saved by lat_save */
+static inline void
+lat_restore(const lat_saved *orig)
+{
+    NVMM_LatencySet(orig->rlat, orig->wlat, NVMM_LAT_FINE);
+}
+
+
+/******************** Timer *************************/
+static inline uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/******************** Random number ****************/
+/* xorshift32 (state must not be 0) */
+static inline uint32_t
+xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+
+/******************** Histogram *********************/
+/*
+ * log-linear histogram of latency [ns]
+ * each power of 2 is divided into 2^HIST_SUB_BITS buckets (error < 6.25%)
+ */
+#define HIST_SUB_BITS (4)
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_NBUCKET  (64 * HIST_SUB)
+
+typedef struct _hist {
+    uint64_t cnt[HIST_NBUCKET];
+    uint64_t n;
+    uint64_t sum;
+    uint64_t max;
+} hist;
+
+static inline int
+hist_idx(uint64_t v)
+{
+    int msb;
+
+    if (v < HIST_SUB)
+        return (int) v;
+
+    msb = 63 - __builtin_clzll(v);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB
+        + (int) ((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* lower bound of bucket */
+static inline uint64_t
+hist_val(int idx)
+{
+    int msb;
+
+    if (idx < HIST_SUB)
+        return idx;
+
+    msb = idx / HIST_SUB + HIST_SUB_BITS - 1;
+    return (uint64_t) (HIST_SUB + idx % HIST_SUB) << (msb - HIST_SUB_BITS);
+}
+
+static inline void
+hist_init(hist *h)
+{
+    memset(h, 0, sizeof(hist));
+}
+
+static inline void
+hist_add(hist *h, uint64_t v)
+{
+    h->cnt[hist_idx(v)]++;
+    h->n++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+}
+
+static inline void
+hist_merge(hist *dst, const hist *src)
+{
+    int i;
+
+    for (i = 0; i < HIST_NBUCKET; ++i)
+        dst->cnt[i] += src->cnt[i];
+    dst->n   += src->n;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/* p-th percentile (0.0 < p <= 1.0) */
+static inline uint64_t
+hist_pct(const hist *h, double p)
+{
+    uint64_t target, acc;
+    int i;
+
+    if (h->n == 0)
+        return 0;
+
+    target = (uint64_t) (p * h->n);
+    if (target == 0)
+        target = 1;
+
+    acc = 0;
+    for (i = 0; i < HIST_NBUCKET; ++i) {
+        acc += h->cnt[i];
+        if (acc >= target)
+            return hist_val(i);
+    }
+
+    return h->max;
+}
+
+/* CSV: name,count,avg,p50,p99,p999,max [ns] */
+static inline void
+hist_print_header(FILE *fp)
+{
+    fprintf(fp, "count,avg[ns],p50[ns],p99[ns],p999[ns],max[ns]");
+}
+
+static inline void
+hist_print(FILE *fp, const hist *h)
+{
+    fprintf(fp, "%llu,%.1f,%llu,%llu,%llu,%llu",
+            (unsigned long long) h->n,
+            (h->n > 0) ? (double) h->sum / h->n : 0.0,
+            (unsigned long long) hist_pct(h, 0.50),
+            (unsigned long long) hist_pct(h, 0.99),
+            (unsigned long long) hist_pct(h, 0.999),
+            (unsigned long long) h->max);
+}
+
+/* all non-empty buckets: lower bound [ns], count */
+static inline void
+hist_dump(FILE *fp, const char *name, const hist *h)
+{
+    int i;
+
+    for (i = 0; i < HIST_NBUCKET; ++i) {
+        if (h->cnt[i] > 0)
+            fprintf(fp, "# %s %llu %llu\n", name,
+                    (unsigned long long) hist_val(i), (unsigned long long) h->cnt[i]);
+    }
+}
+
+#endif /* _BENCHUTIL_H_INCLUDED */
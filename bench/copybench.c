@@ -0,0 +1,251 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * copybench: bandwidth of copy/fill into NVMM and cache pollution
+ *
+ * For each point of (rlat, wlat, mode, size), repeat iters times
+ *   1. copy (or fill) size bytes to [off, off + size) of NVMM and make it
+ *      persistent (timed)
+ *   2. read hot working set in DRAM (timed separately, cache pollution)
+ *   3. off += size
+ * where mode is
+ *   memcpy : memcpy, NVMM_FlushRangeRelax and NVMM_Fence
+ *   stream : NVMM_MemcpyPersist
+ *   memset : memset (0), NVMM_FlushRangeRelax and NVMM_Fence
+ *   sset   : NVMM_Memset (0) and NVMM_Fence
+ *
+ * rlat/wlat are programmed by NVMM_LatencySet (fine mode) and only
+ * available on ZC706.  Original latency is restored at exit.
+ *
+ * output
+ *   CSV: rlat,wlat,mode,size,bandwidth[MB/s],hot[ns] (read of hot set per iteration),
+ *        read,write,act,pre (deltas of memory requests, 0 for emulation)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libnvmm.h"
+#include "nvmm_latency.h"
+#include "benchutil.h"
+
+typedef unsigned char byte;
+
+#define CACHELINE (32)
+
+#define MODE_MEMCPY (0)
+#define MODE_STREAM (1)
+#define MODE_MEMSET (2)
+#define MODE_SSET   (3)
+#define NMODE       (4)
+
+static const char *mode_name[NMODE] = { "memcpy", "stream", "memset", "sset" };
+
+
+/******************** Parameters ********************/
+static long rlat[MAXN_LIST] = { 0 };
+static long wlat[MAXN_LIST] = { 0 };
+static long size[MAXN_LIST] = { 256, 4 * KB, 64 * KB, 1 * MB, 16 * MB };
+static int n_rlat = 1, n_wlat = 1, n_size = 5;
+
+static long   iters = 100;
+static size_t area  = 64 * MB;
+static size_t hot   = 16 * KB;
+
+
+/******************** Benchmark *********************/
+/**
+ * Run one point
+ *
+ * @param buf
+ *            NVMM area
+ * @param src
+ *            source in DRAM (largest size)
+ * @param set
+ *            hot working set in DRAM
+ * @param mode
+ *            MODE_*
+ * @param sz
+ *            bytes per copy
+ * @param hot_ns
+ *            time to read hot set (total)
+ * @param req
+ *            memory requests during the point
+ *
+ * @return elapsed time of copies [ns]
+ *
+ */
+static uint64_t
+run_point(byte *buf, const byte *src, const byte *set, int mode, size_t sz,
+          uint64_t *hot_ns, memreq *req)
+{
+    memreq start, end;
+    uint64_t t0, t1, t2, elapsed;
+    size_t off, i;
+    long n;
+    volatile byte sink;
+
+    elapsed = 0;
+    *hot_ns = 0;
+    off = 0;
+
+    NVMM_StartRequestStat(&start);
+    for (n = 0; n < iters; ++n) {
+        if (off + sz > area)
+            off = 0;
+
+        t0 = now_ns();
+        switch (mode) {
+        case MODE_MEMCPY:
+            memcpy(buf + off, src, sz);
+            NVMM_FlushRangeRelax(buf + off, sz);
+            NVMM_Fence();
+            break;
+        case MODE_STREAM:
+            NVMM_MemcpyPersist(buf + off, src, sz);
+            break;
+        case MODE_MEMSET:
+            memset(buf + off, 0, sz);
+            NVMM_FlushRangeRelax(buf + off, sz);
+            NVMM_Fence();
+            break;
+        case MODE_SSET:
+            NVMM_Memset(buf + off, 0, sz);
+            NVMM_Fence();
+            break;
+        }
+        t1 = now_ns();
+
+        /* hot set is evicted by copy if cache is polluted */
+        for (i = 0; i < hot; i += CACHELINE)
+            sink = set[i];
+        t2 = now_ns();
+
+        elapsed += t1 - t0;
+        *hot_ns += t2 - t1;
+        off += sz;
+    }
+    NVMM_EndRequestStat(&end);
+    (void) sink;
+
+    req->read  = end.read  - start.read;
+    req->write = end.write - start.write;
+    req->act   = end.act   - start.act;
+    req->pre   = end.pre   - start.pre;
+
+    return elapsed;
+}
+
+
+/******************** Main **************************/
+static void
+usage()
+{
+    fprintf(stderr,
+            "Usage: ./copybench [-s sizes] [-r rlats] [-w wlats] [-n iters] [-a area] [-c hot]\n"
+            "  each list is comma-separated (K/M suffix is allowed), e.g. -s 4K,1M\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    byte *buf, *src, *set;
+    memreq req;
+    uint64_t elapsed, hot_ns;
+    size_t max;
+    lat_saved orig;
+    int a, b, c, m, opt;
+    long tmp[1];
+
+    while ((opt = getopt(argc, argv, "s:r:w:n:a:c:")) != -1) {
+        switch (opt) {
+        case 's': n_size = parse_list(optarg, size); break;
+        case 'r': n_rlat = parse_list(optarg, rlat); break;
+        case 'w': n_wlat = parse_list(optarg, wlat); break;
+        case 'n': iters  = atol(optarg);             break;
+        case 'a':
+            if (parse_list(optarg, tmp) != 1)
+                usage();
+            area = (size_t) tmp[0];
+            break;
+        case 'c':
+            if (parse_list(optarg, tmp) != 1)
+                usage();
+            hot = (size_t) tmp[0];
+            break;
+        default:
+            usage();
+        }
+    }
+    if (n_size < 1 || n_rlat < 1 || n_wlat < 1 || iters < 1 || hot < 1)
+        usage();
+    max = 0;
+    for (a = 0; a < n_size; ++a) {
+        if (size[a] < 1 || (size_t) size[a] > area)
+            usage();
+        if ((size_t) size[a] > max)
+            max = size[a];
+    }
+
+    lat_save(&orig, n_rlat, rlat, n_wlat, wlat);
+
+    src = (byte *) malloc(max);
+    set = (byte *) malloc(hot);
+    memset(src, 0x5A, max);
+    memset(set, 0xA5, hot);
+
+    buf = (byte *) NVMM_Malloc(area);
+    memset(buf, 0, area);
+    NVMM_FlushRange(buf, area);
+
+    printf("rlat[ns],wlat[ns],mode,size[B],bandwidth[MB/s],hot[ns],read,write,act,pre\n");
+
+    for (a = 0; a < n_rlat; ++a)
+    for (b = 0; b < n_wlat; ++b) {
+        NVMM_LatencySet(rlat[a], wlat[b], NVMM_LAT_FINE);
+        for (c = 0; c < n_size; ++c)
+        for (m = 0; m < NMODE; ++m) {
+            elapsed = run_point(buf, src, set, m, size[c], &hot_ns, &req);
+            printf("%ld,%ld,%s,%ld,%.1f,%.0f,%lld,%lld,%lld,%lld\n",
+                   rlat[a], wlat[b], mode_name[m], size[c],
+                   (double) size[c] * iters / (elapsed / 1e9) / MB,
+                   (double) hot_ns / iters,
+                   (long long) req.read, (long long) req.write,
+                   (long long) req.act, (long long) req.pre);
+            fflush(stdout);
+        }
+    }
+
+    lat_restore(&orig);
+    NVMM_LatencyClose();
+    NVMM_Free(buf);
+    free(src);
+    free(set);
+
+    return 0;
+}
@@ -0,0 +1,531 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * crashcheck: crash-consistency test of nvmm_log, nvmm_tree and nvmm_hash
+ * by simulated power failure (libnvmm built with NVMM_CRASHSIM, emulation)
+ *
+ * For each structure,
+ *   1. run the workload once and count flush/fence events (E)
+ *   2. for each crash point p in [1, E + 1] (every step events),
+ *      rebuild the structure, arm NVMM_CrashPoint(p) and run the workload again.
+ *      At p, NVMM is replaced with the persisted image and the workload is
+ *      abandoned (longjmp).  The structure is recovered from NVMM and checked:
+ *        log:  entries are consecutive and intact, all committed entries remain
+ *        tree: every key has its value after completed ops (or after the op in
+ *              flight), and scan sees exactly the present keys
+ *        hash: same as tree (without scan)
+ *        hashcol: same as hash, but keys collide in low bits of both hash values
+ *                 (items cannot be placed at resize and table is rebuilt)
+ *
+ * output
+ *   CSV: struct,events,points,pass,fail
+ *   first failures per structure are reported to stderr (point,seed,reason)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+
+#include "libnvmm.h"
+#include "nvmm_log.h"
+#include "nvmm_tree.h"
+#include "nvmm_hash.h"
+#include "benchutil.h"
+
+#if !defined(NVMM_CRASHSIM)
+#error "crashcheck needs libnvmm with NVMM_CRASHSIM"
+#endif
+
+#define MAXN_REPORT (5)
+
+
+/******************** Parameters ********************/
+static long nops  = 1000; /* operations of workload */
+static long nkeys = 256;  /* key space of tree/hash */
+static long step  = 1;    /* interval of crash points */
+static int  seeds = 1;    /* random seeds per crash point */
+static int  flags = 0;    /* NVMM_CRASH_* */
+
+
+/******************** Crash *************************/
+static jmp_buf crash_env;
+
+static void
+on_crash(void *arg)
+{
+    longjmp(crash_env, 1);
+}
+
+
+/******************** Workloads *********************/
+/* progress of workload (read after longjmp) */
+static volatile long done;
+
+/*
+ * op i of tree/hash: set key to val (val 0 is delete)
+ */
+static uint64_t *op_key, *op_val;
+static uint64_t *expect;
+
+static void
+gen_ops()
+{
+    uint32_t x = 2463534242U;
+    long i;
+
+    op_key = (uint64_t *) malloc(sizeof(uint64_t) * nops);
+    op_val = (uint64_t *) malloc(sizeof(uint64_t) * nops);
+    expect = (uint64_t *) malloc(sizeof(uint64_t) * (nkeys + 1));
+
+    for (i = 0; i < nops; ++i) {
+        op_key[i] = 1 + xorshift32(&x) % nkeys;
+        op_val[i] = (xorshift32(&x) % 4 == 0) ? 0 : (uint64_t) i + 1;
+    }
+}
+
+/* expected value of each key after done ops */
+static void
+replay()
+{
+    long i;
+
+    memset(expect, 0, sizeof(uint64_t) * (nkeys + 1));
+    for (i = 0; i < done; ++i)
+        expect[op_key[i]] = op_val[i];
+}
+
+/* got is expected value of key (after done ops, or after op in flight) */
+static int
+check_key(uint64_t key, uint64_t got)
+{
+    if (got == expect[key])
+        return 1;
+    return done < nops && op_key[done] == key && op_val[done] == got;
+}
+
+
+/*
+ * log: entry i has payload of id i, committed every 4 entries,
+ * truncated to tail when full
+ */
+#define LOG_SIZE  (4096)
+#define LOG_LEN   (40)
+#define LOG_BATCH (4)
+
+static void *log_buf;
+static nvmm_log *log_handle;
+static volatile long log_first; /* first committed id after truncate */
+
+static void
+log_payload(uint64_t *p, uint64_t id)
+{
+    int i;
+
+    p[0] = id;
+    for (i = 1; i < LOG_LEN / 8; ++i)
+        p[i] = id * 0x9E3779B97F4A7C15ULL + i;
+}
+
+static void
+log_setup()
+{
+    log_buf = NVMM_Malloc(LOG_SIZE);
+    log_handle = NVMM_LogCreate(log_buf, LOG_SIZE);
+    log_first = 0;
+    done = 0;
+}
+
+static void
+log_run()
+{
+    uint64_t p[LOG_LEN / 8], lsn, first;
+    long id;
+
+    first = NVMM_LogTail(log_handle);
+    for (id = 0; id < nops; ++id) {
+        log_payload(p, id);
+        lsn = NVMM_LogAppend(log_handle, p, LOG_LEN);
+        if (lsn == NVMM_LOG_FULL) {
+            /* entries before id are committed (and may be lost from now) */
+            log_first = id;
+            NVMM_LogTruncate(log_handle, NVMM_LogTail(log_handle));
+            first = lsn = NVMM_LogAppend(log_handle, p, LOG_LEN);
+        }
+
+        if ((id + 1) % LOG_BATCH == 0) {
+            NVMM_LogCommit(log_handle, first, lsn);
+            done = id + 1;
+            first = NVMM_LogTail(log_handle);
+        }
+    }
+}
+
+static const char *
+log_verify()
+{
+    const uint64_t *e;
+    uint64_t p[LOG_LEN / 8], lsn;
+    const char *err;
+    long id, first;
+    size_t len;
+
+    log_handle = NVMM_LogOpen(log_buf, LOG_SIZE);
+    if (log_handle == NULL)
+        return "log is lost";
+
+    err = NULL;
+    first = -1;
+    id = 0;
+    lsn = NVMM_LogHead(log_handle);
+    while ((e = (const uint64_t *) NVMM_LogNext(log_handle, &lsn, &len)) != NULL) {
+        if (first < 0)
+            first = id = (long) e[0];
+        log_payload(p, id);
+        if (len != LOG_LEN || memcmp(e, p, LOG_LEN) != 0) {
+            err = "entry is broken or out of order";
+            break;
+        }
+        id++;
+    }
+
+    if (err == NULL && done > log_first && (first < 0 || first > log_first || id < done))
+        err = "committed entry is lost";
+
+    NVMM_LogClose(log_handle);
+    NVMM_Free(log_buf);
+    return err;
+}
+
+
+/*
+ * tree
+ */
+static void *tree_root;
+static nvmm_tree *tree_handle;
+
+static void
+tree_setup()
+{
+    tree_handle = NVMM_TreeCreate();
+    tree_root = NVMM_TreeRoot(tree_handle);
+    done = 0;
+}
+
+static void
+tree_run()
+{
+    long i;
+
+    for (i = 0; i < nops; ++i) {
+        if (op_val[i] != 0)
+            NVMM_TreeInsert(tree_handle, op_key[i], op_val[i]);
+        else
+            NVMM_TreeDelete(tree_handle, op_key[i]);
+        done = i + 1;
+    }
+}
+
+static const char *
+tree_verify()
+{
+    uint64_t *keys, *vals, key, val;
+    const char *err;
+    size_t m, present, j;
+
+    tree_handle = NVMM_TreeRecover(tree_root);
+    if (tree_handle == NULL)
+        return "tree is lost";
+
+    replay();
+    err = NULL;
+    present = 0;
+    for (key = 1; key <= (uint64_t) nkeys; ++key) {
+        if (!NVMM_TreeLookup(tree_handle, key, &val))
+            val = 0;
+        if (!check_key(key, val)) {
+            err = "wrong value";
+            break;
+        }
+        present += (val != 0);
+    }
+
+    if (err == NULL) {
+        keys = (uint64_t *) malloc(sizeof(uint64_t) * (nkeys + 1));
+        vals = (uint64_t *) malloc(sizeof(uint64_t) * (nkeys + 1));
+        m = NVMM_TreeScan(tree_handle, 0, nkeys + 1, keys, vals);
+        if (m != present)
+            err = "scan differs from lookup";
+        for (j = 1; err == NULL && j < m; ++j) {
+            if (keys[j - 1] >= keys[j])
+                err = "scan is not sorted";
+        }
+        free(keys);
+        free(vals);
+    }
+
+    NVMM_TreeDestroy(tree_handle);
+    return err;
+}
+
+
+/*
+ * hash (small capacity to cause resizing)
+ * key k is hash_keys[k] if hash_keys is set (hashcol)
+ */
+#define COL_BITS (4)  /* low bits of both hash values shared by colliding keys */
+
+static void *hash_root;
+static nvmm_hash *hash_handle;
+static uint64_t *hash_keys, *col_keys;
+
+static inline uint64_t
+hash_key(uint64_t key)
+{
+    return (hash_keys == NULL) ? key : hash_keys[key];
+}
+
+/* hash of nvmm_hash.c (seed of NVMM_HashCreate) */
+static inline uint64_t
+hash_mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/* keys whose 2 hash values have the same low COL_BITS bits */
+static void
+gen_col_keys()
+{
+    const uint64_t seed = 0x2545F4914F6CDD1DULL;
+    const uint64_t mask = (1ULL << COL_BITS) - 1;
+    uint64_t key, h0;
+    long k;
+
+    col_keys = (uint64_t *) malloc(sizeof(uint64_t) * (nkeys + 1));
+    col_keys[0] = 0;
+
+    k = 1;
+    for (key = 1; k <= nkeys; ++key) {
+        h0 = hash_mix(key ^ seed);
+        if ((h0 & mask) == 0 && (hash_mix(key ^ ~seed) & mask) == 0)
+            col_keys[k++] = key;
+    }
+}
+
+static void
+hash_setup()
+{
+    hash_handle = NVMM_HashCreate(16);
+    hash_root = NVMM_HashRoot(hash_handle);
+    hash_keys = NULL;
+    done = 0;
+}
+
+static void
+hashcol_setup()
+{
+    hash_setup();
+    hash_keys = col_keys;
+}
+
+static void
+hash_run()
+{
+    long i;
+
+    for (i = 0; i < nops; ++i) {
+        if (op_val[i] != 0)
+            NVMM_HashInsert(hash_handle, hash_key(op_key[i]), op_val[i]);
+        else
+            NVMM_HashDelete(hash_handle, hash_key(op_key[i]));
+        done = i + 1;
+    }
+}
+
+static const char *
+hash_verify()
+{
+    const char *err;
+    uint64_t key, val;
+    size_t present;
+
+    hash_handle = NVMM_HashRecover(hash_root);
+    if (hash_handle == NULL)
+        return "hash is lost";
+
+    replay();
+    err = NULL;
+    present = 0;
+    for (key = 1; key <= (uint64_t) nkeys; ++key) {
+        if (!NVMM_HashLookup(hash_handle, hash_key(key), &val))
+            val = 0;
+        if (!check_key(key, val)) {
+            err = "wrong value";
+            break;
+        }
+        present += (val != 0);
+    }
+
+    if (err == NULL && NVMM_HashCount(hash_handle) != present)
+        err = "count differs from lookup";
+
+    NVMM_HashDestroy(hash_handle);
+    return err;
+}
+
+
+typedef struct _workload {
+    const char *name;
+    void (*setup)();
+    void (*run)();
+    const char *(*verify)();
+} workload;
+
+static workload workloads[] = {
+    { "log",  log_setup,  log_run,  log_verify  },
+    { "tree", tree_setup, tree_run, tree_verify },
+    { "hash", hash_setup, hash_run, hash_verify },
+    { "hashcol", hashcol_setup, hash_run, hash_verify },
+};
+#define NWORKLOAD ((int) (sizeof(workloads) / sizeof(workloads[0])))
+
+
+/**
+ * Crash workload at every point and verify recovery
+ *
+ * @param w
+ *            target workload
+ *
+ * @return number of failures
+ *
+ */
+static long
+check(workload *w)
+{
+    const char *err;
+    long events, p, points, fail;
+    unsigned int seed;
+
+    /* count events of clean run (crash after completion) */
+    w->setup();
+    events = NVMM_CrashEvents();
+    w->run();
+    events = NVMM_CrashEvents() - events;
+    NVMM_CrashSimulate(1, flags);
+    err = w->verify();
+    if (err != NULL)
+        fprintf(stderr, "%s: after completion: %s\n", w->name, err);
+
+    points = fail = 0;
+    for (p = 1; p <= events + 1; p += step) {
+        for (seed = 1; seed <= (unsigned int) seeds; ++seed) {
+            w->setup();
+            NVMM_CrashPoint(p, seed, flags, on_crash, NULL);
+            if (setjmp(crash_env) == 0) {
+                w->run();
+                NVMM_CrashPoint(0, 0, 0, NULL, NULL);
+                NVMM_CrashSimulate(seed, flags);
+            }
+
+            points++;
+            err = w->verify();
+            if (err == NULL)
+                continue;
+
+            if (fail++ < MAXN_REPORT)
+                fprintf(stderr, "%s: point %ld, seed %u (op %ld): %s\n",
+                        w->name, p, seed, (long) done, err);
+        }
+    }
+
+    printf("%s,%ld,%ld,%ld,%ld\n", w->name, events, points, points - fail, fail);
+    fflush(stdout);
+    return fail;
+}
+
+
+/******************** Main **************************/
+static void
+usage()
+{
+    fprintf(stderr,
+            "Usage: ./crashcheck [-n ops] [-k keys] [-s step] [-x seeds] [-o] [-e] [structs]\n"
+            "  -o: persist random subset of unfenced flushes (reorder)\n"
+            "  -e: persist random subset of dirty lines (eviction)\n"
+            "  structs: log, tree, hash, hashcol (default all)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    long fail;
+    int i, j, opt;
+
+    while ((opt = getopt(argc, argv, "n:k:s:x:oe")) != -1) {
+        switch (opt) {
+        case 'n': nops  = atol(optarg);           break;
+        case 'k': nkeys = atol(optarg);           break;
+        case 's': step  = atol(optarg);           break;
+        case 'x': seeds = atoi(optarg);           break;
+        case 'o': flags |= NVMM_CRASH_REORDER;    break;
+        case 'e': flags |= NVMM_CRASH_EVICT;      break;
+        default:
+            usage();
+        }
+    }
+    if (nops < 1 || nkeys < 1 || step < 1 || seeds < 1)
+        usage();
+
+    gen_ops();
+    gen_col_keys();
+
+    printf("struct,events,points,pass,fail\n");
+    fail = 0;
+    for (i = 0; i < NWORKLOAD; ++i) {
+        if (optind < argc) {
+            for (j = optind; j < argc; ++j) {
+                if (strcmp(argv[j], workloads[i].name) == 0)
+                    break;
+            }
+            if (j == argc)
+                continue;
+        }
+        fail += check(&workloads[i]);
+    }
+
+    free(op_key);
+    free(op_val);
+    free(expect);
+    free(col_keys);
+
+    return fail != 0;
+}
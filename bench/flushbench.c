@@ -0,0 +1,223 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * flushbench: cost of NVMM_FlushRange/NVMM_FlushRangeRelax
+ *
+ * For each point of (rlat, wlat, size, stride, fence), repeat
+ *   1. dirty [off, off + size) (one store per cache line)
+ *   2. flush [off, off + size)             (timed)
+ *   3. off += stride
+ * where
+ *   fence = 0 : NVMM_FlushRange (DSB before/after DCCMVACs in wbmod)
+ *   fence = k : NVMM_FlushRangeRelax, and NVMM_Fence after every k flushes
+ *               (fence time is included in the flush that issued it)
+ *
+ * rlat/wlat are programmed by NVMM_LatencySet (fine mode) and only
+ * available on ZC706.  Original latency is restored at exit.
+ *
+ * output
+ *   CSV: rlat,wlat,size,stride,fence,count,avg,p50,p99,p999,max,MB/s,
+ *        read,write,act,pre (deltas of memory requests, 0 for emulation)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libnvmm.h"
+#include "nvmm_latency.h"
+#include "benchutil.h"
+
+typedef unsigned char byte;
+
+#define CACHELINE  (32)
+
+
+/******************** Parameters ********************/
+static long rlat[MAXN_LIST]   = { 0 };
+static long wlat[MAXN_LIST]   = { 0 };
+static long size[MAXN_LIST]   = { 32, 64, 128, 256, 512, 1 * KB, 2 * KB, 4 * KB,
+                                  8 * KB, 16 * KB, 32 * KB, 64 * KB };
+static long stride[MAXN_LIST] = { 0 };
+static long fence[MAXN_LIST]  = { 0, 1, 4, 16 };
+static int n_rlat = 1, n_wlat = 1, n_size = 12, n_stride = 1, n_fence = 4;
+
+static long   iters = 100000;
+static size_t area  = 64 * MB;
+
+
+/******************** Benchmark *********************/
+/**
+ * Run one point
+ *
+ * @param buf
+ *            NVMM area
+ * @param sz
+ *            bytes per flush
+ * @param st
+ *            distance between flushes (0: sz)
+ * @param fn
+ *            flushes per fence (0: NVMM_FlushRange)
+ * @param h
+ *            histogram of flush latency
+ * @param req
+ *            memory requests during the point
+ *
+ * @return elapsed time [ns]
+ *
+ */
+static uint64_t
+run_point(byte *buf, size_t sz, size_t st, long fn, hist *h, memreq *req)
+{
+    memreq start, end;
+    uint64_t t0, t1, elapsed;
+    size_t off, i;
+    long n;
+
+    if (st == 0)
+        st = sz;
+
+    hist_init(h);
+    elapsed = 0;
+    off = 0;
+
+    NVMM_StartRequestStat(&start);
+    for (n = 0; n < iters; ++n) {
+        if (off + sz > area)
+            off = 0;
+
+        for (i = 0; i < sz; i += CACHELINE)
+            ((volatile byte *) buf)[off + i] = (byte) n;
+
+        t0 = now_ns();
+        if (fn == 0) {
+            NVMM_FlushRange(buf + off, sz);
+        } else {
+            NVMM_FlushRangeRelax(buf + off, sz);
+            if ((n + 1) % fn == 0)
+                NVMM_Fence();
+        }
+        t1 = now_ns();
+
+        hist_add(h, t1 - t0);
+        elapsed += t1 - t0;
+        off += st;
+    }
+    if (fn != 0)
+        NVMM_Fence();
+    NVMM_EndRequestStat(&end);
+
+    req->read  = end.read  - start.read;
+    req->write = end.write - start.write;
+    req->act   = end.act   - start.act;
+    req->pre   = end.pre   - start.pre;
+
+    return elapsed;
+}
+
+
+/******************** Main **************************/
+static void
+usage()
+{
+    fprintf(stderr,
+            "Usage: ./flushbench [-s sizes] [-d strides] [-f fences] [-r rlats] [-w wlats]\n"
+            "                    [-n iters] [-a area]\n"
+            "  each list is comma-separated (K/M suffix is allowed), e.g. -s 32,1K,64K\n"
+            "  stride 0 means stride = size, fence 0 means NVMM_FlushRange\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    byte *buf;
+    hist h;
+    memreq req;
+    uint64_t elapsed;
+    lat_saved orig;
+    int a, b, c, d, e, opt;
+    long tmp[1];
+
+    while ((opt = getopt(argc, argv, "s:d:f:r:w:n:a:")) != -1) {
+        switch (opt) {
+        case 's': n_size   = parse_list(optarg, size);   break;
+        case 'd': n_stride = parse_list(optarg, stride); break;
+        case 'f': n_fence  = parse_list(optarg, fence);  break;
+        case 'r': n_rlat   = parse_list(optarg, rlat);   break;
+        case 'w': n_wlat   = parse_list(optarg, wlat);   break;
+        case 'n': iters    = atol(optarg);               break;
+        case 'a':
+            if (parse_list(optarg, tmp) != 1)
+                usage();
+            area = (size_t) tmp[0];
+            break;
+        default:
+            usage();
+        }
+    }
+    if (n_size < 1 || n_stride < 1 || n_fence < 1 || n_rlat < 1 || n_wlat < 1 ||
+        iters < 1)
+        usage();
+    for (a = 0; a < n_size; ++a) {
+        if (size[a] < 1 || (size_t) size[a] > area)
+            usage();
+    }
+
+    lat_save(&orig, n_rlat, rlat, n_wlat, wlat);
+
+    buf = (byte *) NVMM_Malloc(area);
+    memset(buf, 0, area);
+    NVMM_FlushRange(buf, area);
+
+    printf("rlat[ns],wlat[ns],size[B],stride[B],fence,");
+    hist_print_header(stdout);
+    printf(",bandwidth[MB/s],read,write,act,pre\n");
+
+    for (a = 0; a < n_rlat; ++a)
+    for (b = 0; b < n_wlat; ++b) {
+        NVMM_LatencySet(rlat[a], wlat[b], NVMM_LAT_FINE);
+        for (c = 0; c < n_size; ++c)
+        for (d = 0; d < n_stride; ++d)
+        for (e = 0; e < n_fence; ++e) {
+            elapsed = run_point(buf, size[c], stride[d], fence[e], &h, &req);
+            printf("%ld,%ld,%ld,%ld,%ld,", rlat[a], wlat[b], size[c],
+                   (stride[d] == 0) ? size[c] : stride[d], fence[e]);
+            hist_print(stdout, &h);
+            printf(",%.1f,%lld,%lld,%lld,%lld\n",
+                   (double) size[c] * iters / (elapsed / 1e9) / MB,
+                   (long long) req.read, (long long) req.write,
+                   (long long) req.act, (long long) req.pre);
+            fflush(stdout);
+        }
+    }
+
+    lat_restore(&orig);
+    NVMM_LatencyClose();
+    NVMM_Free(buf);
+
+    return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * hashbench: YCSB-style benchmark of persistent hash table (nvmm_hash)
+ *
+ * For each number of threads, run workloads on a new table
+ *   load : insert records (table grows from 16 items, incremental resize)
+ *   a    : 50% read, 50% update
+ *   b    : 95% read,  5% update
+ *   c    : 100% read
+ *   d    : 95% read (latest records), 5% insert
+ * Keys are chosen by scrambled zipfian distribution (theta = 0.99) as YCSB,
+ * or by uniform distribution (-u).
+ *
+ * output
+ *   CSV: workload,dist,threads,ops,time,ops/s,read,write,read/op,write/op
+ *        (deltas of memory requests, 0 for emulation)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "libnvmm.h"
+#include "nvmm_hash.h"
+#include "benchutil.h"
+
+#define MAXN_THREADS (64)
+#define ZIPF_THETA   (0.99)
+
+
+/******************** Parameters ********************/
+static long threads[MAXN_LIST] = { 1, 2, 4 };
+static int n_threads = 3;
+
+static long records = 1000000;
+static long ops     = 1000000;
+static int  uniform = 0;
+
+
+/******************** Key generator *****************/
+/* key of i-th record (not 0) */
+static inline uint64_t
+key_of(uint64_t i)
+{
+    return (i + 1) * 0x9E3779B97F4A7C15ULL;
+}
+
+/* zipfian generator (Gray et al., as YCSB) */
+static double zipf_zetan, zipf_alpha, zipf_eta;
+
+static void
+zipf_init(long n)
+{
+    double zeta2;
+    long i;
+
+    zipf_zetan = 0;
+    for (i = 1; i <= n; ++i)
+        zipf_zetan += 1.0 / pow((double) i, ZIPF_THETA);
+    zeta2 = 1.0 + 1.0 / pow(2.0, ZIPF_THETA);
+
+    zipf_alpha = 1.0 / (1.0 - ZIPF_THETA);
+    zipf_eta   = (1.0 - pow(2.0 / n, 1.0 - ZIPF_THETA)) / (1.0 - zeta2 / zipf_zetan);
+}
+
+/* rank in [0, n) (0 is the hottest) */
+static inline uint64_t
+zipf_next(uint32_t *seed, long n)
+{
+    double u, uz;
+
+    u  = (double) xorshift32(seed) / 4294967296.0;
+    uz = u * zipf_zetan;
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow(0.5, ZIPF_THETA))
+        return 1;
+
+    return (uint64_t) (n * pow(zipf_eta * u - zipf_eta + 1.0, zipf_alpha)) % n;
+}
+
+/* record in [0, n) */
+static inline uint64_t
+next_record(uint32_t *seed, long n)
+{
+    uint64_t x;
+
+    if (uniform)
+        return xorshift32(seed) % n;
+
+    /* scramble, so hot records are spread over the table */
+    x = zipf_next(seed, n) * 0xBF58476D1CE4E5B9ULL;
+    return (x ^ (x >> 31)) % n;
+}
+
+
+/******************** Benchmark *********************/
+typedef struct _worker {
+    pthread_t th;
+    int id;
+    int nt;
+    int read_pct;   /* -1 for load */
+    int latest;     /* workload d */
+} worker;
+
+static nvmm_hash *table;
+static pthread_barrier_t barrier;
+static long inserted; /* records in table (workload d) */
+
+static void *
+run_worker(void *arg)
+{
+    worker *w = (worker *) arg;
+    uint32_t seed = 2463534242U + w->id * 7919;
+    uint64_t val, sum, r;
+    long n, i, cnt;
+
+    sum = 0;
+    pthread_barrier_wait(&barrier);
+
+    if (w->read_pct < 0) {
+        for (i = w->id; i < records; i += w->nt)
+            NVMM_HashInsert(table, key_of(i), i);
+        return NULL;
+    }
+
+    n = ops / w->nt;
+    for (i = 0; i < n; ++i) {
+        if ((long) (xorshift32(&seed) % 100) < w->read_pct) {
+            if (w->latest) {
+                cnt = __atomic_load_n(&inserted, __ATOMIC_RELAXED);
+                r = cnt - 1 - next_record(&seed, cnt < records ? cnt : records);
+            } else {
+                r = next_record(&seed, records);
+            }
+            if (NVMM_HashLookup(table, key_of(r), &val))
+                sum += val;
+        } else if (w->latest) {
+            r = __atomic_fetch_add(&inserted, 1, __ATOMIC_RELAXED);
+            NVMM_HashInsert(table, key_of(r), r);
+        } else {
+            NVMM_HashInsert(table, key_of(next_record(&seed, records)), i);
+        }
+    }
+
+    /* keep lookups */
+    if (sum == 1)
+        fprintf(stderr, "\n");
+
+    return NULL;
+}
+
+/**
+ * Run one workload by nt threads
+ *
+ * @param name
+ *            name of workload
+ * @param read_pct
+ *            percentage of read (-1 for load)
+ * @param latest
+ *            read latest records and insert new ones (workload d)
+ *
+ * @return none
+ *
+ */
+static void
+run_workload(const char *name, int nt, int read_pct, int latest)
+{
+    worker w[MAXN_THREADS];
+    memreq start, end;
+    uint64_t t0, t1;
+    long n;
+    int i;
+
+    pthread_barrier_init(&barrier, NULL, nt + 1);
+    for (i = 0; i < nt; ++i) {
+        w[i].id       = i;
+        w[i].nt       = nt;
+        w[i].read_pct = read_pct;
+        w[i].latest   = latest;
+        pthread_create(&w[i].th, NULL, run_worker, &w[i]);
+    }
+
+    NVMM_StartRequestStat(&start);
+    t0 = now_ns();
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < nt; ++i)
+        pthread_join(w[i].th, NULL);
+    t1 = now_ns();
+    NVMM_EndRequestStat(&end);
+
+    pthread_barrier_destroy(&barrier);
+
+    n = (read_pct < 0) ? records : ops / nt * nt;
+    printf("%s,%s,%d,%ld,%.3f,%.0f,%lld,%lld,%.2f,%.2f\n", name,
+           uniform ? "uniform" : "zipfian", nt, n, (t1 - t0) / 1e9, n / ((t1 - t0) / 1e9),
+           (long long) (end.read - start.read), (long long) (end.write - start.write),
+           (double) (end.read - start.read) / n, (double) (end.write - start.write) / n);
+    fflush(stdout);
+}
+
+
+/******************** Main **************************/
+static void
+usage()
+{
+    fprintf(stderr,
+            "Usage: ./hashbench [-t threads] [-n records] [-o ops] [-u]\n"
+            "  threads are comma-separated, e.g. -t 1,2,4\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int a, opt;
+
+    while ((opt = getopt(argc, argv, "t:n:o:u")) != -1) {
+        switch (opt) {
+        case 't': n_threads = parse_list(optarg, threads); break;
+        case 'n': records   = atol(optarg);                break;
+        case 'o': ops       = atol(optarg);                break;
+        case 'u': uniform   = 1;                           break;
+        default:
+            usage();
+        }
+    }
+    if (n_threads < 1 || records < 2 || ops < 1)
+        usage();
+    for (a = 0; a < n_threads; ++a) {
+        if (threads[a] < 1 || threads[a] > MAXN_THREADS)
+            usage();
+    }
+
+    zipf_init(records);
+
+    printf("workload,dist,threads,ops,time[s],ops/s,read,write,read/op,write/op\n");
+    for (a = 0; a < n_threads; ++a) {
+        table    = NVMM_HashCreate(16);
+        inserted = records;
+
+        run_workload("load", threads[a], -1, 0);
+        run_workload("a", threads[a], 50, 0);
+        run_workload("b", threads[a], 95, 0);
+        run_workload("c", threads[a], 100, 0);
+        run_workload("d", threads[a], 95, 1);
+
+        NVMM_HashDestroy(table);
+    }
+
+    return 0;
+}
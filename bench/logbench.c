@@ -0,0 +1,259 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * logbench: throughput of append-only log (nvmm_log)
+ *
+ * For each point of (rlat, wlat, size, threads, batch), every thread repeats
+ *   1. NVMM_LogAppend an entry of size bytes
+ *   2. NVMM_LogCommit after every batch entries (group commit, timed)
+ * The log is truncated to tail when it is full (checkpoint).
+ *
+ * rlat/wlat are programmed by NVMM_LatencySet (fine mode) and only
+ * available on ZC706.  Original latency is restored at exit.
+ *
+ * output
+ *   CSV: rlat,wlat,size,threads,batch,appends/s,MB/s,
+ *        count,avg,p50,p99,p999,max (latency of group commit),
+ *        read,write,act,pre (deltas of memory requests, 0 for emulation)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "libnvmm.h"
+#include "nvmm_latency.h"
+#include "nvmm_log.h"
+#include "benchutil.h"
+
+typedef unsigned char byte;
+
+#define MAXN_THREADS (64)
+
+
+/******************** Parameters ********************/
+static long rlat[MAXN_LIST]    = { 0 };
+static long wlat[MAXN_LIST]    = { 0 };
+static long size[MAXN_LIST]    = { 16, 48, 112, 240, 496, 1008, 4080 };
+static long threads[MAXN_LIST] = { 1, 2, 4 };
+static long batch[MAXN_LIST]   = { 1, 8, 64 };
+static int n_rlat = 1, n_wlat = 1, n_size = 7, n_threads = 3, n_batch = 3;
+
+static long   iters = 100000;
+static size_t area  = 16 * MB;
+
+
+/******************** Benchmark *********************/
+typedef struct _worker {
+    pthread_t th;
+    nvmm_log *log;
+    size_t sz;
+    long bt;
+    hist h;
+} worker;
+
+static pthread_barrier_t barrier;
+
+static void *
+run_worker(void *arg)
+{
+    worker *w = (worker *) arg;
+    byte data[w->sz];
+    uint64_t first, lsn, t0;
+    long n;
+
+    memset(data, 0xA5, w->sz);
+    hist_init(&w->h);
+    first = 0;
+
+    pthread_barrier_wait(&barrier);
+    for (n = 0; n < iters; ++n) {
+        while ((lsn = NVMM_LogAppend(w->log, data, w->sz)) == NVMM_LOG_FULL)
+            NVMM_LogTruncate(w->log, NVMM_LogTail(w->log));
+
+        if (n % w->bt == 0)
+            first = lsn;
+        if ((n + 1) % w->bt == 0 || n + 1 == iters) {
+            t0 = now_ns();
+            NVMM_LogCommit(w->log, first, lsn);
+            hist_add(&w->h, now_ns() - t0);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Run one point
+ *
+ * @param buf
+ *            NVMM area for log
+ * @param sz
+ *            bytes of payload
+ * @param nt
+ *            number of threads
+ * @param bt
+ *            entries per group commit
+ * @param h
+ *            histogram of group commit latency
+ * @param req
+ *            memory requests during the point
+ *
+ * @return elapsed time [ns]
+ *
+ */
+static uint64_t
+run_point(byte *buf, size_t sz, int nt, long bt, hist *h, memreq *req)
+{
+    worker w[MAXN_THREADS];
+    nvmm_log *log;
+    memreq start, end;
+    uint64_t t0, t1;
+    int i;
+
+    log = NVMM_LogCreate(buf, area);
+    pthread_barrier_init(&barrier, NULL, nt + 1);
+    for (i = 0; i < nt; ++i) {
+        w[i].log = log;
+        w[i].sz  = sz;
+        w[i].bt  = bt;
+        pthread_create(&w[i].th, NULL, run_worker, &w[i]);
+    }
+
+    NVMM_StartRequestStat(&start);
+    t0 = now_ns();
+    pthread_barrier_wait(&barrier);
+
+    hist_init(h);
+    for (i = 0; i < nt; ++i) {
+        pthread_join(w[i].th, NULL);
+        hist_merge(h, &w[i].h);
+    }
+    t1 = now_ns();
+    NVMM_EndRequestStat(&end);
+
+    pthread_barrier_destroy(&barrier);
+    NVMM_LogClose(log);
+
+    req->read  = end.read  - start.read;
+    req->write = end.write - start.write;
+    req->act   = end.act   - start.act;
+    req->pre   = end.pre   - start.pre;
+
+    return t1 - t0;
+}
+
+
+/******************** Main **************************/
+static void
+usage()
+{
+    fprintf(stderr,
+            "Usage: ./logbench [-s sizes] [-t threads] [-b batches] [-r rlats] [-w wlats]\n"
+            "                  [-n iters] [-a area]\n"
+            "  each list is comma-separated (K/M suffix is allowed), e.g. -s 16,1K\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    byte *buf;
+    hist h;
+    memreq req;
+    uint64_t elapsed;
+    double ops;
+    lat_saved orig;
+    int a, b, c, d, e, opt;
+    long tmp[1];
+
+    while ((opt = getopt(argc, argv, "s:t:b:r:w:n:a:")) != -1) {
+        switch (opt) {
+        case 's': n_size    = parse_list(optarg, size);    break;
+        case 't': n_threads = parse_list(optarg, threads); break;
+        case 'b': n_batch   = parse_list(optarg, batch);   break;
+        case 'r': n_rlat    = parse_list(optarg, rlat);    break;
+        case 'w': n_wlat    = parse_list(optarg, wlat);    break;
+        case 'n': iters     = atol(optarg);                break;
+        case 'a':
+            if (parse_list(optarg, tmp) != 1)
+                usage();
+            area = (size_t) tmp[0];
+            break;
+        default:
+            usage();
+        }
+    }
+    if (n_size < 1 || n_threads < 1 || n_batch < 1 || n_rlat < 1 || n_wlat < 1 ||
+        iters < 1)
+        usage();
+    for (a = 0; a < n_size; ++a) {
+        /* several entries of each thread must fit in the log */
+        if (size[a] < 0 || (size_t) size[a] * MAXN_THREADS * 4 > area)
+            usage();
+    }
+    for (a = 0; a < n_threads; ++a) {
+        if (threads[a] < 1 || threads[a] > MAXN_THREADS)
+            usage();
+    }
+    for (a = 0; a < n_batch; ++a) {
+        if (batch[a] < 1)
+            usage();
+    }
+
+    lat_save(&orig, n_rlat, rlat, n_wlat, wlat);
+
+    buf = (byte *) NVMM_Malloc(area);
+
+    printf("rlat[ns],wlat[ns],size[B],threads,batch,appends/s,bandwidth[MB/s],");
+    hist_print_header(stdout);
+    printf(",read,write,act,pre\n");
+
+    for (a = 0; a < n_rlat; ++a)
+    for (b = 0; b < n_wlat; ++b) {
+        NVMM_LatencySet(rlat[a], wlat[b], NVMM_LAT_FINE);
+        for (c = 0; c < n_size; ++c)
+        for (d = 0; d < n_threads; ++d)
+        for (e = 0; e < n_batch; ++e) {
+            elapsed = run_point(buf, size[c], threads[d], batch[e], &h, &req);
+            ops = (double) iters * threads[d] / (elapsed / 1e9);
+            printf("%ld,%ld,%ld,%ld,%ld,%.0f,%.1f,", rlat[a], wlat[b], size[c],
+                   threads[d], batch[e], ops, ops * size[c] / MB);
+            hist_print(stdout, &h);
+            printf(",%lld,%lld,%lld,%lld\n",
+                   (long long) req.read, (long long) req.write,
+                   (long long) req.act, (long long) req.pre);
+            fflush(stdout);
+        }
+    }
+
+    lat_restore(&orig);
+    NVMM_LatencyClose();
+    NVMM_Free(buf);
+
+    return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * pptrbench: cost of persistent pointer (nvmm_pptr) against raw pointer
+ *
+ * Nodes are linked in random order by both of raw pointer and nvmm_pptr,
+ * and the chain is followed by
+ *   raw    : p = p->raw
+ *   pptr   : p = NVMM_PPTR_GET(p->pptr)        (bias is loaded per hop)
+ *   cached : p = NVMM_PPTR_AT(bias, p->pptr)   (bias is cached, one add)
+ * Working set is doubled from 64 KiB to given size, so both of cache-hit
+ * and memory-bound chains are measured.
+ *
+ * output
+ *   CSV: working_set,stride,raw,pptr,cached [ns/hop]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "libnvmm.h"
+#include "benchutil.h"
+
+typedef struct _node {
+    struct _node *raw;
+    nvmm_pptr pptr;
+} node;
+
+static uint32_t rng = 2463534242U;
+
+/* link nodes in a random single cycle (Sattolo's algorithm) */
+static void
+build_cycle(char *base, size_t nnode, size_t stride, size_t *perm)
+{
+    node *n;
+    size_t i, j, t;
+
+    for (i = 0; i < nnode; ++i)
+        perm[i] = i;
+    for (i = nnode - 1; i > 0; --i) {
+        j = xorshift32(&rng) % i;
+        t = perm[i]; perm[i] = perm[j]; perm[j] = t;
+    }
+    for (i = 0; i < nnode; ++i) {
+        n = (node *) (base + perm[i] * stride);
+        n->raw  = (node *) (base + perm[(i + 1) % nnode] * stride);
+        n->pptr = NVMM_PPtr(n->raw);
+    }
+}
+
+/* ns/hop of each mode */
+static double
+chase_raw(node *p, long nnode, long hops)
+{
+    uint64_t t0, t1;
+    long h;
+
+    for (h = 0; h < nnode; ++h)
+        p = p->raw;
+
+    t0 = now_ns();
+    for (h = 0; h < hops; ++h)
+        p = p->raw;
+    t1 = now_ns();
+
+    return (p == NULL) ? 0 : (double) (t1 - t0) / hops;
+}
+
+static double
+chase_pptr(node *p, long nnode, long hops)
+{
+    uint64_t t0, t1;
+    long h;
+
+    for (h = 0; h < nnode; ++h)
+        p = (node *) NVMM_PPTR_GET(p->pptr);
+
+    t0 = now_ns();
+    for (h = 0; h < hops; ++h)
+        p = (node *) NVMM_PPTR_GET(p->pptr);
+    t1 = now_ns();
+
+    return (p == NULL) ? 0 : (double) (t1 - t0) / hops;
+}
+
+static double
+chase_cached(node *p, long nnode, long hops)
+{
+    uint64_t t0, t1, bias;
+    long h;
+
+    /* all nodes are in the same heap */
+    bias = NVMM_PPTR_BIAS(p->pptr);
+    for (h = 0; h < nnode; ++h)
+        p = (node *) NVMM_PPTR_AT(bias, p->pptr);
+
+    t0 = now_ns();
+    for (h = 0; h < hops; ++h)
+        p = (node *) NVMM_PPTR_AT(bias, p->pptr);
+    t1 = now_ns();
+
+    return (p == NULL) ? 0 : (double) (t1 - t0) / hops;
+}
+
+static void
+usage()
+{
+    fprintf(stderr,
+            "Usage: ./pptrbench [-s size_MiB] [-d stride] [-n hops]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    size_t size, stride, ws, nnode;
+    long hops;
+    size_t *perm;
+    char *base;
+    int opt;
+
+    size   = 64 * MB;
+    stride = 64;
+    hops   = 10 * 1000 * 1000;
+
+    while ((opt = getopt(argc, argv, "s:d:n:")) != -1) {
+        switch (opt) {
+        case 's': size   = (size_t) atol(optarg) * MB; break;
+        case 'd': stride = (size_t) atol(optarg);      break;
+        case 'n': hops   = atol(optarg);               break;
+        default:
+            usage();
+        }
+    }
+    if (size == 0 || stride < sizeof(node) || stride % sizeof(uint64_t) != 0 || hops <= 0)
+        usage();
+
+    base = (char *) NVMM_Malloc(size);
+    perm = (size_t *) malloc(sizeof(size_t) * (size / stride));
+    if (perm == NULL) {
+        perror("failed to malloc");
+        exit(1);
+    }
+
+    printf("working_set[KiB],stride,raw[ns/hop],pptr[ns/hop],cached[ns/hop]\n");
+    for (ws = 64 * KB; ws <= size; ws *= 2) {
+        nnode = ws / stride;
+        if (nnode < 2)
+            continue;
+        build_cycle(base, nnode, stride, perm);
+
+        printf("%zu,%zu,%.2f,%.2f,%.2f\n", ws / KB, stride,
+               chase_raw((node *) base, nnode, hops),
+               chase_pptr((node *) base, nnode, hops),
+               chase_cached((node *) base, nnode, hops));
+        fflush(stdout);
+    }
+
+    free(perm);
+    NVMM_Free(base);
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * ptrchase: pointer-chasing over NVMM to observe TLB misses
+ *
+ * One node is placed per stride (default: one node per 4 KiB page) and
+ * nodes are linked in random order, so every hop touches a different page.
+ * Working set is doubled from 64 KiB to given size; when working set
+ * exceeds TLB reach, ns/hop jumps. Build with NVMM_FLAGS=-DNVMM_HUGEPAGE
+ * to compare 2 MiB aligned nvmm_block.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "libnvmm.h"
+#include "benchutil.h"
+
+static uint32_t rng = 2463534242U;
+
+/* link nodes in a random single cycle (Sattolo's algorithm) */
+static void
+build_cycle(char *base, size_t nnode, size_t stride, size_t *perm)
+{
+    size_t i, j, t;
+
+    for (i = 0; i < nnode; ++i)
+        perm[i] = i;
+    for (i = nnode - 1; i > 0; --i) {
+        j = xorshift32(&rng) % i;
+        t = perm[i]; perm[i] = perm[j]; perm[j] = t;
+    }
+    for (i = 0; i < nnode; ++i)
+        *((void **) (base + perm[i] * stride)) = base + perm[(i + 1) % nnode] * stride;
+}
+
+int main(int argc, char **argv)
+{
+    size_t size, stride, ws, nnode;
+    long hops, h;
+    size_t *perm;
+    char *base;
+    void **p;
+    uint64_t t0, t1;
+
+    size   = (argc > 1) ? (size_t) atol(argv[1]) * MB : 256 * MB;
+    stride = (argc > 2) ? (size_t) atol(argv[2])      : 4 * KB;
+    hops   = (argc > 3) ? atol(argv[3])               : 10 * 1000 * 1000;
+
+    if (size == 0 || stride < sizeof(void *) || hops <= 0) {
+        fprintf(stderr, "Usage: ./ptrchase [size_MiB] [stride] [hops]\n");
+        exit(1);
+    }
+
+    base = (char *) NVMM_Malloc(size);
+    perm = (size_t *) malloc(sizeof(size_t) * (size / stride));
+    if (perm == NULL) {
+        perror("failed to malloc");
+        exit(1);
+    }
+
+    printf("working_set[KiB],stride,ns/hop\n");
+    for (ws = 64 * KB; ws <= size; ws *= 2) {
+        nnode = ws / stride;
+        if (nnode < 2)
+            continue;
+        build_cycle(base, nnode, stride, perm);
+
+        /* warm up, then measure */
+        p = (void **) base;
+        for (h = 0; h < (long) nnode; ++h)
+            p = (void **) *p;
+
+        t0 = now_ns();
+        for (h = 0; h < hops; ++h)
+            p = (void **) *p;
+        t1 = now_ns();
+
+        /* print p to keep the chain alive */
+        printf("%zu,%zu,%.2f%s\n", ws / KB, stride, (double) (t1 - t0) / hops,
+               (p == NULL) ? " " : "");
+    }
+
+    free(perm);
+    NVMM_Free(base);
+
+    return 0;
+}
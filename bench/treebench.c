@@ -0,0 +1,209 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * treebench: throughput of persistent B+-tree (nvmm_tree)
+ *
+ * For each pair of (rlat, wlat), run phases on a new tree
+ *   insert  : insert n random keys
+ *   lookup  : lookup n keys (all hit, random order)
+ *   update  : update n keys
+ *   scan    : n / 100 range scans of len entries
+ *   recover : rebuild inner nodes from leaves (NVMM_TreeRecover)
+ *   delete  : delete n keys
+ *
+ * rlat/wlat are programmed by NVMM_LatencySet (fine mode) and only
+ * available on ZC706.  Original latency is restored at exit.
+ *
+ * output
+ *   CSV: rlat,wlat,phase,ops,time,ops/s,read,write,act,pre,write/op
+ *        (deltas of memory requests, 0 for emulation)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libnvmm.h"
+#include "nvmm_latency.h"
+#include "nvmm_tree.h"
+#include "benchutil.h"
+
+
+/******************** Parameters ********************/
+static long rlat[MAXN_LIST] = { 0 };
+static long wlat[MAXN_LIST] = { 0 };
+static int n_rlat = 1, n_wlat = 1;
+
+static long n   = 1000000;
+static long len = 100;
+
+
+/******************** Benchmark *********************/
+static long rl, wl;
+static memreq start;
+static uint64_t t0;
+
+static void
+phase_start()
+{
+    NVMM_StartRequestStat(&start);
+    t0 = now_ns();
+}
+
+static void
+phase_end(const char *phase, long ops)
+{
+    memreq end;
+    uint64_t t1;
+
+    t1 = now_ns();
+    NVMM_EndRequestStat(&end);
+
+    printf("%ld,%ld,%s,%ld,%.3f,%.0f,%lld,%lld,%lld,%lld,%.2f\n", rl, wl, phase, ops,
+           (t1 - t0) / 1e9, ops / ((t1 - t0) / 1e9),
+           (long long) (end.read - start.read), (long long) (end.write - start.write),
+           (long long) (end.act - start.act), (long long) (end.pre - start.pre),
+           (double) (end.write - start.write) / ops);
+    fflush(stdout);
+}
+
+/**
+ * Run all phases
+ *
+ * @param keys
+ *            n distinct random keys
+ *
+ * @return none
+ *
+ */
+static void
+run(uint64_t *keys)
+{
+    nvmm_tree *tree;
+    uint64_t *out, val, sum;
+    uint32_t seed;
+    long i;
+
+    out = (uint64_t *) malloc(sizeof(uint64_t) * len);
+    tree = NVMM_TreeCreate();
+    sum = 0;
+
+    phase_start();
+    for (i = 0; i < n; ++i)
+        NVMM_TreeInsert(tree, keys[i], i);
+    phase_end("insert", n);
+
+    seed = 2463534242U;
+    phase_start();
+    for (i = 0; i < n; ++i) {
+        NVMM_TreeLookup(tree, keys[xorshift32(&seed) % n], &val);
+        sum += val;
+    }
+    phase_end("lookup", n);
+
+    phase_start();
+    for (i = 0; i < n; ++i)
+        NVMM_TreeInsert(tree, keys[xorshift32(&seed) % n], i);
+    phase_end("update", n);
+
+    phase_start();
+    for (i = 0; i < n / 100; ++i)
+        sum += NVMM_TreeScan(tree, keys[xorshift32(&seed) % n], len, out, NULL);
+    phase_end("scan", n / 100);
+
+    phase_start();
+    tree = NVMM_TreeRecover(NVMM_TreeRoot(tree));
+    phase_end("recover", 1);
+
+    phase_start();
+    for (i = 0; i < n; ++i)
+        NVMM_TreeDelete(tree, keys[i]);
+    phase_end("delete", n);
+
+    NVMM_TreeDestroy(tree);
+    free(out);
+
+    /* keep lookups */
+    if (sum == 1)
+        fprintf(stderr, "\n");
+}
+
+
+/******************** Main **************************/
+static void
+usage()
+{
+    fprintf(stderr,
+            "Usage: ./treebench [-n keys] [-l scanlen] [-r rlats] [-w wlats]\n"
+            "  rlats/wlats are comma-separated, e.g. -w 0,100,200\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t *keys, x;
+    lat_saved orig;
+    int a, b, opt;
+    long i;
+
+    while ((opt = getopt(argc, argv, "n:l:r:w:")) != -1) {
+        switch (opt) {
+        case 'n': n      = atol(optarg);              break;
+        case 'l': len    = atol(optarg);              break;
+        case 'r': n_rlat = parse_list(optarg, rlat);  break;
+        case 'w': n_wlat = parse_list(optarg, wlat);  break;
+        default:
+            usage();
+        }
+    }
+    if (n < 100 || len < 1 || n_rlat < 1 || n_wlat < 1)
+        usage();
+
+    lat_save(&orig, n_rlat, rlat, n_wlat, wlat);
+
+    /* distinct keys: odd multiples of golden ratio are a permutation */
+    keys = (uint64_t *) malloc(sizeof(uint64_t) * n);
+    for (i = 0; i < n; ++i) {
+        x = (uint64_t) (i + 1) * 0x9E3779B97F4A7C15ULL;
+        keys[i] = x ^ (x >> 29);
+    }
+
+    printf("rlat[ns],wlat[ns],phase,ops,time[s],ops/s,read,write,act,pre,write/op\n");
+    for (a = 0; a < n_rlat; ++a)
+    for (b = 0; b < n_wlat; ++b) {
+        rl = rlat[a];
+        wl = wlat[b];
+        NVMM_LatencySet(rl, wl, NVMM_LAT_FINE);
+        run(keys);
+    }
+
+    lat_restore(&orig);
+    NVMM_LatencyClose();
+    free(keys);
+
+    return 0;
+}
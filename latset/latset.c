@@ -24,42 +24,19 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
-#include <unistd.h>
-#include <sys/mman.h>
-#include <errno.h>
-#include <time.h>
 #include <string.h>
 
-#define LATSET_BASE (0x43C00000)
-
-typedef unsigned char byte;
-
-#define KB (1024)
-#define MB (1024*KB)
-#define GB (1024*MB)
-
-#define PL_READ(base, offset) \
-    *((volatile unsigned int *) ((base) + (offset)));
-#define PL_WRITE(base, offset, val) \
-    *((volatile unsigned int *) ((base) + (offset))) = (val);
+#include "nvmm_latency.h"
 
 int main(int argc, char **argv)
 {
-    int fd;
-    byte *base;
     int rlat, wlat;
-    unsigned int offr, offw;
-    unsigned int rlat_bef, rlat_aft, wlat_bef, wlat_aft;
+    int rlat_bef, rlat_aft, wlat_bef, wlat_aft;
     int is_err, lat_v;
 
     /* check args */
     is_err = 0;
-    lat_v = 2;
+    lat_v = NVMM_LAT_FINE;
     if (argc != 3 && argc != 4) {
         is_err = 1;
     } else {
@@ -68,9 +45,9 @@ int main(int argc, char **argv)
 
         if (argc == 4) {
             if (strcmp(argv[3], "coarse") == 0)
-                lat_v = 1;
+                lat_v = NVMM_LAT_COARSE;
             else if (strcmp(argv[3], "fine") == 0)
-                lat_v = 2;
+                lat_v = NVMM_LAT_FINE;
             else
                 is_err = 1;
         }
@@ -82,50 +59,21 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-
-    /* open /dev/mem */
-    fd = open("/dev/mem", O_RDWR | O_SYNC);
-    if (fd == -1) {
-        perror("failed to open /dev/mem");
-        exit(1);
-    }
-
-    /* mmap */
-    base = mmap(0, 4 * KB, PROT_READ | PROT_WRITE, MAP_SHARED, fd, LATSET_BASE);
-    if (base == MAP_FAILED) {
-        perror("failed to mmap");
-        exit(1);
-    }
-
-    offr = lat_v == 1 ? 0x00000000 : 0x00000008;
-    offw = lat_v == 1 ? 0x00000004 : 0x0000000C;
-
     /* read unchanged value */
-    rlat_bef = PL_READ(base, offr);
-    wlat_bef = PL_READ(base, offw);
-
-    /* reset */
-    PL_WRITE(base, 0x00000000, 0);
-    PL_WRITE(base, 0x00000004, 0);
-    PL_WRITE(base, 0x00000008, 0);
-    PL_WRITE(base, 0x0000000C, 0);
+    NVMM_LatencyGet(&rlat_bef, &wlat_bef, lat_v);
 
     /* set latency */
-    PL_WRITE(base, offr, rlat / 5);
-    PL_WRITE(base, offw, wlat / 5);
+    NVMM_LatencySet(rlat, wlat, lat_v);
 
     /* read changed value */
-    rlat_aft = PL_READ(base, offr);
-    wlat_aft = PL_READ(base, offw);
+    NVMM_LatencyGet(&rlat_aft, &wlat_aft, lat_v);
 
     /* print */
     fprintf(stderr, "Latency ver. \"v%d\"\n", lat_v);
-    fprintf(stderr, "  rlat: %4d [ns] -> %4d [ns]\n", rlat_bef * 5, rlat_aft * 5);
-    fprintf(stderr, "  wlat: %4d [ns] -> %4d [ns]\n", wlat_bef * 5, wlat_aft * 5);
+    fprintf(stderr, "  rlat: %4d [ns] -> %4d [ns]\n", rlat_bef, rlat_aft);
+    fprintf(stderr, "  wlat: %4d [ns] -> %4d [ns]\n", wlat_bef, wlat_aft);
 
-    /* de-allocate */
-    munmap(base, 4 * KB);
-    close(fd);
+    NVMM_LatencyClose();
 
     return 0;
 }
@@ -0,0 +1,253 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * latstep: drive latency controller models over fake registers
+ *
+ * for each model (schedule, throttle, thermal, wear)
+ *   1. step NVMM_LatencyStep every PERIOD_MS of simulated time, while
+ *      write request counter is advanced by idle -> burst -> idle workload
+ *   2. write changed latency by NVMM_LatencySet through NVMM_LatencyFakeOps
+ *   3. read registers back and check them (this mode holds latency, the other is 0)
+ *   4. check behavior of the model (phases, slowdown and recovery, wear-out)
+ * and dump changes of latency as CSV:
+ *   model,time[ms],writes,rlat[ns],wlat[ns]
+ *
+ * no register of ZC706 is touched, so it runs on any host (e.g. x86)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "nvmm_latency.h"
+
+#define PERIOD_MS   (10)
+#define DURATION_MS (1000)
+
+/* workload: burst of writes in [BURST_BEGIN, BURST_END) [ms] */
+#define BURST_BEGIN (300)
+#define BURST_END   (600)
+#define IDLE_RATE   (10)    /* writes per ms */
+#define BURST_RATE  (20000) /* writes per ms */
+
+static const char *model_name[] = { "schedule", "throttle", "thermal", "wear" };
+
+static const nvmm_latency_phase phases[] = {
+    { 100, 0,   0   },
+    { 200, 50,  300 },
+    { 50,  15,  20  },
+};
+#define NPHASE ((int) (sizeof(phases) / sizeof(phases[0])))
+#define CYCLE_MS (100 + 200 + 50)
+
+static nvmm_latency_fake fake;
+
+
+/* write request counter at t [ms] */
+static int64_t
+writes_at(int64_t t)
+{
+    int64_t burst;
+
+    burst = (t < BURST_BEGIN) ? 0 : (t < BURST_END) ? t - BURST_BEGIN : BURST_END - BURST_BEGIN;
+    return t * IDLE_RATE + burst * (BURST_RATE - IDLE_RATE);
+}
+
+
+/* configuration of each model */
+static void
+config(nvmm_latctl *ctl, int model)
+{
+    nvmm_latctl zero = { 0 };
+
+    *ctl = zero;
+    ctl->model     = model;
+    ctl->period_ms = PERIOD_MS;
+
+    /* alternate modes to check the other mode is cleared */
+    ctl->mode = (model % 2 == 0) ? NVMM_LAT_COARSE : NVMM_LAT_FINE;
+
+    switch (model) {
+    case NVMM_LATCTL_SCHEDULE:
+        ctl->phases = phases;
+        ctl->nphase = NPHASE;
+        break;
+
+    case NVMM_LATCTL_THROTTLE:
+        ctl->rlat      = 0;
+        ctl->wlat      = 0;
+        ctl->rlat_slow = 100;
+        ctl->wlat_slow = 500;
+        ctl->threshold = 1000; /* writes per ms */
+        ctl->release   = 0.5;
+        break;
+
+    case NVMM_LATCTL_THERMAL:
+        ctl->rlat      = 0;
+        ctl->wlat      = 0;
+        ctl->rlat_slow = 200;
+        ctl->wlat_slow = 800;
+        ctl->heat      = 0.0001;
+        ctl->cool      = 0.05;
+        ctl->threshold = 10.0;
+        ctl->release   = 0.5;
+        break;
+
+    case NVMM_LATCTL_WEAR:
+        ctl->rlat      = 0;
+        ctl->wlat      = 0;
+        ctl->wlat_slow = 200;
+        ctl->wear      = 50.0; /* [ns] per 1M writes */
+        break;
+    }
+
+    return;
+}
+
+
+/* expected phase of SCHEDULE at t [ms] */
+static int
+phase_at(int64_t t)
+{
+    int64_t off = t % CYCLE_MS;
+    int i;
+
+    for (i = 0; i < NPHASE - 1; ++i) {
+        if (off < phases[i].duration_ms)
+            break;
+        off -= phases[i].duration_ms;
+    }
+
+    return i;
+}
+
+
+/**
+ * Run one model over simulated time
+ *
+ * @return number of errors
+ *
+ */
+static int
+run_model(int model)
+{
+    nvmm_latctl ctl;
+    int64_t t, w;
+    int rlat, wlat, other, orlat, owlat;
+    int nchange, nerr, prev_wlat;
+
+    config(&ctl, model);
+    other = (ctl.mode == NVMM_LAT_COARSE) ? NVMM_LAT_FINE : NVMM_LAT_COARSE;
+
+    NVMM_LatencyStepInit(&ctl, 0, writes_at(0));
+    NVMM_LatencySet(ctl.cur_rlat, ctl.cur_wlat, ctl.mode);
+
+    nchange = nerr = 0;
+    prev_wlat = ctl.cur_wlat;
+    for (t = PERIOD_MS; t <= DURATION_MS; t += PERIOD_MS) {
+        w = writes_at(t);
+        fake.writes = w;
+
+        if (NVMM_LatencyStep(&ctl, t, fake.writes)) {
+            NVMM_LatencySet(ctl.cur_rlat, ctl.cur_wlat, ctl.mode);
+            printf("%s,%" PRId64 ",%" PRId64 ",%d,%d\n",
+                   model_name[model], t, w, ctl.cur_rlat, ctl.cur_wlat);
+            nchange++;
+
+            /* registers */
+            NVMM_LatencyGet(&rlat, &wlat, ctl.mode);
+            NVMM_LatencyGet(&orlat, &owlat, other);
+            if (rlat != ctl.cur_rlat / 5 * 5 || wlat != ctl.cur_wlat / 5 * 5 ||
+                orlat != 0 || owlat != 0) {
+                fprintf(stderr, "latstep: %s t=%" PRId64 ": registers %d/%d (other %d/%d)"
+                        ", expected %d/%d\n", model_name[model], t,
+                        rlat, wlat, orlat, owlat, ctl.cur_rlat, ctl.cur_wlat);
+                nerr++;
+            }
+        }
+
+        /* behavior */
+        switch (model) {
+        case NVMM_LATCTL_SCHEDULE:
+            if (ctl.cur_rlat != phases[phase_at(t)].rlat ||
+                ctl.cur_wlat != phases[phase_at(t)].wlat) {
+                fprintf(stderr, "latstep: %s t=%" PRId64 ": not in phase %d\n",
+                        model_name[model], t, phase_at(t));
+                nerr++;
+            }
+            break;
+
+        case NVMM_LATCTL_THROTTLE:
+        case NVMM_LATCTL_THERMAL:
+            /* slow within burst, nominal well after it */
+            if ((t == (BURST_BEGIN + BURST_END) / 2 && ctl.cur_wlat != ctl.wlat_slow) ||
+                (t == DURATION_MS && ctl.cur_wlat != ctl.wlat)) {
+                fprintf(stderr, "latstep: %s t=%" PRId64 ": wlat %d\n",
+                        model_name[model], t, ctl.cur_wlat);
+                nerr++;
+            }
+            break;
+
+        case NVMM_LATCTL_WEAR:
+            /* wlat never decreases, and is capped by wlat_slow */
+            if (ctl.cur_wlat < prev_wlat || ctl.cur_wlat > ctl.wlat_slow ||
+                (t == DURATION_MS && ctl.cur_wlat != ctl.wlat_slow)) {
+                fprintf(stderr, "latstep: %s t=%" PRId64 ": wlat %d\n",
+                        model_name[model], t, ctl.cur_wlat);
+                nerr++;
+            }
+            break;
+        }
+        prev_wlat = ctl.cur_wlat;
+    }
+
+    fprintf(stderr, "latstep: %s %d changes, %d errors\n", model_name[model], nchange, nerr);
+
+    return nerr;
+}
+
+
+int main(int argc, char **argv)
+{
+    nvmm_latency_ops ops;
+    int model, nerr;
+
+    (void) argv;
+    if (argc != 1) {
+        fprintf(stderr, "Usage: ./latstep\n");
+        exit(1);
+    }
+
+    ops = NVMM_LatencyFakeOps(&fake);
+    NVMM_LatencySetOps(&ops);
+
+    printf("model,time[ms],writes,rlat[ns],wlat[ns]\n");
+
+    nerr = 0;
+    for (model = NVMM_LATCTL_SCHEDULE; model <= NVMM_LATCTL_WEAR; ++model)
+        nerr += run_model(model);
+
+    return (nerr == 0) ? 0 : 1;
+}
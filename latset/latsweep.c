@@ -0,0 +1,261 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * latsweep: run a workload command over a grid of rlat/wlat
+ *
+ * for each (rlat, wlat) and each repetition
+ *   1. set latency (NVMM_LatencySet)
+ *   2. reset memory request counters (NVMM_StartRequestStat)
+ *   3. run command and wait for it
+ *   4. read memory request counters (NVMM_EndRequestStat)
+ * and dump one CSV table at the end:
+ *   rlat,wlat,run,status,elapsed[s],user[s],sys[s],read,write,act,pre,bdr,bdw
+ *
+ * the command gets current latency by environment variables
+ * NVMM_RLAT and NVMM_WLAT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "libnvmm.h"
+#include "nvmm_latency.h"
+
+#define MAXN_LIST (64)
+
+typedef struct _result {
+    int rlat;
+    int wlat;
+    int run;
+    int status;
+    double elapsed;
+    double user;
+    double sys;
+    memreq req;
+} result;
+
+
+/**
+ * Parse comma-separated list of integers
+ *
+ * @return number of elements (0 if malformed)
+ *
+ */
+static int
+parse_list(const char *str, int *list)
+{
+    char *end;
+    int n;
+
+    n = 0;
+    while (*str != '\0' && n < MAXN_LIST) {
+        list[n++] = (int) strtol(str, &end, 0);
+        if (end == str)
+            return 0;
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return 0;
+        str = end;
+    }
+
+    return n;
+}
+
+static inline double
+tv_to_sec(struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+
+/**
+ * Run command once
+ *
+ * @param argv
+ *            command and arguments
+ * @param res
+ *            result (status, times and memory requests are stored)
+ *
+ * @return none
+ *
+ */
+static void
+run_command(char **argv, result *res)
+{
+    struct timespec t0, t1;
+    struct rusage ru;
+    memreq start, end;
+    char buf[16];
+    pid_t pid;
+    int status;
+
+    snprintf(buf, sizeof(buf), "%d", res->rlat);
+    setenv("NVMM_RLAT", buf, 1);
+    snprintf(buf, sizeof(buf), "%d", res->wlat);
+    setenv("NVMM_WLAT", buf, 1);
+
+    fflush(stdout);
+    fflush(stderr);
+
+    NVMM_StartRequestStat(&start);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    pid = fork();
+    if (pid == -1) {
+        perror("failed to fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        perror("failed to exec");
+        _exit(127);
+    }
+
+    while (wait4(pid, &status, 0, &ru) == -1) {
+        if (errno != EINTR) {
+            perror("failed to wait");
+            exit(1);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    NVMM_EndRequestStat(&end);
+
+    res->status  = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    res->elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    res->user    = tv_to_sec(&ru.ru_utime);
+    res->sys     = tv_to_sec(&ru.ru_stime);
+    res->req.read  = end.read  - start.read;
+    res->req.write = end.write - start.write;
+    res->req.act   = end.act   - start.act;
+    res->req.pre   = end.pre   - start.pre;
+    res->req.bdr   = end.bdr   - start.bdr;
+    res->req.bdw   = end.bdw   - start.bdw;
+}
+
+
+static void
+usage()
+{
+    fprintf(stderr,
+            "Usage: ./latsweep [-r rlats] [-w wlats] [-m coarse|fine] [-n repeat] [-o file]\n"
+            "                  -- command [args...]\n"
+            "  rlats/wlats are comma-separated [ns], e.g. -r 0,100,200\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int rlat[MAXN_LIST] = { 0 }, wlat[MAXN_LIST] = { 0 };
+    int n_rlat = 1, n_wlat = 1, repeat = 1, mode = NVMM_LAT_FINE;
+    int rlat_orig, wlat_orig;
+    const char *out = NULL;
+    result *res;
+    FILE *fp;
+    int a, b, r, n, opt;
+
+    while ((opt = getopt(argc, argv, "+r:w:m:n:o:")) != -1) {
+        switch (opt) {
+        case 'r': n_rlat = parse_list(optarg, rlat); break;
+        case 'w': n_wlat = parse_list(optarg, wlat); break;
+        case 'n': repeat = atoi(optarg);             break;
+        case 'o': out    = optarg;                   break;
+        case 'm':
+            if (strcmp(optarg, "coarse") == 0)
+                mode = NVMM_LAT_COARSE;
+            else if (strcmp(optarg, "fine") == 0)
+                mode = NVMM_LAT_FINE;
+            else
+                usage();
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind >= argc || n_rlat < 1 || n_wlat < 1 || repeat < 1)
+        usage();
+
+    res = (result *) calloc(n_rlat * n_wlat * repeat, sizeof(result));
+    if (res == NULL) {
+        perror("failed to calloc");
+        exit(1);
+    }
+
+    /* sweep */
+    NVMM_LatencyGet(&rlat_orig, &wlat_orig, mode);
+
+    n = 0;
+    for (a = 0; a < n_rlat; ++a)
+    for (b = 0; b < n_wlat; ++b) {
+        NVMM_LatencySet(rlat[a], wlat[b], mode);
+        for (r = 0; r < repeat; ++r, ++n) {
+            res[n].rlat = rlat[a];
+            res[n].wlat = wlat[b];
+            res[n].run  = r;
+            run_command(&argv[optind], &res[n]);
+            fprintf(stderr, "latsweep: rlat=%d wlat=%d run=%d status=%d %.3f [s]\n",
+                    res[n].rlat, res[n].wlat, r, res[n].status, res[n].elapsed);
+        }
+    }
+
+    NVMM_LatencySet(rlat_orig, wlat_orig, mode);
+    NVMM_LatencyClose();
+
+    /* dump */
+    fp = stdout;
+    if (out != NULL) {
+        fp = fopen(out, "w");
+        if (fp == NULL) {
+            perror("failed to fopen");
+            exit(1);
+        }
+    }
+
+    fprintf(fp, "rlat[ns],wlat[ns],run,status,elapsed[s],user[s],sys[s],"
+            "read,write,act,pre,bdr,bdw\n");
+    for (a = 0; a < n; ++a) {
+        fprintf(fp, "%d,%d,%d,%d,%.6f,%.6f,%.6f,%lld,%lld,%lld,%lld,%lld,%lld\n",
+                res[a].rlat, res[a].wlat, res[a].run, res[a].status,
+                res[a].elapsed, res[a].user, res[a].sys,
+                (long long) res[a].req.read, (long long) res[a].req.write,
+                (long long) res[a].req.act,  (long long) res[a].req.pre,
+                (long long) res[a].req.bdr,  (long long) res[a].req.bdw);
+    }
+
+    if (fp != stdout)
+        fclose(fp);
+    free(res);
+
+    return 0;
+}
@@ -22,6 +22,10 @@
  * SOFTWARE.
  */
 
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE            /* REG_RIP */
+#endif
+
 #include <sys/types.h> /* open() */
 #include <sys/stat.h>  /* open() */
 #include <fcntl.h>     /* open() */
@@ -34,6 +38,18 @@
 #include <time.h>      /* clock() */
 #include <string.h>    /* memset() */
 #include <stdarg.h>    /* va_start(), va_arg(), va_end() */
+#include <stdint.h>    /* SIZE_MAX */
+#include <signal.h>    /* sigaction() */
+#include <ucontext.h>  /* ucontext_t */
+#include <execinfo.h>  /* backtrace() */
+#if defined(__SSE2__)
+#include <emmintrin.h> /* _mm_stream_si128() */
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>  /* vld1q_u8(), vst1q_u8() */
+#endif
+#if defined(NVMM_MT)
+#include <pthread.h>   /* pthread_mutex_lock(), pthread_mutex_unlock() */
+#endif
 
 #include "libnvmm.h"
 
@@ -50,13 +66,41 @@
 #define PAGESIZE (4*KiB)
 #define CACHELINE (32)
 
-/* physical addr of NVMM */
+/* physical addr of NVMM (default window) */
+/* other windows are given by NVMM_WINDOW (environment variable) */
 #define NVMM_BEGIN (0x80000000) /* head 1 MiB is reserved */
 #define NVMM_END   (0xBFFFFFFF)
+#define NVMM_SIZE  ((size_t) NVMM_END - NVMM_BEGIN + 1)
+
+/* initial number of entries of nvmm_block table (grows if needed) */
+#define NB_TABLE_INIT (64)
 
 /* minimum size for mmap */
 #define NB_SIZEMIN (4*MiB)
 
+/* alignment of nvmm_block (both of physical and virtual address) */
+/* 2 MiB covers 1 MiB section / 64 KiB large page (ARM) and 2 MiB page (x86) */
+#if defined(NVMM_HUGEPAGE) || defined(NVMM_HUGETLB)
+#define NB_ALIGN (2*MiB)
+#else
+#define NB_ALIGN PAGESIZE
+#endif
+
+/* lock for multi-thread */
+#if defined(NVMM_MT)
+#define heap_lock(heap)    pthread_mutex_lock(&(heap)->lock)
+#define heap_unlock(heap)  pthread_mutex_unlock(&(heap)->lock)
+#define heap_trylock(heap) pthread_mutex_trylock(&(heap)->lock)
+#define table_lock()       pthread_mutex_lock(&nvmm_heap_table_lock)
+#define table_unlock()     pthread_mutex_unlock(&nvmm_heap_table_lock)
+#else
+#define heap_lock(heap)    ((void) (heap))
+#define heap_unlock(heap)  ((void) (heap))
+#define heap_trylock(heap) ((void) (heap), 0)
+#define table_lock()       ((void) 0)
+#define table_unlock()     ((void) 0)
+#endif
+
 /* branch prediction */
 #define likely(x)   __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
@@ -69,6 +113,7 @@ typedef unsigned long addr_t;  /* phys/virt addr bits */
 
 /* sturuct to manage NVMM */
 struct _nvmm_block;
+struct _nvmm_heap;
 typedef struct _nvmm_region {
     size_t size;            /* allocated size */
     byte  *ptr;             /* allocated ptr */
@@ -76,6 +121,12 @@ typedef struct _nvmm_region {
 
     struct _nvmm_region *prev; /* pointer to prev nvmm_region */
     struct _nvmm_region *next; /* pointer to next nvmm_region */
+
+    /* part of allocated region which may be non-zero (offset from user data) */
+    size_t dirty_off;
+    size_t dirty_len;
+
+    byte sampled; /* allocation is sampled by heap profile */
 } nvmm_region;
 
 typedef struct _nvmm_block {
@@ -83,40 +134,205 @@ typedef struct _nvmm_block {
     void   *va;   /* virtual addr (begin) */
     size_t  size; /* bytes used in mmap */
     size_t  free; /* free bytes */
-
-    struct _nvmm_region *nr; /* allocatable region */
+    int     attr; /* mapping attribute (NVMM_ATTR_*) */
+    int64_t idle; /* time when nb became fully free [ms] */
+    byte  pinned; /* reserved at initialization (not unmapped by purge) */
+    byte  arena;  /* acquired by arena (whole block is in use) */
+    byte  retained; /* fully free and not pinned (in LRU list of heap) */
+    struct _nvmm_region *rover; /* next-fit start (NVMM_POLICY=wear) */
+    int     idx;  /* index in nb_table */
+
+    struct _nvmm_block  *prev; /* physically preceding nvmm_block */
+    struct _nvmm_block  *next; /* physically following nvmm_block */
+    struct _nvmm_block  *lru_prev; /* retained nvmm_block freed before */
+    struct _nvmm_block  *lru_next; /* retained nvmm_block freed after */
+    struct _nvmm_region *nr;   /* allocatable region */
+    struct _nvmm_heap   *heap; /* pointer to parent nvmm_heap */
 } nvmm_block;
 
+/* state of page for persistence check (NVMM_PMCHECK) */
+typedef struct _pm_page {
+    byte *snap;         /* persisted content (NULL if read-only) */
+    const void *pc;     /* first store after snap */
+    byte tracked;       /* mapped */
+    byte listed;        /* in pm_list (snap may be released already) */
+    uint32_t reported[PAGESIZE / CACHELINE / 32]; /* dirty lines reported at fence */
+} pm_page;
+
+/* allocator instance for one physical window of NVMM */
+struct _nvmm_heap {
+    int     id;      /* index in nvmm_heap_table */
+    addr_t  pa;      /* physical address of window (begin) */
+    size_t  size;    /* bytes of window */
+    byte   *va_base; /* virtual address space reserved for window */
+                     /* nvmm_block is mapped at va_base + (pa - heap->pa) */
+
+    nvmm_block **nb_table; /* nvmm_block table (always sorted by nb->free) */
+    int num_nb;            /* allocated nvmm_block */
+    int maxn_nb;           /* capacity of nb_table */
+
+    /* nvmm_blocks in address order (tile whole window) */
+    /* not mmaped nvmm_blocks are never adjacent (merged when unmapped) */
+    nvmm_block *nb_head;
+
+    /* cache for nvmm_block (previous searched nvmm_block, per attribute) */
+    nvmm_block *nbb[NVMM_NATTR];
+
+    /* pool of freeed nvmm_region */
+    struct _nvmm_region *nr_pool;
+
+    /* retained nvmm_blocks in order of nb->idle (head is least recently freed) */
+    nvmm_block *lru_head;
+    nvmm_block *lru_tail;
+    size_t retained; /* bytes of retained nvmm_blocks */
+
+    /* next check of NVMM_DECAY_MS at allocation [ms] */
+    int64_t decay_next;
+
+    /* statistics */
+    size_t num_nr;     /* nvmm_region structs (allocated, idle and pooled) */
+    size_t num_region; /* allocated nvmm_region */
+
+    /* next carve position in window (NVMM_POLICY=wear) */
+    addr_t cursor;
+
+    /* bank of next NVMM_MallocSpread */
+    int spread;
+
+    /* wear counters per page of window (NULL if NVMM_WEAR is not set) */
+    uint64_t *wear_lines;  /* flushed cache lines */
+    uint64_t *wear_allocs; /* allocations starting in page */
+
+    /* state per page of window (NULL if NVMM_PMCHECK is not set) */
+    pm_page *pm_pages;
+    byte    *pm_snap;  /* snapshot slot per page (reserved, committed when used) */
+
+    /* known-zero pages of window (bitmap, free and never written since zeroed) */
+    uint64_t *zero_pages;
+    size_t    zero_bytes; /* bytes of known-zero pages */
+
+#if defined(NVMM_CRASHSIM)
+    /* persisted image per page of window (NULL if never written back) */
+    byte **crash_shadow;
+#endif
+
+#if defined(NVMM_MT)
+    pthread_mutex_t lock; /* lock for all of above */
+#endif
+};
+
+/* bump-pointer allocator on dedicated nvmm_blocks */
+struct _nvmm_arena {
+    nvmm_heap *heap;  /* source nvmm_heap */
+    int flags;        /* flags for nvmm_blocks (NVMM_ATTR_*, NVMM_PREFAULT) */
+    size_t blocksize; /* bytes per nvmm_block */
+
+    nvmm_block **blocks; /* dedicated nvmm_blocks */
+    int num_blocks;      /* acquired nvmm_blocks */
+    int maxn_blocks;     /* capacity of blocks */
+    int cur;             /* index of current nvmm_block */
+
+    byte *ptr; /* bump pointer */
+    byte *end; /* end of current nvmm_block */
+};
+
+/* initial number of entries of arena->blocks (grows if needed) */
+#define ARENA_BLOCKS_INIT (8)
+
+/* alignment of region from arena */
+#define ARENA_ALIGN (8)
+
 typedef struct _region_info {
     struct _nvmm_region *nr;
     size_t  size;
 } region_info;
 
 
-/* nvmm_block_table is sorted by nb->free or not */
-/* if has been sorted already, dont sort again */
-static byte sorted_by_free;
+/* allocation from nvmm_heap (heap must be locked) */
+static void *heap_malloc(nvmm_heap *heap, size_t size, int flags);
+
+/* state of nvmm_heap is reported when NVMM is exhausted (heap must be locked) */
+static void dump_heap(FILE *fp, nvmm_heap *heap);
 
+#if defined(NVMM_CRASHSIM)
+/* region_info survives simulated crash (allocator state is not in NVMM) */
+static void crash_keep(nvmm_heap *heap, const void *va, size_t size);
+#endif
+
+/* persistence check of mapped NVMM (NVMM_PMCHECK) */
+static void pm_map(nvmm_block *nb);
+static void pm_unmap(nvmm_block *nb);
+static void pm_keep(nvmm_heap *heap, const void *ptr, size_t size);
 
-/* cache for nvmm_block (previous searched nvmm_block) */
-nvmm_block *nbb;
+/* heap table (heap 0 is default heap) */
+static nvmm_heap *nvmm_heap_table[NVMM_MAXN_HEAP];
 
-/* nvmm_block table */
-#define MAXN_NB_TABLE (1*GiB / NB_SIZEMIN)
-static nvmm_block *nvmm_block_table[MAXN_NB_TABLE];
-static int num_nvmm_block; /* allocated nvmm_block */
+/* va_base of heap id - ((id + 1) << NVMM_PPTR_SHIFT) at [id + 1], [0] is NULL */
+uint64_t nvmm_pptr_bias[NVMM_MAXN_HEAP + 1];
+#if defined(NVMM_MT)
+static pthread_mutex_t nvmm_heap_table_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 /* file descriptors */
-static int fd_devmem;   /* /dev/mem (    cacheable) */
-static int fd_devmem_s; /* /dev/mem (non-cacheable) */
-static int fd_wbmod;    /* /dev/wbmod */
+static int fd_devmem;    /* /dev/mem (    cacheable) */
+static int fd_devmem_s;  /* /dev/mem (non-cacheable) */
+static int fd_devmem_wc; /* /dev/mem (write-combining) */
+#if defined(ZC706)
+static int fd_wbmod;     /* /dev/wbmod */
+#endif
+
+/* options for retained (fully free but mmaped) nvmm_block */
+static size_t  opt_retain_max; /* high-water mark [bytes] (NVMM_RETAIN_MAX) */
+static int64_t opt_decay_ms;   /* unmap after idle [ms], 0 is never (NVMM_DECAY_MS) */
+
+/* options for new nvmm_block */
+static int    opt_prefault; /* prefault all new nvmm_block (NVMM_PREFAULT) */
+static size_t opt_reserve;  /* bytes mmaped at initialization (NVMM_RESERVE) */
+
+/* option for wear tracking */
+static const char *opt_wear; /* heatmap file written at finalize (NVMM_WEAR) */
 
-/* pool of freeed nvmm_region */
-static nvmm_region *nvmm_region_pool;
+/* option for persistence check */
+static const char *opt_pmcheck; /* report file written at finalize (NVMM_PMCHECK) */
+
+/* options for pre-zeroing (NVMM_MT only) */
+static size_t  opt_prezero;    /* known-zero bytes kept free per heap (NVMM_PREZERO) */
+static int64_t opt_prezero_ms; /* interval of pre-zeroing thread [ms] (NVMM_PREZERO_MS) */
+
+/* options for heap profile */
+static const char *opt_heapprof;        /* profile written at finalize (NVMM_HEAPPROF) */
+static size_t      opt_heapprof_rate;   /* mean bytes between samples, 0 if disabled */
+static int         opt_heapprof_folded; /* folded stacks instead of pprof (NVMM_HEAPPROF_FORMAT) */
+
+/* options for heap statistics */
+static const char *opt_heapstat;    /* file of heap dump at finalize (NVMM_HEAPSTAT) */
+static int64_t     opt_heapstat_ms; /* interval of periodic dump [ms], 0 is never (NVMM_HEAPSTAT_MS) */
+
+/* behavior on exhaustion of NVMM (NVMM_OOM, NVMM_SetOomMode) */
+static int opt_oom; /* NVMM_OOM_ABORT or NVMM_OOM_NULL */
+
+/* callback to free NVMM on exhaustion (NVMM_SetReclaim) */
+static nvmm_reclaim_fn reclaim_fn;
+static void           *reclaim_arg;
+static __thread int    in_reclaim; /* callback is running in this thread */
+
+/* times of callback per allocation */
+#define RECLAIM_MAX (8)
+
+/* allocation policy (NVMM_POLICY) */
+#define POLICY_FIRST (0) /* carve from lowest pa, first-fit in nvmm_block */
+#define POLICY_WEAR  (1) /* carve at rotating cursor, next-fit in nvmm_block */
+static int opt_policy;
+
+/* bank geometry of NVMM (ROW_BANK_COLUMN mapping of physical address) */
+/* default is DDR3 SO-DIMM on ZC706: 8 banks, 8 KiB row */
+static int opt_bank_shift; /* lowest bit of bank (NVMM_BANK_SHIFT) */
+static int opt_bank_bits;  /* bits of bank (NVMM_BANK_BITS) */
 
 /* state of nvmmlib */
 static byte is_initialized = 0;
 static byte is_finalized   = 0;
+static byte is_error_exit  = 0; /* finalized by exit_perror/exit_stderr (locks may be held) */
 
 
 /* func for ptr */
@@ -125,57 +341,15 @@ static inline int nonNull(void *ptr) { return ptr != NULL; }
 
 
 /* func for nvmm_block */
-static inline int deallocatable(nvmm_block *nb) { return nb->size == nb->free; }
-
-/* func for qsort() */
-/* sort by free (ascending order) */
-int cmp_by_free(const void *p1, const void *p2)
-{
-    size_t f1 = (*((nvmm_block **) p1))->free;
-    size_t f2 = (*((nvmm_block **) p2))->free;
-
-    if (f1 < f2)
-        return -1;
-    else if (f1 == f2)
-        return 0;
-    else
-        return 1;
-}
-
-/* sort by free with NULL check (ascending order) */
-int cmp_by_free_nc(const void *p1, const void *p2)
+static inline int deallocatable(nvmm_block *nb)
 {
-    /* NULL check. NULL is treated as quite big */
-    if (isNull((void *) p1) && isNull((void *) p2)) /* p1 and p2 is equal */
-        return 0;
-    else if (isNull((void *) p1)) /* p1 is bigger than p2 */
-        return 1;
-    else if (isNull((void *) p2)) /* p2 is bigger than p1 */
-        return -1;
-
-    size_t f1 = (*((nvmm_block **) p1))->free;
-    size_t f2 = (*((nvmm_block **) p2))->free;
-
-    if (f1 < f2)
-        return -1;
-    else if (f1 == f2)
-        return 0;
-    else
-        return 1;
+    return nonNull(nb->va) && nb->size == nb->free;
 }
 
-/* sort by pa (ascending order) */
-int cmp_by_pa(const void *p1, const void *p2)
+/* nb can serve attr if it has the same attribute or has not been mmaped */
+static inline int attr_match(nvmm_block *nb, int attr)
 {
-    size_t pa1 = (*((nvmm_block **) p1))->pa;
-    size_t pa2 = (*((nvmm_block **) p2))->pa;
-
-    if (pa1 < pa2)
-        return -1;
-    else if (pa1 == pa2)
-        return 0;
-    else
-        return 1;
+    return isNull(nb->va) || nb->attr == attr;
 }
 
 
@@ -215,6 +389,7 @@ nvmmlib_exit(int errn, int caller)
         break;
     }
 
+    is_error_exit = (caller != EXIT_NONE);
     NVMM_Finalize();
     exit(errn);
 }
@@ -271,6 +446,24 @@ align_size(size_t size, size_t alignment)
 }
 
 
+/**
+ * Return current time
+ *
+ * @param none
+ *
+ * @return monotonic time [ms]
+ *
+ */
+static inline int64_t
+now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
 /**
  * Calculate size for mmap
  *
@@ -286,7 +479,84 @@ to_mmapsize(size_t size)
     if (size <= NB_SIZEMIN)
         return NB_SIZEMIN;
     else
-        return align_size(size, PAGESIZE);
+        return align_size(size, NB_ALIGN);
+}
+
+
+/**
+ * Return /dev/mem file descriptor for mapping attribute
+ *
+ * @param attr
+ *            mapping attribute (NVMM_ATTR_*)
+ *
+ * @return file descriptor
+ *
+ */
+static inline int
+attr_to_fd(int attr)
+{
+    switch (attr) {
+    case NVMM_ATTR_WC:
+        return fd_devmem_wc;
+    case NVMM_ATTR_UNCACHED:
+        return fd_devmem_s;
+    default:
+        return fd_devmem;
+    }
+}
+
+
+/**
+ * Return 1 if page of window is known to be zero
+ *
+ * @param heap
+ *            target nvmm_heap
+ * @param page
+ *            index of page in window
+ *
+ * @return 1 if known-zero
+ *
+ */
+static inline int
+zero_page(nvmm_heap *heap, size_t page)
+{
+    return (heap->zero_pages[page / 64] >> (page % 64)) & 1;
+}
+
+
+/**
+ * Mark pages [lo, hi) of window as known-zero or not
+ *
+ * @param heap
+ *            target nvmm_heap
+ * @param lo
+ *            first page
+ * @param hi
+ *            end page
+ * @param zero
+ *            1 if known-zero
+ *
+ * @return none
+ *
+ */
+static void
+mark_zero(nvmm_heap *heap, size_t lo, size_t hi, int zero)
+{
+    size_t page;
+
+    for (page = lo; page < hi; ++page) {
+        if (zero_page(heap, page) == zero)
+            continue;
+        if (zero) {
+            heap->zero_pages[page / 64] |=  (1ULL << (page % 64));
+            heap->zero_bytes += PAGESIZE;
+        } else {
+            heap->zero_pages[page / 64] &= ~(1ULL << (page % 64));
+            heap->zero_bytes -= PAGESIZE;
+        }
+    }
+
+    return;
 }
 
 
@@ -295,31 +565,71 @@ to_mmapsize(size_t size)
  *
  * @param nb
  *            target nvmm_block
+ * @param prefault
+ *            if 1, populate page tables (and pages) in advance
  *
- * @return none
+ * @return 0 if succeeded, -1 if mmap failed (NVMM_OOM_NULL)
  *
  */
-static inline void
-alloc_nvmm(nvmm_block *nb)
+static inline int
+alloc_nvmm(nvmm_block *nb, int prefault)
 {
-    void *ptr;
+    void *ptr, *va;
+    int populate;
+
+    populate = prefault ? MAP_POPULATE : 0;
+
+    /* map into reserved address space */
+    va = nb->heap->va_base + (nb->pa - nb->heap->pa);
 
 #if defined(ZC706)
-    ptr = mmap(0, nb->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_devmem, nb->pa);
+    ptr = mmap(va, nb->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED | populate,
+               attr_to_fd(nb->attr), nb->pa);
     if (ptr == MAP_FAILED) {
+        if (opt_oom == NVMM_OOM_NULL)
+            return -1;
         set_msg("alloc_nvmm::mmap(ptr)");
         exit_perror(errno);
     }
 #else
-    ptr = malloc(nb->size);
-    if (isNull(ptr)) {
-        set_msg("alloc_nvmm::malloc(ptr)");
+    ptr = MAP_FAILED;
+#if defined(NVMM_HUGETLB)
+    /* hugetlbfs (fall back to normal pages if no huge page is reserved) */
+    ptr = mmap(va, nb->size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB | populate, -1, 0);
+#endif
+    if (ptr == MAP_FAILED)
+        ptr = mmap(va, nb->size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | populate, -1, 0);
+    if (ptr == MAP_FAILED) {
+        if (opt_oom == NVMM_OOM_NULL)
+            return -1;
+        set_msg("alloc_nvmm::mmap(ptr)");
         exit_perror(errno);
     }
+#if defined(NVMM_HUGEPAGE)
+    /* transparent huge page (advisory, ignore error) */
+    madvise(ptr, nb->size, MADV_HUGEPAGE);
+#endif
 #endif
 
     nb->va = ptr;
-    return;
+
+    /* anonymous mapping is zero, but NVMM keeps previous contents */
+    mark_zero(nb->heap, (nb->pa - nb->heap->pa) / PAGESIZE,
+              (nb->pa - nb->heap->pa + nb->size) / PAGESIZE,
+#if defined(ZC706)
+              0
+#else
+              1
+#endif
+              );
+
+    /* stores are tracked by page fault */
+    if (unlikely(nonNull((void *) opt_pmcheck)))
+        pm_map(nb);
+
+    return 0;
 }
 
 
@@ -335,12 +645,55 @@ alloc_nvmm(nvmm_block *nb)
 static inline void
 dealloc_nvmm(nvmm_block *nb)
 {
-#if defined(ZC706)
-    munmap(nb->va, nb->size);
-#else
-    free(nb->va);
-#endif
+    if (unlikely(nonNull((void *) opt_pmcheck)))
+        pm_unmap(nb);
+
+    /* contents are lost (emulation) or not tracked any more */
+    mark_zero(nb->heap, (nb->pa - nb->heap->pa) / PAGESIZE,
+              (nb->pa - nb->heap->pa + nb->size) / PAGESIZE, 0);
+
+    /* replace with inaccessible mapping to keep address space reserved */
+    mmap(nb->va, nb->size, PROT_NONE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+
+    return;
+}
+
+
+/**
+ * Reserve virtual address space for whole window of heap
+ * base address is aligned by NB_ALIGN, so va and pa of nvmm_block
+ * are congruent modulo NB_ALIGN (required for section/huge page)
+ *
+ * @param heap
+ *            target nvmm_heap
+ *
+ * @return none
+ *
+ */
+static inline void
+reserve_nvmm_va(nvmm_heap *heap)
+{
+    byte *ptr, *base;
+    size_t size;
 
+    /* reserve with slack for alignment */
+    size = heap->size + NB_ALIGN;
+    ptr = (byte *) mmap(0, size, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED) {
+        set_msg("reserve_nvmm_va::mmap(ptr)");
+        exit_perror(errno);
+    }
+
+    /* trim head and tail of slack */
+    base = (byte *) align_size((addr_t) ptr, NB_ALIGN);
+    if (base != ptr)
+        munmap(ptr, base - ptr);
+    if (base + heap->size != ptr + size)
+        munmap(base + heap->size, (ptr + size) - (base + heap->size));
+
+    heap->va_base = base;
     return;
 }
 
@@ -348,29 +701,31 @@ dealloc_nvmm(nvmm_block *nb)
 /**
  * Allocate nvmm_region
  *
- * @param none
+ * @param heap
+ *            nvmm_heap which has pool of nvmm_region
  *
  * @return allocated nvmm_region
  *
  */
 static inline nvmm_region *
-alloc_nvmm_region()
+alloc_nvmm_region(nvmm_heap *heap)
 {
     nvmm_region *nr;
 
     /*
-     * At first, try to get from nvmm_region_pool.
+     * At first, try to get from heap->nr_pool.
      * if failed, call malloc
      */
-    if (nonNull(nvmm_region_pool)) {
-        nr = nvmm_region_pool;
-        nvmm_region_pool = nvmm_region_pool->next;
+    if (nonNull(heap->nr_pool)) {
+        nr = heap->nr_pool;
+        heap->nr_pool = heap->nr_pool->next;
     } else {
         nr = (nvmm_region *) malloc(sizeof(nvmm_region));
         if (unlikely(isNull(nr))) {
             set_msg("alloc_nvmm_region::malloc(nr)");
             exit_perror(errno);
         }
+        heap->num_nr++;
     }
 
     return nr;
@@ -378,7 +733,7 @@ alloc_nvmm_region()
 
 
 /**
- * De-allocate NVMM (Return nr to nvmm_region_pool)
+ * De-allocate NVMM (Return nr to nr_pool of parent nvmm_heap)
  *
  * @param nr
  *            target nvmm_region
@@ -389,147 +744,186 @@ alloc_nvmm_region()
 static inline void
 dealloc_nvmm_region(nvmm_region *nr)
 {
-    nr->next = nvmm_region_pool;
-    nvmm_region_pool = nr;
+    nvmm_heap *heap = nr->nb->heap;
+
+    nr->next = heap->nr_pool;
+    heap->nr_pool = nr;
     return;
 }
 
 
 /**
- * Allocate nvmm_block
+ * Move nvmm_block to its position in nb_table after nb->free is changed
+ * only nb is out of order, so nb_table is never sorted again as a whole
  *
- * @param none
+ * @param nb
+ *            target nvmm_block
  *
- * @return allocated nvmm_block
+ * @return none
  *
  */
-static inline nvmm_block *
-alloc_nvmm_block()
+static inline void
+sort_nvmm_block(nvmm_block *nb)
 {
-    nvmm_block *nb;
+    nvmm_block **table = nb->heap->nb_table;
+    int idx = nb->idx;
 
-    nb = (nvmm_block *) malloc(sizeof(nvmm_block));
-    if (unlikely(isNull(nb))) {
-        set_msg("alloc_nvmm_block::malloc(nb)");
-        exit_perror(errno);
+    /* nvmm_blocks which have more free bytes go right */
+    for (; idx > 0 && table[idx - 1]->free > nb->free; --idx) {
+        table[idx] = table[idx - 1];
+        table[idx]->idx = idx;
     }
 
-    nb->nr = NULL;
+    /* nvmm_blocks which have less free bytes go left */
+    for (; idx < nb->heap->num_nb - 1 && table[idx + 1]->free < nb->free; ++idx) {
+        table[idx] = table[idx + 1];
+        table[idx]->idx = idx;
+    }
 
-    /* add to nvmm_block_table */
-    nvmm_block_table[num_nvmm_block++] = nb;
+    table[idx] = nb;
+    nb->idx = idx;
 
-    return nb;
+    return;
 }
 
 
 /**
- * Add new nvmm_block
+ * Append nvmm_block which became fully free to LRU list of heap
+ * pinned nvmm_block is never retained (never unmapped by purge or reclaim)
  *
- * @param srcnb
- *             source nvmm_block
- * @param size
- *             size of nvmm_region
+ * @param nb
+ *            target nvmm_block (fully free)
  *
- * @return pointer to new nvmm_block
+ * @return none
  *
  */
-static inline nvmm_block *
-new_nvmm_block(nvmm_block *srcnb, size_t size)
+static inline void
+retain_nvmm_block(nvmm_block *nb)
 {
-    size_t mmapsize;
-    nvmm_block *nb;
-    nvmm_region *nr;
-
-    /* size alignment */
-    mmapsize = to_mmapsize(size);
-
-    /* allocate new nvmm_block */
-    nb = alloc_nvmm_block();
-
-    /* cutoff mmapsize from srcnb */
-    nb->pa     = srcnb->pa;
-    srcnb->pa += mmapsize;
-
-    nb->size     = mmapsize;
-    nb->free     = mmapsize;
-    srcnb->free -= mmapsize;
-
-    /* allocate NVMM */
-    alloc_nvmm(nb);
+    nvmm_heap *heap = nb->heap;
 
-    /* add allocatable region */
-    nr = alloc_nvmm_region();
-    nr->size = mmapsize;
-    nr->ptr  = (byte *) (nb->va);
-    nr->prev = NULL;
-    nr->next = NULL;
-    nr->nb   = nb;
-    nb->nr   = nr;
+    nb->idle = now_ms();
+    if (nb->pinned || nb->retained)
+        return;
 
-    sorted_by_free = 0;
+    nb->retained = 1;
+    nb->lru_prev = heap->lru_tail;
+    nb->lru_next = NULL;
+    if (isNull(heap->lru_tail))
+        heap->lru_head = nb;
+    else
+        heap->lru_tail->lru_next = nb;
+    heap->lru_tail = nb;
+    heap->retained += nb->size;
 
-    /* all done */
-    return nb;
+    return;
 }
 
 
 /**
- * Remove nvmm_region from linked-list
+ * Remove nvmm_block from LRU list of heap (it is used again or unmapped)
  *
- * @param nr
- *            target nvmm_region
  * @param nb
- *            parent nvmm_block of nr
+ *            target nvmm_block
  *
  * @return none
  *
  */
 static inline void
-remove_nvmm_region(nvmm_region *nr)
+unretain_nvmm_block(nvmm_block *nb)
 {
-    if (unlikely(isNull(nr->prev)))
-        nr->nb->nr = nr->next;
-    else
-        nr->prev->next = nr->next;
+    nvmm_heap *heap = nb->heap;
 
-    if (unlikely(isNull(nr->next)))
-        ;
+    if (likely(!nb->retained))
+        return;
+
+    if (isNull(nb->lru_prev))
+        heap->lru_head = nb->lru_next;
     else
-        nr->next->prev = nr->prev;
+        nb->lru_prev->lru_next = nb->lru_next;
+    if (isNull(nb->lru_next))
+        heap->lru_tail = nb->lru_prev;
+    else
+        nb->lru_next->lru_prev = nb->lru_prev;
+    nb->retained = 0;
+    heap->retained -= nb->size;
 
-    /* all done */
     return;
 }
 
 
 /**
- * Remove nvmm_region and free
+ * Allocate not mmaped nvmm_block which has [pa, pa + free)
  *
- * @param nr
- *            target nvmm_region
- * @param nb
- *            parent nvmm_block of nr
+ * @param heap
+ *            parent nvmm_heap
+ * @param next
+ *            physically following nvmm_block (NULL for first nvmm_block)
+ * @param pa
+ *            physical address
+ * @param free
+ *            bytes of nvmm_block
  *
- * @return none
+ * @return allocated nvmm_block
  *
  */
-static inline void
-del_nvmm_region(nvmm_region *nr)
+static inline nvmm_block *
+alloc_nvmm_block(nvmm_heap *heap, nvmm_block *next, addr_t pa, size_t free)
 {
-    /* remove from linked-list */
-    remove_nvmm_region(nr);
+    nvmm_block *nb;
+    nvmm_block **table;
 
-    /* free */
-    dealloc_nvmm_region(nr);
+    nb = (nvmm_block *) malloc(sizeof(nvmm_block));
+    if (unlikely(isNull(nb))) {
+        set_msg("alloc_nvmm_block::malloc(nb)");
+        exit_perror(errno);
+    }
 
-    /* all done */
-    return;
+    nb->pa   = pa;
+    nb->va   = NULL;
+    nb->size = 0;
+    nb->free = free;
+    nb->nr   = NULL;
+    nb->attr   = NVMM_ATTR_CACHED;
+    nb->pinned = 0;
+    nb->arena  = 0;
+    nb->retained = 0;
+    nb->rover  = NULL;
+    nb->heap   = heap;
+
+    /* link before next (address order) */
+    nb->next = next;
+    nb->prev = isNull(next) ? NULL : next->prev;
+    if (isNull(nb->prev))
+        heap->nb_head = nb;
+    else
+        nb->prev->next = nb;
+    if (nonNull(next))
+        next->prev = nb;
+
+    /* extend nb_table if full */
+    if (unlikely(heap->num_nb == heap->maxn_nb)) {
+        table = (nvmm_block **) realloc(heap->nb_table,
+                                        sizeof(nvmm_block *) * heap->maxn_nb * 2);
+        if (unlikely(isNull(table))) {
+            set_msg("alloc_nvmm_block::realloc(nb_table)");
+            exit_perror(errno);
+        }
+        heap->nb_table = table;
+        heap->maxn_nb *= 2;
+    }
+
+    /* add to nb_table */
+    nb->idx = heap->num_nb;
+    heap->nb_table[heap->num_nb++] = nb;
+    sort_nvmm_block(nb);
+
+    return nb;
 }
 
 
 /**
- * Delete nvmm_block
+ * Delete not mmaped nvmm_block from heap
  *
  * @param nb
  *            target nvmm_block
@@ -538,107 +932,182 @@ del_nvmm_region(nvmm_region *nr)
  *
  */
 static inline void
-del_nvmm_block(nvmm_block *nb)
+drop_nvmm_block(nvmm_block *nb)
 {
-    nvmm_region *nr, *nrn;
-
-    /* free all nvmm_region */
-    for (nr = nb->nr; nr != NULL; nr = nrn) {
-        nrn = nr->next;
+    nvmm_heap *heap = nb->heap;
+    int idx, attr;
 
-        free(nr);
+    /* unlink (address order) */
+    if (isNull(nb->prev))
+        heap->nb_head = nb->next;
+    else
+        nb->prev->next = nb->next;
+    if (nonNull(nb->next))
+        nb->next->prev = nb->prev;
+
+    /* remove from nb_table (order is kept) */
+    for (idx = nb->idx; idx < heap->num_nb - 1; ++idx) {
+        heap->nb_table[idx] = heap->nb_table[idx + 1];
+        heap->nb_table[idx]->idx = idx;
+    }
+    heap->num_nb--;
+
+    /* clear cache */
+    for (attr = 0; attr < NVMM_NATTR; ++attr) {
+        if (heap->nbb[attr] == nb)
+            heap->nbb[attr] = NULL;
     }
 
-    /* free */
     free(nb);
 
-    /* all done */
     return;
 }
 
 
 /**
- * Add new nvmm_region to given nvmm_block
- * +++ENTRY FUNCTION from NVMM_Malloc+++
+ * Merge not mmaped nvmm_block with physically adjacent not mmaped nvmm_blocks
+ * called whenever nvmm_block becomes not mmaped, so not mmaped nvmm_blocks
+ * are always maximal extents
  *
  * @param nb
- *            source nvmm_block
- * @param size
- *            size of NVMM region
+ *            target nvmm_block (not mmaped)
  *
- * @return pointer to allocated region
+ * @return none
  *
  */
-static inline void *
-new_nvmm_region(nvmm_block *nb, size_t size)
+static inline void
+merge_nvmm_block(nvmm_block *nb)
 {
-    nvmm_region *nr, *nrb;
-    region_info *ri;
+    nvmm_block *nbp = nb->prev;
+    nvmm_block *nbn = nb->next;
 
-    /* add sizeof(region_info) to size */
-    size += sizeof(region_info);
+    if (nonNull(nbp) && isNull(nbp->va)) {
+        nb->pa    = nbp->pa;
+        nb->free += nbp->free;
+        drop_nvmm_block(nbp);
+    }
 
-    /* if nb has not been mmaped, map */
-    if (unlikely(isNull(nb->va)))
-        nb = new_nvmm_block(nb, size);
+    if (nonNull(nbn) && isNull(nbn->va)) {
+        nb->free += nbn->free;
+        drop_nvmm_block(nbn);
+    }
 
-    /* set cache */
-    nbb = nb;
+    sort_nvmm_block(nb);
 
-    /* look for enough nvmm_region */
-    for (nr = nb->nr; nr != NULL; nr = nr->next) {
-        if (size <= nr->size)
-            break;
-    }
+    return;
+}
 
-    /* if nr is NULL, no enough nvmm_region */
-    if (unlikely(isNull(nr)))
-        return NULL;
 
-    /* allocate new nvmm_region & cut size from nr */
-    nrb = alloc_nvmm_region();
-    nrb->size  = size;
-    nr->size  -= size;
-    nrb->ptr   = nr->ptr;
-    nr->ptr   += size;
-    nb->free  -= size;
-    nrb->nb    = nb;
+/**
+ * Move head of not mmaped srcnb to heap->cursor (NVMM_POLICY=wear)
+ * [srcnb->pa, cursor) is left as another not mmaped nvmm_block
+ *
+ * @param srcnb
+ *             source nvmm_block (not mmaped)
+ * @param mmapsize
+ *             bytes to be carved from srcnb
+ *
+ * @return none
+ *
+ */
+static inline void
+seek_nvmm_block(nvmm_block *srcnb, size_t mmapsize)
+{
+    nvmm_block *nb;
+    addr_t pa = srcnb->pa;
+    addr_t cursor = srcnb->heap->cursor;
 
-    /* set region_info */
-    ri = (region_info *) (nrb->ptr);
-    ri->nr   = nrb;
-    ri->size = nrb->size;
+    /* cursor is out of srcnb, carve from head */
+    if (cursor <= srcnb->pa || srcnb->pa + srcnb->free < cursor + mmapsize)
+        return;
 
-    /* register to nvmm_region_table */
-    nrb->prev = NULL;
-    nrb->next = NULL;
+    srcnb->pa    = cursor;
+    srcnb->free -= cursor - pa;
+    sort_nvmm_block(srcnb);
 
-    /* try to delete nr */
-    if (nr->size == 0)
-        del_nvmm_region(nr);
+    nb = alloc_nvmm_block(srcnb->heap, srcnb, pa, cursor - pa);
+    nb->idle = srcnb->idle;
 
-    return (void *) (nrb->ptr + sizeof(region_info));
+    return;
 }
 
 
 /**
- * Return region size corresponding ptr
+ * Add new nvmm_block
  *
- * @param ptr
- *            pointer to allocated region
+ * @param srcnb
+ *             source nvmm_block
+ * @param size
+ *             size of nvmm_region
+ * @param flags
+ *             mapping attribute of new nvmm_block (and NVMM_PREFAULT)
+ *
+ * @return pointer to new nvmm_block (NULL if mmap failed)
  *
- * @return if ptr is     allocated, return size (> 0)
- *         if ptr is NOT allocated, return size (smaller than ZERO)
  */
-static inline size_t
-get_alloc_size(void *ptr)
+static inline nvmm_block *
+new_nvmm_block(nvmm_block *srcnb, size_t size, int flags)
 {
-    return ptr_to_ri(ptr)->size;
+    size_t mmapsize;
+    nvmm_block *nb;
+    nvmm_region *nr;
+
+    /* size alignment */
+    mmapsize = to_mmapsize(size);
+
+    /* remainder of srcnb is smaller than mmapsize, take all */
+    if (mmapsize > srcnb->free)
+        mmapsize = srcnb->free;
+
+    /* rotate carve position over window */
+    if (opt_policy == POLICY_WEAR)
+        seek_nvmm_block(srcnb, mmapsize);
+
+    /* cutoff mmapsize from srcnb */
+    srcnb->pa   += mmapsize;
+    srcnb->free -= mmapsize;
+    sort_nvmm_block(srcnb);
+
+    /* allocate new nvmm_block */
+    nb = alloc_nvmm_block(srcnb->heap, srcnb, srcnb->pa - mmapsize, mmapsize);
+    nb->size = mmapsize;
+    nb->attr = flags & NVMM_ATTR_MASK;
+    nb->idle = now_ms();
+
+    /* next carve position */
+    nb->heap->cursor = nb->pa + mmapsize;
+    if (nb->heap->cursor >= nb->heap->pa + nb->heap->size)
+        nb->heap->cursor = nb->heap->pa;
+
+    /* allocate NVMM (if failed, give back mmapsize to srcnb) */
+    if (unlikely(alloc_nvmm(nb, opt_prefault || (flags & NVMM_PREFAULT)) != 0)) {
+        drop_nvmm_block(nb);
+        srcnb->pa   -= mmapsize;
+        srcnb->free += mmapsize;
+        merge_nvmm_block(srcnb);
+        return NULL;
+    }
+
+    /* drop empty srcnb (all bytes have been carved) */
+    if (srcnb->free == 0)
+        drop_nvmm_block(srcnb);
+
+    /* add allocatable region */
+    nr = alloc_nvmm_region(nb->heap);
+    nr->size = mmapsize;
+    nr->ptr  = (byte *) (nb->va);
+    nr->prev = NULL;
+    nr->next = NULL;
+    nr->nb   = nb;
+    nb->nr   = nr;
+
+    /* all done */
+    return nb;
 }
 
 
 /**
- * Try to merge nvmm_region
+ * Remove nvmm_region from linked-list
  *
  * @param nr
  *            target nvmm_region
@@ -649,33 +1118,46 @@ get_alloc_size(void *ptr)
  *
  */
 static inline void
-merge_nvmm_region(nvmm_region *nr)
+remove_nvmm_region(nvmm_region *nr)
 {
-    nvmm_region *nrp, *nrn;
-    int is_merged;
+    /* next-fit restarts from next region */
+    if (unlikely(nr->nb->rover == nr))
+        nr->nb->rover = nr->next;
 
-    do {
-        is_merged = 0;
+    if (unlikely(isNull(nr->prev)))
+        nr->nb->nr = nr->next;
+    else
+        nr->prev->next = nr->next;
 
-        /* try to merge with nr & nr->prev */
-        nrp = nr->prev;
-        if (!isNull(nrp) && (nrp->ptr + nrp->size == nr->ptr)) {
-            nr->ptr   = nrp->ptr;
-            nr->size += nrp->size;
+    if (unlikely(isNull(nr->next)))
+        ;
+    else
+        nr->next->prev = nr->prev;
 
-            del_nvmm_region(nrp);
-            ++is_merged;
-        }
+    /* all done */
+    return;
+}
 
-        /* try to merge with nr & nr->next */
-        nrn = nr->next;
-        if (!isNull(nrn) && (nr->ptr + nr->size == nrn->ptr)) {
-            nr->size += nrn->size;
 
-            del_nvmm_region(nrn);
-            ++is_merged;
-        }
-    } while (is_merged);
+/**
+ * Remove nvmm_region and free
+ *
+ * @param nr
+ *            target nvmm_region
+ * @param nb
+ *            parent nvmm_block of nr
+ *
+ * @return none
+ *
+ */
+static inline void
+del_nvmm_region(nvmm_region *nr)
+{
+    /* remove from linked-list */
+    remove_nvmm_region(nr);
+
+    /* free */
+    dealloc_nvmm_region(nr);
 
     /* all done */
     return;
@@ -683,116 +1165,555 @@ merge_nvmm_region(nvmm_region *nr)
 
 
 /**
- * Try to merge nvmm_block
+ * Delete nvmm_block
  *
- * @param nr
+ * @param nb
  *            target nvmm_block
  *
  * @return none
  *
  */
 static inline void
-merge_nvmm_block()
+del_nvmm_block(nvmm_block *nb)
 {
-    nvmm_block *nb, *nbn;
-    int idx, idxn;
-    int merge_cnt;
+    nvmm_region *nr, *nrn;
 
-    /* quick sort nvmm_block_table by pa */
-    qsort(nvmm_block_table, num_nvmm_block, sizeof(nvmm_block *), cmp_by_pa);
+    /* free all nvmm_region */
+    for (nr = nb->nr; nr != NULL; nr = nrn) {
+        nrn = nr->next;
 
-    /* deallocate nvmm of deallocatable nvmm_block */
-    for (idx = 0; idx < num_nvmm_block; ++idx) {
-        nb = nvmm_block_table[idx];
-        if (deallocatable(nb))
-            dealloc_nvmm(nb);
+        free(nr);
+        nb->heap->num_nr--;
     }
 
-    /* try to merge */
-    merge_cnt = 0; /* number of merged nvmm_block */
-    for (idx = 0; idx < num_nvmm_block; ) {
-        nb = nvmm_block_table[idx];
+    /* free */
+    free(nb);
+
+    /* all done */
+    return;
+}
+
 
-        /* if nb->va is NOT NULL, can't merge with others */
-        if (nonNull(nb->va)) {
-            ++idx;
+/**
+ * Record part of allocated region which may be non-zero, and clear
+ * known-zero pages of the region
+ *
+ * @param nr
+ *            allocated nvmm_region
+ *
+ * @return none
+ *
+ */
+static inline void
+set_dirty(nvmm_region *nr)
+{
+    nvmm_heap *heap = nr->nb->heap;
+    addr_t lo, hi, dlo, dhi, off, end;
+    size_t page;
+
+    /* user data in window */
+    lo = nr->ptr + sizeof(region_info) - heap->va_base;
+    hi = nr->ptr + nr->size - heap->va_base;
+
+    dlo = hi;
+    dhi = lo;
+    for (page = lo / PAGESIZE; page * PAGESIZE < hi; ++page) {
+        if (zero_page(heap, page))
             continue;
-        }
+        off = (page * PAGESIZE < lo) ? lo : page * PAGESIZE;
+        end = ((page + 1) * PAGESIZE > hi) ? hi : (page + 1) * PAGESIZE;
+        if (off < dlo)
+            dlo = off;
+        if (end > dhi)
+            dhi = end;
+    }
 
-        /* merge with succeesing nvmm_block */
-        for (idxn = idx + 1; idxn < num_nvmm_block; ++idxn) {
-            nbn = nvmm_block_table[idxn];
-            if (isNull(nbn) || nonNull(nbn->va))
-                break;
+    if (dlo < dhi) {
+        nr->dirty_off = dlo - lo;
+        nr->dirty_len = dhi - dlo;
+    } else {
+        nr->dirty_off = 0;
+        nr->dirty_len = 0;
+    }
+
+    mark_zero(heap, (nr->ptr - heap->va_base) / PAGESIZE,
+              (hi + PAGESIZE - 1) / PAGESIZE, 0);
+    return;
+}
 
-            /* merge */
-            nb->free += nbn->free;
-            del_nvmm_block(nbn);
-            nvmm_block_table[idxn] = NULL;
-            ++merge_cnt;
-        }
 
-        idx = idxn + 1;
+/**
+ * Cut [at, at + size) from idle nvmm_region and allocate it
+ * if at is not head of nr, nr is split into front and back
+ *
+ * @param nr
+ *            idle nvmm_region which contains [at, at + size)
+ * @param at
+ *            head of new region (region_info)
+ * @param size
+ *            size of new region (including region_info)
+ *
+ * @return pointer to allocated region
+ *
+ */
+static inline void *
+cut_nvmm_region(nvmm_region *nr, byte *at, size_t size)
+{
+    nvmm_block *nb = nr->nb;
+    nvmm_region *nrb, *nrn;
+    region_info *ri;
+    size_t back;
+
+    back = (nr->ptr + nr->size) - (at + size);
+
+    if (unlikely(at != nr->ptr)) {
+        /* nr keeps front, and back is inserted after nr */
+        nr->size = at - nr->ptr;
+        if (back > 0) {
+            nrn = alloc_nvmm_region(nb->heap);
+            nrn->ptr  = at + size;
+            nrn->size = back;
+            nrn->nb   = nb;
+            nrn->prev = nr;
+            nrn->next = nr->next;
+            if (nonNull(nr->next))
+                nr->next->prev = nrn;
+            nr->next = nrn;
+        }
+        nb->rover = nr->next;
+    } else {
+        /* cut head of nr */
+        nr->size -= size;
+        nr->ptr  += size;
+        nb->rover = nr;
     }
 
-    /* quick sort nvmm_block_table by free */
-    qsort(nvmm_block_table, num_nvmm_block, sizeof(nvmm_block *), cmp_by_free_nc);
-    sorted_by_free = 1;
+    /* allocate new nvmm_region */
+    nrb = alloc_nvmm_region(nb->heap);
+    nrb->size = size;
+    nrb->ptr  = at;
+    nrb->nb   = nb;
+    nrb->sampled = 0;
+    unretain_nvmm_block(nb);
+    nb->free -= size;
+    nb->heap->num_region++;
+    sort_nvmm_block(nb);
 
-    /* update num_nvmm_block */
-    num_nvmm_block -= merge_cnt;
+    /* pages are no longer known-zero (NVMM_Calloc skips known-zero part) */
+    set_dirty(nrb);
 
-    /* clear cache */
-    nbb = NULL;
+    /* set region_info */
+    ri = (region_info *) (nrb->ptr);
+    ri->nr   = nrb;
+    ri->size = nrb->size;
+#if defined(NVMM_CRASHSIM)
+    crash_keep(nb->heap, ri, sizeof(region_info));
+#endif
+    if (unlikely(nonNull((void *) opt_pmcheck)))
+        pm_keep(nb->heap, ri, sizeof(region_info));
 
-    /* all done */
-    return;
+    /* register to nvmm_region_table */
+    nrb->prev = NULL;
+    nrb->next = NULL;
+
+    /* try to delete nr */
+    if (nr->size == 0)
+        del_nvmm_region(nr);
+
+    return (void *) (nrb->ptr + sizeof(region_info));
 }
 
+
 /**
- * Move nvmm_region(busy) to nvmm_region(idle)
+ * Look for enough nvmm_region from nb->rover, and wrap around (next-fit)
+ * nb->rover is updated by remove_nvmm_region, so it is always in idle list
  *
- * @param ptr
- *            ptr to allocated region
+ * @param nb
+ *            source nvmm_block
+ * @param size
+ *            size of nvmm_region
  *
- * @return none
+ * @return enough nvmm_region (NULL if not found)
  *
  */
-static inline void
-free_nvmm_region(void *ptr)
+static inline nvmm_region *
+next_fit_nvmm_region(nvmm_block *nb, size_t size)
 {
-    nvmm_block *nb;
-    nvmm_region *nr, *nrp, *nrn;
+    nvmm_region *nr;
 
-    /* remove from nvmm_region_table */
-    nr = ptr_to_ri(ptr)->nr;
-    nb = nr->nb;
+    for (nr = nb->rover; nr != NULL; nr = nr->next) {
+        if (size <= nr->size)
+            return nr;
+    }
 
-    /* insert to linked-list (idle) */
-    nb->free += nr->size;
-    if (isNull(nb->nr)) {
-        nb->nr = nr;
-    } else {
-        nrp = nb->nr;
-        nrn = nrp->next;
-        for(;;) {
-            /* idle list is sorted by ascending order of ptr */
-            if (isNull(nrn)) {
-                /* if nrn is NULL, insert nrp -> nr -> NULL */
-                nrp->next = nr;
-                nr->prev = nrp;
+    for (nr = nb->nr; nr != nb->rover; nr = nr->next) {
+        if (size <= nr->size)
+            return nr;
+    }
 
-                //nrn->prev = nr;
-                nr->next = nrn;
+    return NULL;
+}
 
-                break;
-            } else if (nrp->ptr < nr->ptr && nr->ptr < nrn->ptr) {
-                /* nrp < nr < nrn, insert nrp -> nr -> nrn */
-                nrp->next = nr;
-                nr->prev = nrp;
 
-                nrn->prev = nr;
-                nr->next = nrn;
+/**
+ * Add new nvmm_region to given nvmm_block
+ * +++ENTRY FUNCTION from NVMM_Malloc+++
+ *
+ * @param nb
+ *            source nvmm_block
+ * @param size
+ *            size of NVMM region
+ * @param flags
+ *            mapping attribute of NVMM region (and NVMM_PREFAULT)
+ *
+ * @return pointer to allocated region
+ *
+ */
+static inline void *
+new_nvmm_region(nvmm_block *nb, size_t size, int flags)
+{
+    nvmm_region *nr;
+
+    /* add sizeof(region_info) to size */
+    size += sizeof(region_info);
+
+    /* if nb has not been mmaped, map */
+    if (unlikely(isNull(nb->va))) {
+        if (unlikely(size > nb->free))
+            return NULL;
+        nb = new_nvmm_block(nb, size, flags);
+        if (unlikely(isNull(nb)))
+            return NULL;
+    }
+
+    /* set cache */
+    nb->heap->nbb[nb->attr] = nb;
+
+    /* look for enough nvmm_region */
+    if (opt_policy == POLICY_WEAR) {
+        nr = next_fit_nvmm_region(nb, size);
+    } else {
+        for (nr = nb->nr; nr != NULL; nr = nr->next) {
+            if (size <= nr->size)
+                break;
+        }
+    }
+
+    /* if nr is NULL, no enough nvmm_region */
+    if (unlikely(isNull(nr)))
+        return NULL;
+
+    return cut_nvmm_region(nr, nr->ptr, size);
+}
+
+
+/**
+ * Return region size corresponding ptr
+ *
+ * @param ptr
+ *            pointer to allocated region
+ *
+ * @return if ptr is     allocated, return size (> 0)
+ *         if ptr is NOT allocated, return size (smaller than ZERO)
+ */
+static inline size_t
+get_alloc_size(void *ptr)
+{
+    return ptr_to_ri(ptr)->size;
+}
+
+
+/**
+ * Try to merge nvmm_region
+ *
+ * @param nr
+ *            target nvmm_region
+ * @param nb
+ *            parent nvmm_block of nr
+ *
+ * @return none
+ *
+ */
+static inline void
+merge_nvmm_region(nvmm_region *nr)
+{
+    nvmm_region *nrp, *nrn;
+    int is_merged;
+
+    do {
+        is_merged = 0;
+
+        /* try to merge with nr & nr->prev */
+        nrp = nr->prev;
+        if (!isNull(nrp) && (nrp->ptr + nrp->size == nr->ptr)) {
+            nr->ptr   = nrp->ptr;
+            nr->size += nrp->size;
+
+            del_nvmm_region(nrp);
+            ++is_merged;
+        }
+
+        /* try to merge with nr & nr->next */
+        nrn = nr->next;
+        if (!isNull(nrn) && (nr->ptr + nr->size == nrn->ptr)) {
+            nr->size += nrn->size;
+
+            del_nvmm_region(nrn);
+            ++is_merged;
+        }
+    } while (is_merged);
+
+    /* all done */
+    return;
+}
+
+
+/**
+ * Unmap fully free nvmm_block
+ * nvmm_block is kept in nb_table as not mmaped nvmm_block, and merged with
+ * physically adjacent not mmaped nvmm_blocks
+ *
+ * @param nb
+ *            target nvmm_block
+ *
+ * @return none
+ *
+ */
+static inline void
+unmap_nvmm_block(nvmm_block *nb)
+{
+    nvmm_region *nr, *nrn;
+
+    unretain_nvmm_block(nb);
+    dealloc_nvmm(nb);
+
+    /* return all nvmm_region to pool */
+    for (nr = nb->nr; nr != NULL; nr = nrn) {
+        nrn = nr->next;
+        dealloc_nvmm_region(nr);
+    }
+
+    /* not mmaped nvmm_block has [pa, pa + free) */
+    nb->nr    = NULL;
+    nb->rover = NULL;
+    nb->va    = NULL;
+    nb->free  = nb->size;
+    nb->size  = 0;
+
+    merge_nvmm_block(nb);
+
+    return;
+}
+
+
+/**
+ * Unmap retained nvmm_block by decay time and high-water mark
+ * LRU list is in order of idle time, so only its head is examined
+ *
+ * @param heap
+ *            target nvmm_heap
+ *
+ * @return none
+ *
+ */
+static inline void
+purge_nvmm_block(nvmm_heap *heap)
+{
+    nvmm_block *nb;
+    int64_t now;
+
+    now = now_ms();
+    while (nonNull(nb = heap->lru_head)) {
+        if (heap->retained <= opt_retain_max &&
+            (opt_decay_ms == 0 || now - nb->idle < opt_decay_ms))
+            break;
+        unmap_nvmm_block(nb);
+    }
+
+    return;
+}
+
+
+/**
+ * Unmap nvmm_block idle over NVMM_DECAY_MS at allocation
+ * (checked at most every NVMM_DECAY_MS, so process which no longer frees
+ *  also returns retained nvmm_block)
+ *
+ * @param heap
+ *            target nvmm_heap (locked)
+ *
+ * @return none
+ *
+ */
+static inline void
+decay_nvmm_block(nvmm_heap *heap)
+{
+    int64_t now;
+
+    if (likely(opt_decay_ms == 0))
+        return;
+
+    now = now_ms();
+    if (now < heap->decay_next)
+        return;
+    heap->decay_next = now + opt_decay_ms;
+
+    purge_nvmm_block(heap);
+    return;
+}
+
+
+/**
+ * Unmap retained nvmm_block in LRU order until not mmaped nvmm_block
+ * which has enough bytes appears (pinned nvmm_block is not unmapped)
+ *
+ * @param heap
+ *            target nvmm_heap
+ * @param size
+ *            required bytes
+ *
+ * @return 1 if succeeded, 0 if no more nvmm_block can be unmapped
+ *
+ */
+static inline int
+reclaim_nvmm_block(nvmm_heap *heap, size_t size)
+{
+    nvmm_block *nb;
+    int idx;
+
+    /* enough not mmaped nvmm_block? */
+    for (idx = 0; idx < heap->num_nb; ++idx) {
+        nb = heap->nb_table[idx];
+        if (isNull(nb->va) && size <= nb->free)
+            return 1;
+    }
+
+    /* unmapped nvmm_block is merged into nb */
+    while (nonNull(nb = heap->lru_head)) {
+        unmap_nvmm_block(nb);
+        if (size <= nb->free)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Call reclaim callback (NVMM_SetReclaim) on exhaustion
+ * heap is unlocked during callback, so that callback can free NVMM
+ *
+ * @param heap
+ *            exhausted nvmm_heap (locked)
+ * @param size
+ *            required bytes
+ * @param tries
+ *            times of callback in this allocation (updated)
+ *
+ * @return 1 if callback freed NVMM (retry), 0 if not
+ *
+ */
+static int
+oom_retry(nvmm_heap *heap, size_t size, int *tries)
+{
+    int freed;
+
+    /* callback must not be nested (allocation in callback fails) */
+    if (isNull((void *) reclaim_fn) || in_reclaim || *tries >= RECLAIM_MAX)
+        return 0;
+    (*tries)++;
+
+    in_reclaim = 1;
+    heap_unlock(heap);
+    freed = reclaim_fn(heap, size, reclaim_arg);
+    heap_lock(heap);
+    in_reclaim = 0;
+
+    return freed != 0;
+}
+
+
+/**
+ * Fail allocation on exhaustion
+ * NVMM_OOM_ABORT: report state of heap and exit (heap is unlocked before exit)
+ * NVMM_OOM_NULL : set errno to ENOMEM (caller returns NULL)
+ *
+ * @param heap
+ *            exhausted nvmm_heap (locked)
+ * @param func
+ *            name of allocation function
+ *
+ * @return none
+ *
+ */
+static void
+oom_fail(nvmm_heap *heap, const char *func)
+{
+    if (opt_oom == NVMM_OOM_NULL) {
+        errno = ENOMEM;
+        return;
+    }
+
+    /* with NVMM_HEAPSTAT, finalize reports all heaps */
+    if (isNull((void *) opt_heapstat))
+        dump_heap(stderr, heap);
+    heap_unlock(heap);
+
+    set_msg("%s::No Available NVMM\n", func);
+    exit_stderr();
+}
+
+/**
+ * Move nvmm_region(busy) to nvmm_region(idle)
+ * (region_info of nr is not read)
+ *
+ * @param nr
+ *            allocated nvmm_region
+ *
+ * @return none
+ *
+ */
+static inline void
+release_nvmm_region(nvmm_region *nr)
+{
+    nvmm_block *nb = nr->nb;
+    nvmm_region *nrp, *nrn;
+
+    /* insert to linked-list (idle) */
+    nb->free += nr->size;
+    nb->heap->num_region--;
+    sort_nvmm_block(nb);
+    if (isNull(nb->nr)) {
+        nr->prev = NULL;
+        nr->next = NULL;
+        nb->nr = nr;
+    } else if (nr->ptr < nb->nr->ptr) {
+        /* insert NULL -> nr -> head */
+        nr->prev = NULL;
+        nr->next = nb->nr;
+        nb->nr->prev = nr;
+        nb->nr = nr;
+    } else {
+        nrp = nb->nr;
+        nrn = nrp->next;
+        for(;;) {
+            /* idle list is sorted by ascending order of ptr */
+            if (isNull(nrn)) {
+                /* if nrn is NULL, insert nrp -> nr -> NULL */
+                nrp->next = nr;
+                nr->prev = nrp;
+
+                //nrn->prev = nr;
+                nr->next = nrn;
+
+                break;
+            } else if (nrp->ptr < nr->ptr && nr->ptr < nrn->ptr) {
+                /* nrp < nr < nrn, insert nrp -> nr -> nrn */
+                nrp->next = nr;
+                nr->prev = nrp;
+
+                nrn->prev = nr;
+                nr->next = nrn;
 
                 break;
             }
@@ -803,369 +1724,4547 @@ free_nvmm_region(void *ptr)
         }
     }
 
-    sorted_by_free = 0;
+    /* try to merge nvmm_region */
+    merge_nvmm_region(nr);
+
+    /* nb became fully free, retain it (or unmap by decay/high-water) */
+    if (deallocatable(nb)) {
+        retain_nvmm_block(nb);
+        if (opt_decay_ms > 0 || opt_retain_max != SIZE_MAX)
+            purge_nvmm_block(nb->heap);
+    }
+
+    /* all done */
+    return;
+}
+
+
+/**
+ * Move nvmm_region(busy) to nvmm_region(idle)
+ *
+ * @param ptr
+ *            ptr to allocated region
+ *
+ * @return none
+ *
+ */
+static inline void
+free_nvmm_region(void *ptr)
+{
+    release_nvmm_region(ptr_to_ri(ptr)->nr);
+    return;
+}
+
+
+/**
+ * Return index in nb_table
+ * nb_table[idx] is the first nvmm_block which has enough free bytes for size
+ *
+ * @param heap
+ *            target nvmm_heap
+ * @param size
+ *            allocation size
+ *
+ * @return index in nb_table (heap->num_nb if no nvmm_block has enough)
+ *
+ */
+static inline int
+get_nbt_idx(nvmm_heap *heap, size_t size)
+{
+
+    int left, right, mid;
+
+    /* binary search (lower bound) */
+    left = 0;
+    right = heap->num_nb;
+    while(left != right) {
+        mid = (left + right) / 2;
+        if (heap->nb_table[mid]->free < size)
+            left = mid + 1;
+        else
+            right = mid;
+    }
+
+    return left;
+}
+
+
+/**
+ * Acquire whole nvmm_block (for arena)
+ * all bytes of returned nvmm_block are consumed, so general allocation
+ * never carves nvmm_region from it
+ *
+ * @param heap
+ *            source nvmm_heap
+ * @param size
+ *            minimum bytes of nvmm_block
+ * @param flags
+ *            mapping attribute of nvmm_block (and NVMM_PREFAULT)
+ *
+ * @return acquired nvmm_block (NULL if exhausted and NVMM_OOM_NULL)
+ *
+ */
+static nvmm_block *
+acquire_nvmm_block(nvmm_heap *heap, size_t size, int flags)
+{
+    nvmm_block *nb;
+    nvmm_region *nr, *nrn;
+    int merged, tries;
+    int idx;
+    int attr = flags & NVMM_ATTR_MASK;
+
+    size = to_mmapsize(size);
+
+    /* look for not mmaped or fully free nvmm_block */
+    merged = 0;
+    tries  = 0;
+    for (;;) {
+        for (idx = get_nbt_idx(heap, size); idx < heap->num_nb; ++idx) {
+            nb = heap->nb_table[idx];
+            if (isNull(nb->va) || (nb->attr == attr && deallocatable(nb)))
+                break;
+        }
+
+        if (idx < heap->num_nb)
+            break;
+
+        if (merged == 0) {
+            /* if have not purged, unmap decayed nvmm_block and retry */
+            purge_nvmm_block(heap);
+        } else if (merged == 1 && reclaim_nvmm_block(heap, size)) {
+            /* unmapped retained nvmm_block, retry */
+        } else if (oom_retry(heap, size, &tries)) {
+            /* user freed NVMM, search again */
+            merged = -1;
+        } else {
+            oom_fail(heap, "acquire_nvmm_block");
+            return NULL;
+        }
+        ++merged;
+    }
+
+    /* if nb has not been mmaped, map */
+    if (isNull(nb->va)) {
+        nb = new_nvmm_block(nb, size, flags);
+        if (unlikely(isNull(nb))) {
+            oom_fail(heap, "acquire_nvmm_block");
+            return NULL;
+        }
+        heap->nbb[attr] = nb;
+    }
+
+    /* consume all of nb */
+    for (nr = nb->nr; nr != NULL; nr = nrn) {
+        nrn = nr->next;
+        dealloc_nvmm_region(nr);
+    }
+    unretain_nvmm_block(nb);
+    nb->nr    = NULL;
+    nb->rover = NULL;
+    nb->free  = 0;
+    nb->arena = 1;
+    sort_nvmm_block(nb);
+
+    /* arena writes without nvmm_region, so no page stays known-zero */
+    mark_zero(heap, (nb->pa - heap->pa) / PAGESIZE,
+              (nb->pa - heap->pa + nb->size) / PAGESIZE, 0);
+
+    return nb;
+}
+
+
+/**
+ * Release nvmm_block acquired by acquire_nvmm_block()
+ * nvmm_block becomes fully free, and reusable by general allocation
+ *
+ * @param nb
+ *            target nvmm_block
+ *
+ * @return none
+ *
+ */
+static void
+release_nvmm_block(nvmm_block *nb)
+{
+    nvmm_region *nr;
+
+    nr = alloc_nvmm_region(nb->heap);
+    nr->size = nb->size;
+    nr->ptr  = (byte *) (nb->va);
+    nr->prev = NULL;
+    nr->next = NULL;
+    nr->nb   = nb;
+
+    nb->nr    = nr;
+    nb->free  = nb->size;
+    nb->arena = 0;
+    sort_nvmm_block(nb);
+    retain_nvmm_block(nb);
+
+    return;
+}
+
+
+/**
+ * Map and prefault NVMM in advance
+ * reserved nvmm_block is free (allocatable) and never unmapped by purge
+ *
+ * @param heap
+ *            target nvmm_heap
+ * @param size
+ *            bytes to reserve
+ *
+ * @return none
+ *
+ */
+static void
+reserve_nvmm_block(nvmm_heap *heap, size_t size)
+{
+    nvmm_block *nb;
+
+    nb = acquire_nvmm_block(heap, size, NVMM_ATTR_CACHED | NVMM_PREFAULT);
+    if (unlikely(isNull(nb)))
+        return;
+    nb->pinned = 1;
+    release_nvmm_block(nb);
+
+    return;
+}
+
+
+/*
+ ********** Wear **********
+ */
+
+/**
+ * Allocate wear counters of heap if NVMM_WEAR is set
+ *
+ * @param heap
+ *            target nvmm_heap
+ *
+ * @return none
+ *
+ */
+static void
+alloc_wear(nvmm_heap *heap)
+{
+    size_t npage = heap->size / PAGESIZE;
+
+    heap->wear_lines  = NULL;
+    heap->wear_allocs = NULL;
+    if (likely(isNull((void *) opt_wear)))
+        return;
+
+    heap->wear_lines  = (uint64_t *) calloc(npage, sizeof(uint64_t));
+    heap->wear_allocs = (uint64_t *) calloc(npage, sizeof(uint64_t));
+    if (unlikely(isNull(heap->wear_lines) || isNull(heap->wear_allocs))) {
+        set_msg("alloc_wear::calloc(wear)");
+        exit_perror(errno);
+    }
+
+    return;
+}
+
+
+/**
+ * Return heap whose window contains va (NULL if not NVMM)
+ *
+ * @param va
+ *            virtual address
+ *
+ * @return nvmm_heap
+ *
+ */
+static inline nvmm_heap *
+va_to_heap(const byte *va)
+{
+    nvmm_heap *heap;
+    int i;
+
+    for (i = 0; i < NVMM_MAXN_HEAP; ++i) {
+        heap = nvmm_heap_table[i];
+        if (nonNull(heap) && heap->va_base <= va && va < heap->va_base + heap->size)
+            return heap;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Count allocation at ptr
+ *
+ * @param heap
+ *            source nvmm_heap
+ * @param ptr
+ *            allocated region
+ *
+ * @return none
+ *
+ */
+static inline void
+wear_alloc(nvmm_heap *heap, const void *ptr)
+{
+    size_t page = ((const byte *) ptr - heap->va_base) / PAGESIZE;
+
+    if (unlikely(isNull((void *) ptr)))
+        return;
+    __atomic_fetch_add(&heap->wear_allocs[page], 1, __ATOMIC_RELAXED);
+    return;
+}
+
+
+/**
+ * Count flushed cache lines in [va, va + size) per page
+ *
+ * @param va
+ *            start address
+ * @param size
+ *            bytes to be flushed
+ *
+ * @return none
+ *
+ */
+static void
+wear_flush(const void *va, size_t size)
+{
+    nvmm_heap *heap;
+    addr_t off, end, next;
+
+    heap = va_to_heap((const byte *) va);
+    if (isNull(heap) || size == 0)
+        return;
+
+    off = ((const byte *) va - heap->va_base) & ~((addr_t) CACHELINE - 1);
+    end = (const byte *) va - heap->va_base + size;
+    if (end > heap->size)
+        end = heap->size;
+
+    for (; off < end; off = next) {
+        next = (off / PAGESIZE + 1) * PAGESIZE;
+        if (next > end)
+            next = end;
+        __atomic_fetch_add(&heap->wear_lines[off / PAGESIZE],
+                           (next - off + CACHELINE - 1) / CACHELINE, __ATOMIC_RELAXED);
+    }
+
+    return;
+}
+
+
+/**
+ * Write heatmap of all heaps
+ *
+ * @param fp
+ *            output
+ *
+ * @return none
+ *
+ */
+static void
+dump_wear(FILE *fp)
+{
+    nvmm_heap *heap;
+    uint64_t lines, allocs, max_lines, max_allocs;
+    size_t npage, page, touched;
+    int i;
+
+    /* summary */
+    fprintf(fp, "# heap,pages,touched,lines,max_lines,allocs,max_allocs\n");
+    for (i = 0; i < NVMM_MAXN_HEAP; ++i) {
+        heap = nvmm_heap_table[i];
+        if (isNull(heap) || isNull(heap->wear_lines))
+            continue;
+
+        npage = heap->size / PAGESIZE;
+        touched = 0;
+        lines = allocs = max_lines = max_allocs = 0;
+        for (page = 0; page < npage; ++page) {
+            if (heap->wear_lines[page] == 0 && heap->wear_allocs[page] == 0)
+                continue;
+            touched++;
+            lines  += heap->wear_lines[page];
+            allocs += heap->wear_allocs[page];
+            if (heap->wear_lines[page] > max_lines)
+                max_lines = heap->wear_lines[page];
+            if (heap->wear_allocs[page] > max_allocs)
+                max_allocs = heap->wear_allocs[page];
+        }
+        fprintf(fp, "# %d,%zu,%zu,%llu,%llu,%llu,%llu\n", heap->id, npage, touched,
+                (unsigned long long) lines, (unsigned long long) max_lines,
+                (unsigned long long) allocs, (unsigned long long) max_allocs);
+    }
+
+    /* heatmap (touched pages only) */
+    fprintf(fp, "heap,pa,lines,allocs\n");
+    for (i = 0; i < NVMM_MAXN_HEAP; ++i) {
+        heap = nvmm_heap_table[i];
+        if (isNull(heap) || isNull(heap->wear_lines))
+            continue;
+
+        npage = heap->size / PAGESIZE;
+        for (page = 0; page < npage; ++page) {
+            if (heap->wear_lines[page] == 0 && heap->wear_allocs[page] == 0)
+                continue;
+            fprintf(fp, "%d,0x%lx,%llu,%llu\n", heap->id, heap->pa + page * PAGESIZE,
+                    (unsigned long long) heap->wear_lines[page],
+                    (unsigned long long) heap->wear_allocs[page]);
+        }
+    }
+
+    return;
+}
+
+
+#if defined(NVMM_CRASHSIM)
+/*
+ ********** Crash simulation **********
+ */
+
+/*
+ * Persisted image of NVMM is kept in shadow pages (per heap, allocated at
+ * first write back).  Lines flushed by NVMM_FlushRange reach the shadow at
+ * once.  Lines flushed by NVMM_FlushRangeRelax are pending until NVMM_Fence
+ * of the same thread (or NVMM_FlushRange, which has DSB before).
+ */
+
+/* cache line written back by NVMM_FlushRangeRelax, not fenced yet */
+typedef struct _crash_line {
+    const void *tid;       /* issuing thread */
+    nvmm_heap  *heap;
+    addr_t      off;       /* offset in window */
+    byte data[CACHELINE];  /* content at flush */
+} crash_line;
+
+static crash_line *crash_pending;
+static size_t crash_npending, crash_maxpending;
+
+static long crash_events;               /* number of flush/fence */
+static long crash_point;                /* crash at this event (0: disarmed) */
+static unsigned int crash_seed;
+static int  crash_flags;
+static void (*crash_handler)(void *);
+static void *crash_arg;
+
+/* content of line never written back */
+static const byte crash_zero[CACHELINE];
+
+/* address of this identifies thread */
+static __thread int crash_self;
+
+#if defined(NVMM_MT)
+static pthread_mutex_t crash_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define crash_lock()   pthread_mutex_lock(&crash_mutex)
+#define crash_unlock() pthread_mutex_unlock(&crash_mutex)
+#else
+#define crash_lock()   ((void) 0)
+#define crash_unlock() ((void) 0)
+#endif
+
+
+/**
+ * Allocate table of shadow pages for heap
+ *
+ * @param heap
+ *            target nvmm_heap
+ *
+ * @return none
+ *
+ */
+static void
+alloc_crash(nvmm_heap *heap)
+{
+    heap->crash_shadow = (byte **) calloc(heap->size / PAGESIZE, sizeof(byte *));
+    if (unlikely(isNull(heap->crash_shadow))) {
+        set_msg("alloc_crash::calloc(crash_shadow)");
+        exit_perror(errno);
+    }
+
+    return;
+}
+
+
+/**
+ * Free shadow pages of heap (pending lines of heap are dropped)
+ *
+ * @param heap
+ *            target nvmm_heap
+ *
+ * @return none
+ *
+ */
+static void
+free_crash(nvmm_heap *heap)
+{
+    size_t i, j;
+
+    crash_lock();
+    for (i = 0, j = 0; i < crash_npending; ++i) {
+        if (crash_pending[i].heap != heap)
+            crash_pending[j++] = crash_pending[i];
+    }
+    crash_npending = j;
+    crash_unlock();
+
+    for (i = 0; i < heap->size / PAGESIZE; ++i)
+        free(heap->crash_shadow[i]);
+    free(heap->crash_shadow);
+
+    return;
+}
+
+
+/**
+ * Return shadow of cache line (shadow page is allocated if needed)
+ *
+ * @param heap
+ *            target nvmm_heap
+ * @param off
+ *            offset of cache line in window
+ *
+ * @return shadow of cache line
+ *
+ */
+static inline byte *
+crash_shadow_line(nvmm_heap *heap, addr_t off)
+{
+    byte **page = &heap->crash_shadow[off / PAGESIZE];
+    byte *sp, *expected;
+
+    sp = __atomic_load_n(page, __ATOMIC_ACQUIRE);
+    if (unlikely(isNull(sp))) {
+        /* never written back: NVMM is zero as emulated */
+        sp = (byte *) calloc(1, PAGESIZE);
+        if (unlikely(isNull(sp))) {
+            set_msg("crash_shadow_line::calloc(page)");
+            exit_perror(errno);
+        }
+
+        /* crash_keep may install concurrently */
+        expected = NULL;
+        if (!__atomic_compare_exchange_n(page, &expected, sp, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(sp);
+            sp = expected;
+        }
+    }
+
+    return sp + off % PAGESIZE;
+}
+
+
+/**
+ * Write [va, va + size) to shadow directly
+ * (called with heap locked, so crash_mutex is not taken)
+ *
+ * @param heap
+ *            nvmm_heap which contains va
+ * @param va
+ *            start address
+ * @param size
+ *            bytes to be kept
+ *
+ * @return none
+ *
+ */
+static void
+crash_keep(nvmm_heap *heap, const void *va, size_t size)
+{
+    addr_t off = (const byte *) va - heap->va_base;
+    size_t n;
+
+    for (; size > 0; off += n, size -= n) {
+        n = PAGESIZE - off % PAGESIZE;
+        if (n > size)
+            n = size;
+        memcpy(crash_shadow_line(heap, off), heap->va_base + off, n);
+    }
+
+    return;
+}
+
+
+/* xorshift32 (state must not be 0) */
+static inline unsigned int
+crash_rand(unsigned int *state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+
+/**
+ * Apply pending lines of this thread to shadow (fence)
+ * (crash_mutex must be locked)
+ *
+ * @return none
+ *
+ */
+static void
+crash_apply_own()
+{
+    crash_line *cl;
+    size_t i, j;
+
+    for (i = 0, j = 0; i < crash_npending; ++i) {
+        cl = &crash_pending[i];
+        if (cl->tid == &crash_self)
+            memcpy(crash_shadow_line(cl->heap, cl->off), cl->data, CACHELINE);
+        else
+            crash_pending[j++] = *cl;
+    }
+    crash_npending = j;
+
+    return;
+}
+
+
+/**
+ * Make persisted image into NVMM (simulated power failure)
+ * (crash_mutex must be locked)
+ *
+ * @param seed
+ *            seed of random choices
+ * @param flags
+ *            NVMM_CRASH_REORDER and NVMM_CRASH_EVICT
+ *
+ * @return none
+ *
+ */
+static void
+crash_materialize(unsigned int seed, int flags)
+{
+    nvmm_heap *heap;
+    nvmm_block *nb;
+    crash_line *cl;
+    byte *va, *sp;
+    addr_t off;
+    size_t i, l;
+    int h, b;
+
+    if (seed == 0)
+        seed = 2463534242U;
+
+    /* unfenced lines: none, or any subset in any order */
+    for (i = 0; i < crash_npending; ++i) {
+        cl = &crash_pending[i];
+        if ((flags & NVMM_CRASH_REORDER) && (crash_rand(&seed) & 1))
+            memcpy(crash_shadow_line(cl->heap, cl->off), cl->data, CACHELINE);
+    }
+    crash_npending = 0;
+
+    for (h = 0; h < NVMM_MAXN_HEAP; ++h) {
+        heap = nvmm_heap_table[h];
+        if (isNull(heap))
+            continue;
+
+        heap_lock(heap);
+        for (b = 0; b < heap->num_nb; ++b) {
+            nb = heap->nb_table[b];
+            if (isNull(nb->va))
+                continue;
+
+            for (va = (byte *) nb->va; va < (byte *) nb->va + nb->size; va += PAGESIZE) {
+                off = va - heap->va_base;
+
+                /* dirty lines may be evicted at any time */
+                if (flags & NVMM_CRASH_EVICT) {
+                    for (l = 0; l < PAGESIZE; l += CACHELINE) {
+                        sp = heap->crash_shadow[off / PAGESIZE];
+                        if (memcmp(va + l, isNull(sp) ? crash_zero : sp + l, CACHELINE) != 0 &&
+                            (crash_rand(&seed) & 1))
+                            memcpy(crash_shadow_line(heap, off + l), va + l, CACHELINE);
+                    }
+                }
+
+                sp = heap->crash_shadow[off / PAGESIZE];
+                if (isNull(sp))
+                    memset(va, 0, PAGESIZE);
+                else
+                    memcpy(va, sp, PAGESIZE);
+            }
+        }
+
+        /* free pages may have been restored to old contents */
+        mark_zero(heap, 0, heap->size / PAGESIZE, 0);
+        heap_unlock(heap);
+    }
+
+    return;
+}
+
+
+/**
+ * Count flush/fence and crash if armed point is reached
+ * (crash_mutex must be locked, and is unlocked while handler runs)
+ *
+ * @return none
+ *
+ */
+static void
+crash_event()
+{
+    void (*handler)(void *);
+
+    crash_events++;
+    if (likely(crash_point == 0 || crash_events < crash_point))
+        return;
+
+    crash_point = 0;
+    crash_materialize(crash_seed, crash_flags);
+    handler = crash_handler;
+
+    if (nonNull(handler)) {
+        crash_unlock();
+        handler(crash_arg);
+        crash_lock();
+    }
+
+    return;
+}
+
+
+/**
+ * Record write back of [va, va + size)
+ *
+ * @param va
+ *            start address
+ * @param size
+ *            bytes to be written back
+ * @param fenced
+ *            1 for NVMM_FlushRange (DSB before/after), 0 for NVMM_FlushRangeRelax
+ *
+ * @return none
+ *
+ */
+static void
+crash_flush(const void *va, size_t size, int fenced)
+{
+    nvmm_heap *heap;
+    crash_line *cl;
+    addr_t off, end;
+
+    crash_lock();
+    crash_event();
+    if (fenced)
+        crash_apply_own();
+
+    heap = va_to_heap((const byte *) va);
+    if (isNull(heap) || size == 0) {
+        crash_unlock();
+        return;
+    }
+
+    off = ((const byte *) va - heap->va_base) & ~((addr_t) CACHELINE - 1);
+    end = (const byte *) va - heap->va_base + size;
+    if (end > heap->size)
+        end = heap->size;
+
+    for (; off < end; off += CACHELINE) {
+        if (fenced) {
+            memcpy(crash_shadow_line(heap, off), heap->va_base + off, CACHELINE);
+            continue;
+        }
+
+        if (crash_npending == crash_maxpending) {
+            crash_maxpending = (crash_maxpending == 0) ? 1024 : crash_maxpending * 2;
+            crash_pending = (crash_line *) realloc(crash_pending,
+                                                   sizeof(crash_line) * crash_maxpending);
+            if (unlikely(isNull(crash_pending))) {
+                set_msg("crash_flush::realloc(crash_pending)");
+                exit_perror(errno);
+            }
+        }
+
+        cl = &crash_pending[crash_npending++];
+        cl->tid  = &crash_self;
+        cl->heap = heap;
+        cl->off  = off;
+        memcpy(cl->data, heap->va_base + off, CACHELINE);
+    }
+
+    crash_unlock();
+    return;
+}
+
+
+/**
+ * Record fence (pending lines of this thread are persisted)
+ *
+ * @return none
+ *
+ */
+static void
+crash_fence()
+{
+    crash_lock();
+    crash_event();
+    crash_apply_own();
+    crash_unlock();
+    return;
+}
+#endif /* NVMM_CRASHSIM */
+
+/*
+ ********** Persistence check **********
+ */
+
+/*
+ * If NVMM_PMCHECK is set, mapped NVMM is read-only until a store faults.
+ * The page is then copied (snapshot of persisted content) and made writable.
+ * Lines which differ from snapshot are dirty.  Flush copies lines to snapshot,
+ * and fence makes pages without dirty line read-only again.
+ *
+ *   redundant          : flushed line is clean (flush site)
+ *   unfenced           : NVMM_FlushRangeRelax without following NVMM_Fence (flush site)
+ *   unflushed_at_fence : dirty line at NVMM_Fence (first store to page)
+ *   unflushed          : dirty line at dump or exit (first store to page)
+ */
+#define PM_REDUNDANT       (0)
+#define PM_UNFENCED        (1)
+#define PM_UNFLUSHED_FENCE (2)
+#define PM_UNFLUSHED       (3)
+#define PM_NKIND           (4)
+
+static const char *pm_kind_name[PM_NKIND] = {
+    "redundant", "unfenced", "unflushed_at_fence", "unflushed"
+};
+
+/* count of reports per (kind, site) */
+typedef struct _pm_site {
+    const void *pc;  /* flush site or first store to page (NULL is empty) */
+    const void *va;  /* example of line */
+    uint64_t count;
+    int kind;
+} pm_site;
+#define PM_NSITE (1024)
+
+/* NVMM_FlushRangeRelax not fenced yet */
+typedef struct _pm_pending_flush {
+    const void *tid; /* issuing thread */
+    const void *pc;  /* flush site */
+    const void *va;
+} pm_pending_flush;
+
+static pm_site pm_sites[PM_NSITE];
+static uint64_t pm_total[PM_NKIND];
+
+static pm_pending_flush *pm_pending;
+static size_t pm_npending, pm_maxpending;
+
+/* pages which have snapshot (writable) */
+/* capacity is kept over tracked pages, so SIGSEGV handler never grows it */
+static byte **pm_list;
+static size_t pm_nlist, pm_maxlist;
+static size_t pm_ntracked;
+
+static struct sigaction pm_oldact;
+
+/* address of this identifies thread */
+static __thread int pm_self;
+
+/* spin lock (also taken in SIGSEGV handler, where pthread_mutex is not allowed) */
+#if defined(NVMM_MT)
+static byte pm_spin;
+#define pm_lock()   do { } while (__atomic_test_and_set(&pm_spin, __ATOMIC_ACQUIRE))
+#define pm_unlock() __atomic_clear(&pm_spin, __ATOMIC_RELEASE)
+#else
+#define pm_lock()   ((void) 0)
+#define pm_unlock() ((void) 0)
+#endif
+
+
+/**
+ * Grow array by doubling if full
+ *
+ * @param array
+ *            pointer to array
+ * @param num
+ *            number of elements
+ * @param maxn
+ *            capacity (updated)
+ * @param elem
+ *            bytes of element
+ *
+ * @return none
+ *
+ */
+static void
+pm_reserve(void *array, size_t num, size_t *maxn, size_t elem)
+{
+    void **a = (void **) array;
+
+    if (likely(num < *maxn))
+        return;
+
+    while (*maxn <= num)
+        *maxn = (*maxn == 0) ? 256 : *maxn * 2;
+    *a = realloc(*a, *maxn * elem);
+    if (unlikely(isNull(*a))) {
+        set_msg("pm_reserve::realloc");
+        exit_perror(errno);
+    }
+
+    return;
+}
+
+
+/**
+ * Count report at site
+ * (pm_mutex must be locked)
+ *
+ * @param table
+ *            site table (PM_NSITE entries)
+ * @param kind
+ *            PM_*
+ * @param pc
+ *            site
+ * @param va
+ *            reported line
+ * @param n
+ *            count
+ *
+ * @return none
+ *
+ */
+static void
+pm_report(pm_site *table, int kind, const void *pc, const void *va, uint64_t n)
+{
+    size_t h, i;
+
+    h = (((uintptr_t) pc >> 2) * 0x9E3779B1U + kind) % PM_NSITE;
+    for (i = 0; i < PM_NSITE; ++i, h = (h + 1) % PM_NSITE) {
+        if (isNull((void *) table[h].pc)) {
+            table[h].pc   = pc;
+            table[h].va   = va;
+            table[h].kind = kind;
+        }
+        if (table[h].pc == pc && table[h].kind == kind) {
+            table[h].count += n;
+            return;
+        }
+    }
+
+    /* table is full (only total is counted) */
+    return;
+}
+
+
+/**
+ * Allocate page states of heap
+ *
+ * @param heap
+ *            target nvmm_heap
+ *
+ * @return none
+ *
+ */
+static void
+alloc_pmcheck(nvmm_heap *heap)
+{
+    heap->pm_pages = NULL;
+    if (likely(isNull((void *) opt_pmcheck)))
+        return;
+
+    heap->pm_pages = (pm_page *) calloc(heap->size / PAGESIZE, sizeof(pm_page));
+    if (unlikely(isNull(heap->pm_pages))) {
+        set_msg("alloc_pmcheck::calloc(pm_pages)");
+        exit_perror(errno);
+    }
+
+    /* SIGSEGV handler copies page to its slot (no malloc in handler) */
+    heap->pm_snap = (byte *) mmap(NULL, heap->size, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (unlikely(heap->pm_snap == MAP_FAILED)) {
+        set_msg("alloc_pmcheck::mmap(pm_snap)");
+        exit_perror(errno);
+    }
+
+    return;
+}
+
+
+/**
+ * Free page states of heap
+ *
+ * @param heap
+ *            target nvmm_heap
+ *
+ * @return none
+ *
+ */
+static void
+free_pmcheck(nvmm_heap *heap)
+{
+    byte *va;
+    size_t i, j;
+
+    pm_lock();
+    for (i = 0, j = 0; i < pm_nlist; ++i) {
+        va = pm_list[i];
+        if (va < heap->va_base || heap->va_base + heap->size <= va)
+            pm_list[j++] = va;
+    }
+    pm_nlist = j;
+
+    for (i = 0, j = 0; i < pm_npending; ++i) {
+        va = (byte *) pm_pending[i].va;
+        if (va < heap->va_base || heap->va_base + heap->size <= va)
+            pm_pending[j++] = pm_pending[i];
+    }
+    pm_npending = j;
+
+    for (i = 0; i < heap->size / PAGESIZE; ++i)
+        pm_ntracked -= heap->pm_pages[i].tracked;
+    pm_unlock();
+
+    munmap(heap->pm_snap, heap->size);
+    free(heap->pm_pages);
+    heap->pm_pages = NULL;
+    heap->pm_snap  = NULL;
+
+    return;
+}
+
+
+/**
+ * Release snapshot of page and make it read-only
+ * (pm_mutex must be locked, page is not removed from pm_list)
+ *
+ * @param pg
+ *            state of page
+ * @param va
+ *            page
+ *
+ * @return none
+ *
+ */
+static void
+pm_release(pm_page *pg, byte *va)
+{
+    /* give back memory of slot */
+    madvise(pg->snap, PAGESIZE, MADV_DONTNEED);
+    pg->snap = NULL;
+    memset(pg->reported, 0, sizeof(pg->reported));
+
+    if (pg->tracked)
+        mprotect(va, PAGESIZE, PROT_READ);
+
+    return;
+}
+
+
+/**
+ * Start tracking of mapped nvmm_block (all pages become read-only)
+ *
+ * @param nb
+ *            mapped nvmm_block
+ *
+ * @return none
+ *
+ */
+static void
+pm_map(nvmm_block *nb)
+{
+    nvmm_heap *heap = nb->heap;
+    size_t page, end;
+
+    pm_lock();
+    page = ((byte *) nb->va - heap->va_base) / PAGESIZE;
+    end  = page + nb->size / PAGESIZE;
+    for (; page < end; ++page)
+        heap->pm_pages[page].tracked = 1;
+
+    /* every tracked page can be listed by SIGSEGV handler */
+    pm_ntracked += nb->size / PAGESIZE;
+    pm_reserve(&pm_list, pm_ntracked, &pm_maxlist, sizeof(byte *));
+
+    if (unlikely(mprotect(nb->va, nb->size, PROT_READ) != 0)) {
+        set_msg("pm_map::mprotect");
+        exit_perror(errno);
+    }
+    pm_unlock();
+
+    return;
+}
+
+
+/**
+ * Stop tracking of nvmm_block to be unmapped
+ *
+ * @param nb
+ *            mapped nvmm_block
+ *
+ * @return none
+ *
+ */
+static void
+pm_unmap(nvmm_block *nb)
+{
+    nvmm_heap *heap = nb->heap;
+    pm_page *pg;
+    byte *va;
+    size_t i, j;
+
+    pm_lock();
+    for (i = 0, j = 0; i < pm_nlist; ++i) {
+        va = pm_list[i];
+        if (va < (byte *) nb->va || (byte *) nb->va + nb->size <= va) {
+            pm_list[j++] = va;
+            continue;
+        }
+        pg = &heap->pm_pages[(va - heap->va_base) / PAGESIZE];
+        pg->tracked = 0;
+        pg->listed  = 0;
+        if (nonNull(pg->snap))
+            pm_release(pg, va);
+    }
+    pm_nlist = j;
+
+    for (i = 0; i < nb->size / PAGESIZE; ++i)
+        heap->pm_pages[((byte *) nb->va - heap->va_base) / PAGESIZE + i].tracked = 0;
+    pm_ntracked -= nb->size / PAGESIZE;
+    pm_unlock();
+
+    return;
+}
+
+
+/**
+ * Pass SIGSEGV which is not ours to previous handler
+ * (default action is taken by faulting again)
+ *
+ * @return none
+ *
+ */
+static void
+pm_chain(int sig, siginfo_t *si, void *uc)
+{
+    struct sigaction dfl;
+
+    if (pm_oldact.sa_flags & SA_SIGINFO) {
+        pm_oldact.sa_sigaction(sig, si, uc);
+    } else if (pm_oldact.sa_handler != SIG_DFL && pm_oldact.sa_handler != SIG_IGN) {
+        pm_oldact.sa_handler(sig);
+    } else {
+        memset(&dfl, 0, sizeof(dfl));
+        dfl.sa_handler = SIG_DFL;
+        sigemptyset(&dfl.sa_mask);
+        sigaction(SIGSEGV, &dfl, NULL);
+    }
+
+    return;
+}
+
+
+/**
+ * Signal handler of SIGSEGV: first store to read-only page of NVMM
+ * (other faults are passed to previous handler)
+ * only async-signal-safe calls: snapshot slot and pm_list are prepared
+ * in advance, and pm_lock is spin lock
+ *
+ * @return none
+ *
+ */
+static void
+pm_fault(int sig, siginfo_t *si, void *uc)
+{
+    static const char msg[] = "pm_fault::mprotect failed (vm.max_map_count?)\n";
+    nvmm_heap *heap;
+    pm_page *pg;
+    byte *va;
+    const void *pc;
+
+    va = (byte *) si->si_addr;
+    heap = va_to_heap(va);
+    if (isNull(heap) || isNull(heap->pm_pages) ||
+        !heap->pm_pages[(va - heap->va_base) / PAGESIZE].tracked) {
+        pm_chain(sig, si, uc);
+        return;
+    }
+
+#if defined(__x86_64__)
+    pc = (const void *) ((ucontext_t *) uc)->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    pc = (const void *) ((ucontext_t *) uc)->uc_mcontext.pc;
+#elif defined(__arm__)
+    pc = (const void *) ((ucontext_t *) uc)->uc_mcontext.arm_pc;
+#else
+    pc = NULL;
+#endif
+
+    va = (byte *) ((addr_t) va & ~((addr_t) PAGESIZE - 1));
+    pg = &heap->pm_pages[(va - heap->va_base) / PAGESIZE];
+
+    pm_lock();
+    if (nonNull(pg->snap)) {
+        /* made writable by other thread */
+        pm_unlock();
+        return;
+    }
+
+    pg->snap = heap->pm_snap + (va - heap->va_base);
+    memcpy(pg->snap, va, PAGESIZE);
+    pg->pc = isNull((void *) pc) ? (const void *) va : pc;
+
+    if (!pg->listed) {
+        pm_list[pm_nlist++] = va;
+        pg->listed = 1;
+    }
+
+    if (unlikely(mprotect(va, PAGESIZE, PROT_READ | PROT_WRITE) != 0)) {
+        /* store faults again with default action */
+        (void) write(STDERR_FILENO, msg, sizeof(msg) - 1);
+        pm_oldact.sa_flags   = 0;
+        pm_oldact.sa_handler = SIG_DFL;
+        pm_chain(sig, si, uc);
+    }
+    pm_unlock();
+
+    return;
+}
+
+
+/**
+ * Enable persistence check (SIGSEGV handler is installed)
+ *
+ * @param none
+ *
+ * @return none
+ *
+ */
+static void
+init_pmcheck()
+{
+    struct sigaction act;
+
+    memset(&act, 0, sizeof(act));
+    act.sa_sigaction = pm_fault;
+    act.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&act.sa_mask);
+    if (unlikely(sigaction(SIGSEGV, &act, &pm_oldact) != 0)) {
+        set_msg("init_pmcheck::sigaction");
+        exit_perror(errno);
+    }
+
+    return;
+}
+
+
+/**
+ * Remove pending NVMM_FlushRangeRelax of this thread
+ * (pm_mutex must be locked)
+ *
+ * @return none
+ *
+ */
+static void
+pm_fence_own()
+{
+    size_t i, j;
+
+    for (i = 0, j = 0; i < pm_npending; ++i) {
+        if (pm_pending[i].tid != &pm_self)
+            pm_pending[j++] = pm_pending[i];
+    }
+    pm_npending = j;
+
+    return;
+}
+
+
+/**
+ * Check flush of [va, va + size)
+ *
+ * @param va
+ *            start address
+ * @param size
+ *            bytes to be written back
+ * @param fenced
+ *            1 for NVMM_FlushRange (DSB before/after), 0 for NVMM_FlushRangeRelax
+ * @param pc
+ *            flush site
+ *
+ * @return none
+ *
+ */
+static void
+pm_flush(const void *va, size_t size, int fenced, const void *pc)
+{
+    nvmm_heap *heap;
+    pm_page *pg;
+    const byte *line;
+    addr_t off, end;
+    size_t l;
+    uint64_t redundant;
+
+    heap = va_to_heap((const byte *) va);
+    if (isNull(heap) || isNull(heap->pm_pages) || size == 0)
+        return;
+
+    off = ((const byte *) va - heap->va_base) & ~((addr_t) CACHELINE - 1);
+    end = (const byte *) va - heap->va_base + size;
+    if (end > heap->size)
+        end = heap->size;
+
+    pm_lock();
+    if (fenced)
+        pm_fence_own();
+
+    redundant = 0;
+    for (; off < end; off += CACHELINE) {
+        pg = &heap->pm_pages[off / PAGESIZE];
+        if (!pg->tracked)
+            continue;
+
+        line = heap->va_base + off;
+        l = off % PAGESIZE;
+        if (isNull(pg->snap) || memcmp(pg->snap + l, line, CACHELINE) == 0) {
+            redundant++;
+            continue;
+        }
+
+        /* now persisted */
+        memcpy(pg->snap + l, line, CACHELINE);
+        pg->reported[l / CACHELINE / 32] &= ~(1U << (l / CACHELINE % 32));
+    }
+
+    if (redundant > 0) {
+        pm_total[PM_REDUNDANT] += redundant;
+        pm_report(pm_sites, PM_REDUNDANT, pc, va, redundant);
+    }
+
+    if (!fenced) {
+        pm_reserve(&pm_pending, pm_npending, &pm_maxpending, sizeof(pm_pending_flush));
+        pm_pending[pm_npending].tid = &pm_self;
+        pm_pending[pm_npending].pc  = pc;
+        pm_pending[pm_npending].va  = va;
+        pm_npending++;
+    }
+    pm_unlock();
+
+    return;
+}
+
+
+/**
+ * Check dirty lines at NVMM_Fence (and make clean pages read-only)
+ *
+ * @param none
+ *
+ * @return none
+ *
+ */
+static void
+pm_fence()
+{
+    nvmm_heap *heap;
+    pm_page *pg;
+    byte *va;
+    size_t i, j, l;
+    uint32_t bit;
+    int dirty;
+
+    pm_lock();
+    pm_fence_own();
+
+    for (i = 0, j = 0; i < pm_nlist; ++i) {
+        va = pm_list[i];
+        heap = va_to_heap(va);
+        pg = &heap->pm_pages[(va - heap->va_base) / PAGESIZE];
+        if (isNull(pg->snap)) {
+            /* released by pm_keep */
+            pg->listed = 0;
+            continue;
+        }
+
+        /* stores after this fault and wait for pm_mutex */
+        mprotect(va, PAGESIZE, PROT_READ);
+
+        dirty = 0;
+        for (l = 0; l < PAGESIZE; l += CACHELINE) {
+            if (memcmp(pg->snap + l, va + l, CACHELINE) == 0)
+                continue;
+            dirty = 1;
+
+            bit = 1U << (l / CACHELINE % 32);
+            if (pg->reported[l / CACHELINE / 32] & bit)
+                continue;
+            pg->reported[l / CACHELINE / 32] |= bit;
+            pm_total[PM_UNFLUSHED_FENCE]++;
+            pm_report(pm_sites, PM_UNFLUSHED_FENCE, pg->pc, va + l, 1);
+        }
+
+        if (dirty) {
+            mprotect(va, PAGESIZE, PROT_READ | PROT_WRITE);
+            pm_list[j++] = va;
+        } else {
+            pm_release(pg, va);
+            pg->listed = 0;
+        }
+    }
+    pm_nlist = j;
+    pm_unlock();
+
+    return;
+}
+
+
+/**
+ * Regard [ptr, ptr + size) as persisted (allocator state, freed region)
+ *
+ * @param heap
+ *            nvmm_heap which contains ptr
+ * @param ptr
+ *            start address
+ * @param size
+ *            bytes
+ *
+ * @return none
+ *
+ */
+static void
+pm_keep(nvmm_heap *heap, const void *ptr, size_t size)
+{
+    pm_page *pg;
+    byte *va;
+    addr_t off;
+    size_t n;
+
+    pm_lock();
+    off = (const byte *) ptr - heap->va_base;
+    for (; size > 0; off += n, size -= n) {
+        n = PAGESIZE - off % PAGESIZE;
+        if (n > size)
+            n = size;
+        pg = &heap->pm_pages[off / PAGESIZE];
+        if (isNull(pg->snap))
+            continue;
+        memcpy(pg->snap + off % PAGESIZE, heap->va_base + off, n);
+
+        /* read-only again, so that next store records its own site */
+        va = heap->va_base + off / PAGESIZE * PAGESIZE;
+        if (memcmp(pg->snap, va, PAGESIZE) == 0)
+            pm_release(pg, va);
+    }
+    pm_unlock();
+
+    return;
+}
+
+
+/**
+ * Write site as object+offset (for addr2line)
+ *
+ * @param fp
+ *            output
+ * @param pc
+ *            site
+ *
+ * @return none
+ *
+ */
+static void
+print_site(FILE *fp, const void *pc)
+{
+    FILE *maps;
+    char line[512], path[400];
+    unsigned long lo, hi, off;
+
+    maps = fopen("/proc/self/maps", "r");
+    if (nonNull(maps)) {
+        while (fgets(line, sizeof(line), maps) != NULL) {
+            path[0] = '\0';
+            if (sscanf(line, "%lx-%lx %*s %lx %*s %*s %399s", &lo, &hi, &off, path) < 3)
+                continue;
+            if ((unsigned long) pc < lo || hi <= (unsigned long) pc || path[0] != '/')
+                continue;
+            fprintf(fp, "%s+0x%lx", path, (unsigned long) pc - lo + off);
+            fclose(maps);
+            return;
+        }
+        fclose(maps);
+    }
+
+    fprintf(fp, "%p", pc);
+    return;
+}
+
+
+/**
+ * Write sites of kind in table
+ *
+ * @param fp
+ *            output
+ * @param table
+ *            site table (PM_NSITE entries)
+ * @param kind
+ *            PM_*
+ *
+ * @return none
+ *
+ */
+static void
+print_sites(FILE *fp, const pm_site *table, int kind)
+{
+    size_t i;
+
+    for (i = 0; i < PM_NSITE; ++i) {
+        if (isNull((void *) table[i].pc) || table[i].kind != kind)
+            continue;
+        fprintf(fp, "%s,", pm_kind_name[kind]);
+        print_site(fp, table[i].pc);
+        fprintf(fp, ",%llu,%p\n", (unsigned long long) table[i].count, table[i].va);
+    }
+
+    return;
+}
+
+
+/**
+ * Write report of persistence check
+ * (pm_mutex must be locked)
+ *
+ * @param fp
+ *            output
+ *
+ * @return none
+ *
+ */
+static void
+dump_pmcheck(FILE *fp)
+{
+    nvmm_heap *heap;
+    pm_site *now;
+    pm_page *pg;
+    byte *va;
+    uint64_t total[PM_NKIND];
+    size_t i, l;
+    int k;
+
+    /* unfenced and unflushed are state at this time */
+    now = (pm_site *) calloc(PM_NSITE, sizeof(pm_site));
+    if (unlikely(isNull(now))) {
+        set_msg("dump_pmcheck::calloc(now)");
+        exit_perror(errno);
+    }
+    memcpy(total, pm_total, sizeof(total));
+
+    for (i = 0; i < pm_npending; ++i) {
+        total[PM_UNFENCED]++;
+        pm_report(now, PM_UNFENCED, pm_pending[i].pc, pm_pending[i].va, 1);
+    }
+
+    for (i = 0; i < pm_nlist; ++i) {
+        va = pm_list[i];
+        heap = va_to_heap(va);
+        pg = &heap->pm_pages[(va - heap->va_base) / PAGESIZE];
+        for (l = 0; nonNull(pg->snap) && l < PAGESIZE; l += CACHELINE) {
+            if (memcmp(pg->snap + l, va + l, CACHELINE) == 0)
+                continue;
+            total[PM_UNFLUSHED]++;
+            pm_report(now, PM_UNFLUSHED, pg->pc, va + l, 1);
+        }
+    }
+
+    /* summary */
+    fprintf(fp, "# kind,count\n");
+    for (k = 0; k < PM_NKIND; ++k)
+        fprintf(fp, "# %s,%llu\n", pm_kind_name[k], (unsigned long long) total[k]);
+
+    /* per site */
+    fprintf(fp, "kind,site,count,va\n");
+    for (k = 0; k < PM_NKIND; ++k) {
+        print_sites(fp, pm_sites, k);
+        print_sites(fp, now, k);
+    }
+
+    free(now);
+    return;
+}
+
+
+/*
+ ********** Pre-zeroing **********
+ */
+
+/* bytes zeroed at once (heap is unlocked while zeroing) */
+#define PREZERO_CHUNK (1*MiB)
+
+#if defined(NVMM_MT)
+static pthread_t prezero_thread;
+static int prezero_stop; /* set at finalize */
+
+/* held while prezero thread zeroes heap (pins heap against NVMM_HeapDestroy) */
+static pthread_mutex_t prezero_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define prezero_lock()   pthread_mutex_lock(&prezero_mutex)
+#define prezero_unlock() pthread_mutex_unlock(&prezero_mutex)
+#else
+#define prezero_lock()   ((void) 0)
+#define prezero_unlock() ((void) 0)
+#endif
+
+
+/**
+ * Look for run of free pages which are not known-zero in mapped nvmm_block
+ * (heap must be locked)
+ *
+ * @param heap
+ *            target nvmm_heap
+ * @param max
+ *            maximum bytes of run
+ * @param run
+ *            head of run (output)
+ * @param len
+ *            bytes of run (output)
+ *
+ * @return idle nvmm_region which contains run (NULL if not found)
+ *
+ */
+static nvmm_region *
+find_dirty_run(nvmm_heap *heap, size_t max, byte **run, size_t *len)
+{
+    nvmm_block *nb;
+    nvmm_region *nr;
+    addr_t p0, p1, page, end;
+    int i;
+
+    for (i = 0; i < heap->num_nb; ++i) {
+        nb = heap->nb_table[i];
+        if (isNull(nb->va))
+            continue;
+
+        for (nr = nb->nr; nr != NULL; nr = nr->next) {
+            /* whole pages after region_info of new region */
+            p0 = (nr->ptr + sizeof(region_info) - heap->va_base + PAGESIZE - 1) / PAGESIZE;
+            p1 = (nr->ptr + nr->size - heap->va_base) / PAGESIZE;
+
+            for (page = p0; page < p1; ++page) {
+                if (zero_page(heap, page))
+                    continue;
+
+                for (end = page + 1; end < p1 && !zero_page(heap, end) &&
+                         (end - page) * PAGESIZE < max; ++end)
+                    ;
+                *run = heap->va_base + page * PAGESIZE;
+                *len = (end - page) * PAGESIZE;
+                return nr;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Zero free pages of heap which are not known-zero
+ * each run is allocated while zeroing, so heap is not locked during memset
+ *
+ * @param heap
+ *            target nvmm_heap
+ * @param bytes
+ *            bytes to zero at most
+ *
+ * @return bytes zeroed
+ *
+ */
+static size_t
+prezero_nvmm_heap(nvmm_heap *heap, size_t bytes)
+{
+    nvmm_region *nr;
+    size_t done, len;
+    byte *run;
+    void *ptr;
+
+    for (done = 0; done < bytes; done += len) {
+        heap_lock(heap);
+        nr = find_dirty_run(heap, (bytes - done < PREZERO_CHUNK) ? bytes - done : PREZERO_CHUNK,
+                            &run, &len);
+        if (isNull(nr)) {
+            heap_unlock(heap);
+            break;
+        }
+        /* region_info is put inside run (page before run is left known-zero) */
+        ptr = cut_nvmm_region(nr, run, len);
+        nr  = get_nvmm_region(ptr);
+        heap_unlock(heap);
+
+        /* region_info is zeroed too, so nr is released without it */
+        NVMM_Memset(run, 0, len);
+        NVMM_Fence();
+
+        heap_lock(heap);
+        mark_zero(heap, (run - heap->va_base) / PAGESIZE,
+                  (run - heap->va_base + len) / PAGESIZE, 1);
+        release_nvmm_region(nr);
+        heap_unlock(heap);
+    }
+
+    return done;
+}
+
+
+#if defined(NVMM_MT)
+/**
+ * Keep NVMM_PREZERO bytes of known-zero pages in each heap (thread)
+ *
+ * @param arg
+ *            unused
+ *
+ * @return NULL
+ *
+ */
+static void *
+prezero_main(void *arg)
+{
+    struct timespec ts;
+    nvmm_heap *heap;
+    size_t want;
+    int i;
+
+    ts.tv_sec  = opt_prezero_ms / 1000;
+    ts.tv_nsec = (opt_prezero_ms % 1000) * 1000000;
+
+    while (__atomic_load_n(&prezero_stop, __ATOMIC_RELAXED) == 0) {
+        nanosleep(&ts, NULL);
+
+        for (i = 0; i < NVMM_MAXN_HEAP; ++i) {
+            /* table is locked only to look up heap, which is pinned while zeroed */
+            prezero_lock();
+            table_lock();
+            heap = nvmm_heap_table[i];
+            table_unlock();
+
+            if (nonNull(heap)) {
+                heap_lock(heap);
+                want = (heap->zero_bytes < opt_prezero) ? opt_prezero - heap->zero_bytes : 0;
+                heap_unlock(heap);
+                if (want > 0)
+                    prezero_nvmm_heap(heap, want);
+            }
+            prezero_unlock();
+        }
+    }
+
+    (void) arg;
+    return NULL;
+}
+#endif
+
+
+/*
+ ********** Heap profile **********
+ */
+
+/* frames per backtrace */
+#define PROF_DEPTH (32)
+
+/* size of site table (open addressing) and buckets of sampled allocations */
+#define PROF_NSITE (4096)
+#define PROF_NHASH (1024)
+
+/* allocation site (backtrace) */
+typedef struct {
+    void    *pc[PROF_DEPTH];
+    int      depth;
+    uint64_t alloc_objs;  /* estimated number of allocations */
+    uint64_t alloc_bytes; /* estimated bytes of allocations */
+    uint64_t live_objs;   /* estimated number of live allocations */
+    uint64_t live_bytes;  /* estimated bytes of live allocations */
+} prof_site;
+
+/* sampled allocation (live) */
+typedef struct _prof_sample {
+    const void *ptr;
+    prof_site  *site;
+    uint64_t    objs;  /* weight of sample */
+    uint64_t    bytes;
+    struct _prof_sample *next;
+} prof_sample;
+
+static prof_site   *prof_sites;  /* PROF_NSITE entries */
+static size_t       prof_nsite;
+static prof_sample *prof_hash[PROF_NHASH];
+
+/* bytes until next sample (per thread) */
+static __thread int64_t  prof_left;
+static __thread unsigned prof_seed;
+
+/* profile is dumped at next allocation after SIGUSR2 */
+static volatile sig_atomic_t prof_signaled;
+static int prof_ndump;
+
+#if defined(NVMM_MT)
+static pthread_mutex_t prof_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define prof_lock()   pthread_mutex_lock(&prof_mutex)
+#define prof_unlock() pthread_mutex_unlock(&prof_mutex)
+#else
+#define prof_lock()   ((void) 0)
+#define prof_unlock() ((void) 0)
+#endif
+
+
+/**
+ * Request dump of heap profile (SIGUSR2)
+ *
+ * @param sig
+ *            signal number
+ *
+ * @return none
+ *
+ */
+static void
+prof_signal(int sig)
+{
+    prof_signaled = 1;
+    (void) sig;
+}
+
+
+/**
+ * Initialize heap profile
+ *
+ * @return none
+ *
+ */
+static void
+init_heapprof()
+{
+    struct sigaction act;
+    void *pc[1];
+
+    prof_sites = (prof_site *) calloc(PROF_NSITE, sizeof(prof_site));
+    if (unlikely(isNull(prof_sites))) {
+        set_msg("init_heapprof::calloc(prof_sites)");
+        exit_perror(errno);
+    }
+
+    /* first backtrace loads unwinder (not to do it in allocation) */
+    backtrace(pc, 1);
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = prof_signal;
+    act.sa_flags = SA_RESTART;
+    sigemptyset(&act.sa_mask);
+    if (unlikely(sigaction(SIGUSR2, &act, NULL) != 0)) {
+        set_msg("init_heapprof::sigaction");
+        exit_perror(errno);
+    }
+
+    return;
+}
+
+
+/**
+ * Return site of backtrace (NULL if table is full)
+ * (prof_mutex must be locked)
+ *
+ * @param pc
+ *            backtrace
+ * @param depth
+ *            number of frames
+ *
+ * @return prof_site
+ *
+ */
+static prof_site *
+prof_get_site(void **pc, int depth)
+{
+    uint64_t h;
+    size_t i;
+    int d;
+
+    h = 14695981039346656037ULL;
+    for (d = 0; d < depth; ++d)
+        h = (h ^ (uintptr_t) pc[d]) * 1099511628211ULL;
+
+    for (i = 0, h %= PROF_NSITE; i < PROF_NSITE; ++i, h = (h + 1) % PROF_NSITE) {
+        if (prof_sites[h].depth == 0) {
+            if (prof_nsite == PROF_NSITE - 1)
+                return NULL;
+            memcpy(prof_sites[h].pc, pc, sizeof(void *) * depth);
+            prof_sites[h].depth = depth;
+            ++prof_nsite;
+        }
+        if (prof_sites[h].depth == depth &&
+            memcmp(prof_sites[h].pc, pc, sizeof(void *) * depth) == 0)
+            return &prof_sites[h];
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Record sampled allocation with backtrace
+ * each sample point (every 1 / rate bytes on average) in allocation weighs rate
+ * bytes, so sum of weights estimates all allocations
+ *
+ * @param ptr
+ *            allocated region
+ * @param size
+ *            size of region
+ * @param region
+ *            1 if ptr is nvmm_region, 0 if arena block
+ *
+ * @return none
+ *
+ */
+static __attribute__((noinline)) void
+prof_record(void *ptr, size_t size, int region)
+{
+    void *pc[PROF_DEPTH + 1];
+    prof_sample *ps;
+    prof_site *site;
+    uint64_t points;
+    size_t h;
+    int depth;
+
+    if (unlikely(prof_seed == 0)) {
+        /* first allocation of thread only starts countdown */
+        prof_seed = (unsigned) (uintptr_t) &prof_seed ^ (unsigned) now_ms();
+        prof_left = (int64_t) (rand_r(&prof_seed) % (2 * opt_heapprof_rate)) + 1;
+        return;
+    }
+
+    /* next sample point after uniform [1, 2 * rate] bytes (mean is rate) */
+    for (points = 0; prof_left <= 0; ++points)
+        prof_left += (int64_t) (rand_r(&prof_seed) % (2 * opt_heapprof_rate)) + 1;
+
+    /* skip prof_record */
+    depth = backtrace(pc, PROF_DEPTH + 1) - 1;
+    if (unlikely(depth <= 0))
+        return;
+
+    ps = (prof_sample *) malloc(sizeof(prof_sample));
+    if (unlikely(isNull(ps)))
+        return;
+    ps->ptr = ptr;
+    if (size >= 2 * opt_heapprof_rate) {
+        /* always sampled */
+        ps->objs  = 1;
+        ps->bytes = size;
+    } else {
+        ps->bytes = points * opt_heapprof_rate;
+        ps->objs  = (size > 0 && ps->bytes > size) ? (ps->bytes + size / 2) / size : 1;
+    }
+
+    prof_lock();
+    site = prof_get_site(pc + 1, depth);
+    if (unlikely(isNull(site))) {
+        prof_unlock();
+        free(ps);
+        return;
+    }
+    site->alloc_objs  += ps->objs;
+    site->alloc_bytes += ps->bytes;
+    site->live_objs   += ps->objs;
+    site->live_bytes  += ps->bytes;
+
+    ps->site = site;
+    h = ((uintptr_t) ptr >> 4) % PROF_NHASH;
+    ps->next = prof_hash[h];
+    prof_hash[h] = ps;
+    prof_unlock();
+
+    /* NVMM_Free looks up only sampled regions */
+    if (region)
+        get_nvmm_region(ptr)->sampled = 1;
+
+    return;
+}
+
+
+/**
+ * Count allocation for heap profile (sampled every NVMM_HEAPPROF_RATE bytes)
+ *
+ * @param ptr
+ *            allocated region (NULL if allocation is failed)
+ * @param size
+ *            size of region
+ * @param region
+ *            1 if ptr is nvmm_region, 0 if arena block
+ *
+ * @return none
+ *
+ */
+static inline void
+prof_alloc(void *ptr, size_t size, int region)
+{
+    if (unlikely(prof_signaled)) {
+        prof_signaled = 0;
+        NVMM_HeapProfDump(NULL);
+    }
+
+    prof_left -= (int64_t) size;
+    if (likely(prof_left > 0) || isNull(ptr))
+        return;
+
+    prof_record(ptr, size, region);
+    return;
+}
+
+
+/**
+ * Remove sampled allocation (do nothing if ptr is not sampled)
+ *
+ * @param ptr
+ *            region to be freed
+ *
+ * @return none
+ *
+ */
+static void
+prof_free(const void *ptr)
+{
+    prof_sample **pp, *ps;
+
+    prof_lock();
+    for (pp = &prof_hash[((uintptr_t) ptr >> 4) % PROF_NHASH]; nonNull(*pp); pp = &(*pp)->next) {
+        ps = *pp;
+        if (ps->ptr != ptr)
+            continue;
+
+        ps->site->live_objs  -= ps->objs;
+        ps->site->live_bytes -= ps->bytes;
+        *pp = ps->next;
+        free(ps);
+        break;
+    }
+    prof_unlock();
+
+    return;
+}
+
+
+/**
+ * Write heap profile in legacy pprof format (gperftools heap profile)
+ * addresses are resolved by pprof with MAPPED_LIBRARIES
+ * (prof_mutex must be locked)
+ *
+ * @param fp
+ *            output
+ *
+ * @return none
+ *
+ */
+static void
+dump_heapprof_pprof(FILE *fp)
+{
+    uint64_t total[4] = { 0, 0, 0, 0 };
+    prof_site *site;
+    FILE *maps;
+    char line[512];
+    size_t i;
+    int d;
+
+    for (i = 0; i < PROF_NSITE; ++i) {
+        site = &prof_sites[i];
+        total[0] += site->live_objs;
+        total[1] += site->live_bytes;
+        total[2] += site->alloc_objs;
+        total[3] += site->alloc_bytes;
+    }
+
+    fprintf(fp, "heap profile: %6llu: %8llu [%6llu: %8llu] @ heapprofile\n",
+            (unsigned long long) total[0], (unsigned long long) total[1],
+            (unsigned long long) total[2], (unsigned long long) total[3]);
+
+    for (i = 0; i < PROF_NSITE; ++i) {
+        site = &prof_sites[i];
+        if (site->depth == 0)
+            continue;
+
+        fprintf(fp, "%6llu: %8llu [%6llu: %8llu] @",
+                (unsigned long long) site->live_objs, (unsigned long long) site->live_bytes,
+                (unsigned long long) site->alloc_objs, (unsigned long long) site->alloc_bytes);
+        for (d = 0; d < site->depth; ++d)
+            fprintf(fp, " %p", site->pc[d]);
+        fprintf(fp, "\n");
+    }
+
+    fprintf(fp, "\nMAPPED_LIBRARIES:\n");
+    maps = fopen("/proc/self/maps", "r");
+    if (nonNull(maps)) {
+        while (fgets(line, sizeof(line), maps) != NULL)
+            fputs(line, fp);
+        fclose(maps);
+    }
+
+    return;
+}
+
+
+/**
+ * Write live bytes per stack in folded format (input of flamegraph.pl)
+ * frames are function names if exported (link with -rdynamic), otherwise
+ * object+offset
+ * (prof_mutex must be locked)
+ *
+ * @param fp
+ *            output
+ *
+ * @return none
+ *
+ */
+static void
+dump_heapprof_folded(FILE *fp)
+{
+    prof_site *site;
+    char **sym, *b, *e;
+    size_t i;
+    int d;
+
+    for (i = 0; i < PROF_NSITE; ++i) {
+        site = &prof_sites[i];
+        if (site->depth == 0 || site->live_bytes == 0)
+            continue;
+
+        sym = backtrace_symbols(site->pc, site->depth);
+        for (d = site->depth - 1; d >= 0; --d) {
+            /* "object(function+offset) [address]" */
+            b = isNull(sym) ? NULL : strchr(sym[d], '(');
+            e = isNull(b) ? NULL : strpbrk(b, "+)");
+            if (nonNull(b) && nonNull(e) && e > b + 1)
+                fprintf(fp, "%.*s", (int) (e - b - 1), b + 1);
+            else
+                print_site(fp, site->pc[d]);
+            fprintf(fp, (d > 0) ? ";" : " ");
+        }
+        fprintf(fp, "%llu\n", (unsigned long long) site->live_bytes);
+        free(sym);
+    }
+
+    return;
+}
+
+
+/*
+ ********** Statistics **********
+ */
+
+/* periodic dump of heap (NVMM_HEAPSTAT_MS) */
+static FILE   *heapstat_fp;
+static int64_t heapstat_next;
+
+
+/**
+ * Return size class of free extent (floor of log2)
+ *
+ * @param size
+ *            bytes of extent
+ *
+ * @return size class (< NVMM_STATS_NHIST)
+ *
+ */
+static inline int
+size_class(size_t size)
+{
+    int c;
+
+    for (c = 0; size > 1 && c < NVMM_STATS_NHIST - 1; size >>= 1)
+        ++c;
+
+    return c;
+}
+
+
+/**
+ * Collect free extents of mapped nvmm_block
+ * (heap must be locked)
+ *
+ * @param nb
+ *            target nvmm_block
+ * @param largest
+ *            largest free extent (output)
+ * @param hist
+ *            histogram of free extents (added, NVMM_STATS_NHIST entries)
+ *
+ * @return number of free extents
+ *
+ */
+static size_t
+block_stats(nvmm_block *nb, size_t *largest, size_t *hist)
+{
+    nvmm_region *nr;
+    size_t n;
+
+    *largest = 0;
+    for (n = 0, nr = nb->nr; nr != NULL; nr = nr->next, ++n) {
+        if (nr->size > *largest)
+            *largest = nr->size;
+        hist[size_class(nr->size)]++;
+    }
+
+    return n;
+}
+
+
+/**
+ * Collect statistics of heap
+ * (heap must be locked)
+ *
+ * @param heap
+ *            target nvmm_heap
+ * @param st
+ *            statistics (output)
+ *
+ * @return none
+ *
+ */
+static void
+heap_stats(nvmm_heap *heap, nvmm_stats *st)
+{
+    nvmm_block *nb;
+    size_t largest;
+    int i;
+
+    memset(st, 0, sizeof(*st));
+    st->window = heap->size;
+
+    for (i = 0; i < heap->num_nb; ++i) {
+        nb = heap->nb_table[i];
+
+        /* not mmaped nvmm_blocks are never adjacent (always merged) */
+        if (isNull(nb->va)) {
+            st->unmapped += nb->free;
+            if (nb->free > st->largest_unmapped)
+                st->largest_unmapped = nb->free;
+            continue;
+        }
+
+        st->blocks++;
+        st->mapped += nb->size;
+        st->used   += nb->size - nb->free;
+        st->free   += nb->free;
+        if (nb->arena)
+            st->arena_blocks++;
+        if (deallocatable(nb))
+            st->retained += nb->size;
+
+        st->free_extents += block_stats(nb, &largest, st->hist);
+        if (largest > st->largest_free)
+            st->largest_free = largest;
+    }
+
+    st->regions   = heap->num_region;
+    st->meta_nvmm = heap->num_region * sizeof(region_info);
+    st->meta_dram = sizeof(nvmm_heap)
+        + sizeof(nvmm_block *) * heap->maxn_nb
+        + sizeof(nvmm_block) * heap->num_nb
+        + sizeof(nvmm_region) * heap->num_nr
+        + sizeof(uint64_t) * ((heap->size / PAGESIZE + 63) / 64);
+
+    largest = (st->largest_free > st->largest_unmapped) ? st->largest_free : st->largest_unmapped;
+    if (st->free + st->unmapped > 0)
+        st->frag = 1.0 - (double) largest / (double) (st->free + st->unmapped);
+
+    return;
+}
+
+
+/**
+ * Write statistics and nvmm_blocks of heap
+ * (heap must be locked)
+ *
+ * @param fp
+ *            output
+ * @param heap
+ *            target nvmm_heap
+ *
+ * @return none
+ *
+ */
+static void
+dump_heap(FILE *fp, nvmm_heap *heap)
+{
+    static const char *attr_name[NVMM_NATTR] = { "cached", "wc", "uncached" };
+    size_t hist[NVMM_STATS_NHIST];
+    nvmm_stats st;
+    nvmm_block *nb;
+    size_t largest, extents;
+    const char *sep;
+    int c;
+
+    heap_stats(heap, &st);
+    fprintf(fp, "# heap,window,mapped,used,free,retained,unmapped,largest_free,largest_unmapped,"
+            "blocks,arena_blocks,regions,free_extents,meta_nvmm,meta_dram,frag\n");
+    fprintf(fp, "# %d,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%.4f\n",
+            heap->id, st.window, st.mapped, st.used, st.free, st.retained, st.unmapped,
+            st.largest_free, st.largest_unmapped, st.blocks, st.arena_blocks, st.regions,
+            st.free_extents, st.meta_nvmm, st.meta_dram, st.frag);
+
+    /* blocks in address order */
+    /* (hist is "class:count" of free extents, class c is [2^c, 2^(c+1)) bytes) */
+    fprintf(fp, "heap,pa,size,free,attr,state,largest,extents,hist\n");
+    for (nb = heap->nb_head; nb != NULL; nb = nb->next) {
+        if (isNull(nb->va)) {
+            fprintf(fp, "%d,0x%lx,%zu,%zu,-,unmapped,%zu,1,\n",
+                    heap->id, nb->pa, nb->free, nb->free, nb->free);
+            continue;
+        }
+
+        memset(hist, 0, sizeof(hist));
+        extents = block_stats(nb, &largest, hist);
+        fprintf(fp, "%d,0x%lx,%zu,%zu,%s,%s,%zu,%zu,", heap->id, nb->pa, nb->size, nb->free,
+                attr_name[nb->attr],
+                nb->arena ? "arena" : !deallocatable(nb) ? "used" : nb->pinned ? "reserved" : "retained",
+                largest, extents);
+        for (c = 0, sep = ""; c < NVMM_STATS_NHIST; ++c) {
+            if (hist[c] == 0)
+                continue;
+            fprintf(fp, "%s%d:%zu", sep, c, hist[c]);
+            sep = " ";
+        }
+        fprintf(fp, "\n");
+    }
+
+    return;
+}
+
+
+/**
+ * Write statistics of all heaps
+ *
+ * @param fp
+ *            output
+ *
+ * @return none
+ *
+ */
+static void
+dump_heaps(FILE *fp)
+{
+    nvmm_heap *heap;
+    int i;
+
+    fprintf(fp, "# time_ms,%lld\n", (long long) now_ms());
+
+    /* on error exit, exiting thread may hold locks, so never wait for them */
+    if (!is_error_exit)
+        table_lock();
+    for (i = 0; i < NVMM_MAXN_HEAP; ++i) {
+        heap = nvmm_heap_table[i];
+        if (isNull(heap))
+            continue;
+
+        if (!is_error_exit)
+            heap_lock(heap);
+        else if (heap_trylock(heap) != 0) {
+            fprintf(fp, "# heap %d is locked, skipped\n", i);
+            continue;
+        }
+        dump_heap(fp, heap);
+        heap_unlock(heap);
+    }
+    if (!is_error_exit)
+        table_unlock();
+
+    fflush(fp);
+    return;
+}
+
+
+/**
+ * Write statistics to NVMM_HEAPSTAT every NVMM_HEAPSTAT_MS
+ * (called at allocation, heap must not be locked)
+ *
+ * @return none
+ *
+ */
+static void
+heapstat_tick()
+{
+    int64_t now, next;
+
+    now  = now_ms();
+    next = __atomic_load_n(&heapstat_next, __ATOMIC_RELAXED);
+    if (now < next)
+        return;
+
+    /* one thread writes */
+    if (!__atomic_compare_exchange_n(&heapstat_next, &next, now + opt_heapstat_ms, 0,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return;
+
+    dump_heaps(heapstat_fp);
+    return;
+}
+
+
+/**
+ * Create nvmm_heap for given physical window
+ *
+ * @param pa
+ *            physical address of window (begin)
+ * @param size
+ *            bytes of window
+ *
+ * @return created nvmm_heap
+ *
+ */
+static nvmm_heap *
+create_nvmm_heap(addr_t pa, size_t size)
+{
+    nvmm_heap *heap, *h;
+    nvmm_block *nb;
+    int id, attr, i;
+
+    /* window must be aligned by NB_ALIGN */
+    if (unlikely(size == 0 || pa % NB_ALIGN != 0 || size % NB_ALIGN != 0)) {
+        set_msg("create_nvmm_heap::Invalid window(0x%lx, 0x%zx)\n", pa, size);
+        exit_stderr();
+    }
+
+    /* window must not overlap with others, and look for empty slot */
+    id = -1;
+    for (i = 0; i < NVMM_MAXN_HEAP; ++i) {
+        h = nvmm_heap_table[i];
+        if (isNull(h)) {
+            if (id == -1)
+                id = i;
+        } else if (pa < h->pa + h->size && h->pa < pa + size) {
+            set_msg("create_nvmm_heap::Overlapped window(0x%lx, 0x%zx)\n", pa, size);
+            exit_stderr();
+        }
+    }
+    if (unlikely(id == -1)) {
+        set_msg("create_nvmm_heap::Too many heaps\n");
+        exit_stderr();
+    }
+
+    heap = (nvmm_heap *) malloc(sizeof(nvmm_heap));
+    if (unlikely(isNull(heap))) {
+        set_msg("create_nvmm_heap::malloc(heap)");
+        exit_perror(errno);
+    }
+
+    heap->id   = id;
+    heap->pa   = pa;
+    heap->size = size;
+
+    /* nvmm_block table */
+    heap->num_nb   = 0;
+    heap->maxn_nb  = NB_TABLE_INIT;
+    heap->nb_table = (nvmm_block **) malloc(sizeof(nvmm_block *) * heap->maxn_nb);
+    if (unlikely(isNull(heap->nb_table))) {
+        set_msg("create_nvmm_heap::malloc(nb_table)");
+        exit_perror(errno);
+    }
+
+    /* whole window is one (not mmaped) nvmm_block */
+    heap->nb_head = NULL;
+    nb = alloc_nvmm_block(heap, NULL, pa, size);
+    nb->idle = 0;
+
+    /* set cache */
+    for (attr = 0; attr < NVMM_NATTR; ++attr)
+        heap->nbb[attr] = nb;
+
+    /* reserve address space */
+    reserve_nvmm_va(heap);
+    nvmm_pptr_bias[id + 1] = (uint64_t) (uintptr_t) heap->va_base
+        - ((uint64_t) (id + 1) << NVMM_PPTR_SHIFT);
+
+    /* no nvmm_region in pool */
+    heap->nr_pool = NULL;
+
+    /* no retained nvmm_block */
+    heap->lru_head = NULL;
+    heap->lru_tail = NULL;
+    heap->retained = 0;
+    heap->num_nr     = 0;
+    heap->num_region = 0;
+
+    /* check NVMM_DECAY_MS at first allocation */
+    heap->decay_next = 0;
+
+    /* carve from head of window at first */
+    heap->cursor = pa;
+
+    /* NVMM_MallocSpread starts from bank 0 */
+    heap->spread = 0;
+
+    /* wear counters */
+    alloc_wear(heap);
+
+#if defined(NVMM_CRASHSIM)
+    /* persisted image */
+    alloc_crash(heap);
+#endif
+
+    /* persistence check */
+    alloc_pmcheck(heap);
+
+    /* no page is known-zero until mapped */
+    heap->zero_pages = (uint64_t *) calloc((heap->size / PAGESIZE + 63) / 64, sizeof(uint64_t));
+    if (unlikely(isNull(heap->zero_pages))) {
+        set_msg("create_nvmm_heap::calloc(zero_pages)");
+        exit_perror(errno);
+    }
+    heap->zero_bytes = 0;
+
+#if defined(NVMM_MT)
+    pthread_mutex_init(&heap->lock, NULL);
+#endif
+
+    nvmm_heap_table[id] = heap;
+    return heap;
+}
+
+
+/**
+ * Destroy nvmm_heap (all regions in heap are released)
+ *
+ * @param heap
+ *            target nvmm_heap
+ *
+ * @return none
+ *
+ */
+static void
+destroy_nvmm_heap(nvmm_heap *heap)
+{
+    nvmm_region *nr, *nrn;
+    int i;
+
+    /* free all allocated nvmm_block */
+    for (i = 0; i < heap->num_nb; ++i)
+        del_nvmm_block(heap->nb_table[i]);
+    free(heap->nb_table);
+
+    /* free all pooled nvmm_region */
+    for (nr = heap->nr_pool; nr != NULL; nr = nrn) {
+        nrn = nr->next;
+        free(nr);
+    }
+
+    /* release address space (and all mapped nvmm_block) */
+    munmap(heap->va_base, heap->size);
+
+    free(heap->wear_lines);
+    free(heap->wear_allocs);
+#if defined(NVMM_CRASHSIM)
+    free_crash(heap);
+#endif
+    if (nonNull(heap->pm_pages))
+        free_pmcheck(heap);
+    free(heap->zero_pages);
+
+    nvmm_heap_table[heap->id] = NULL;
+    nvmm_pptr_bias[heap->id + 1] = 0;
+#if defined(NVMM_MT)
+    pthread_mutex_destroy(&heap->lock);
+#endif
+    free(heap);
+
+    return;
+}
+
+
+/**
+ * Parse size with suffix (K, M, G)
+ *
+ * @param str
+ *            source string
+ * @param endp
+ *            pointer to first invalid character
+ *
+ * @return parsed size
+ *
+ */
+static size_t
+parse_size(const char *str, char **endp)
+{
+    unsigned long long val;
+
+    val = strtoull(str, endp, 0);
+    switch (**endp) {
+    case 'G': case 'g':
+        val *= GiB; ++*endp; break;
+    case 'M': case 'm':
+        val *= MiB; ++*endp; break;
+    case 'K': case 'k':
+        val *= KiB; ++*endp; break;
+    default:
+        break;
+    }
+
+    return (size_t) val;
+}
+
+
+/**
+ * Return option value from environment variable
+ *
+ * @param name
+ *            name of environment variable
+ * @param defval
+ *            default value (if not set)
+ *
+ * @return option value
+ *
+ */
+static size_t
+getenv_size(const char *name, size_t defval)
+{
+    const char *env;
+    char *p;
+    size_t val;
+
+    env = getenv(name);
+    if (isNull((void *) env) || *env == '\0')
+        return defval;
+
+    val = parse_size(env, &p);
+    if (*p != '\0') {
+        set_msg("getenv_size::Invalid %s(%s)\n", name, env);
+        exit_stderr();
+    }
+
+    return val;
+}
+
+
+/**
+ * Create heaps from NVMM_WINDOW (e.g. "0x80000000:512M,0xA0000000:512M")
+ *
+ * @param env
+ *            value of NVMM_WINDOW
+ *
+ * @return none
+ *
+ */
+static void
+create_nvmm_windows(const char *env)
+{
+    char *p;
+    addr_t pa;
+    size_t size;
+
+    p = (char *) env;
+    for (;;) {
+        pa = (addr_t) parse_size(p, &p);
+        if (*p != ':')
+            break;
+        size = parse_size(p + 1, &p);
+        create_nvmm_heap(pa, size);
+
+        if (*p == '\0')
+            return;
+        if (*p != ',')
+            break;
+        ++p;
+    }
+
+    set_msg("create_nvmm_windows::Invalid NVMM_WINDOW(%s)\n", env);
+    exit_stderr();
+}
+
+
+/**
+ * Initialize nvmmlib
+ * if NVMM_WINDOW is not set, create one heap for default window
+ *
+ * @param none
+ *
+ * @return none
+ *
+ */
+static inline void
+initialize_nvmmlib()
+{
+    const char *env;
+
+    /* options (default: retain all, never decay, no prefault) */
+    opt_retain_max = getenv_size("NVMM_RETAIN_MAX", SIZE_MAX);
+    opt_decay_ms   = (int64_t) getenv_size("NVMM_DECAY_MS", 0);
+    opt_prefault   = (int) getenv_size("NVMM_PREFAULT", 0);
+    opt_reserve    = getenv_size("NVMM_RESERVE", 0);
+
+    /* bank geometry (default: 8 KiB row, 8 banks) */
+    opt_bank_shift = (int) getenv_size("NVMM_BANK_SHIFT", 13);
+    opt_bank_bits  = (int) getenv_size("NVMM_BANK_BITS", 3);
+    if (unlikely(opt_bank_shift < 2 || opt_bank_bits < 0 ||
+                 opt_bank_shift + opt_bank_bits >= 30)) {
+        set_msg("initialize_nvmmlib::Invalid NVMM_BANK_SHIFT/NVMM_BANK_BITS\n");
+        exit_stderr();
+    }
+
+    /* allocation policy (default: first) */
+    env = getenv("NVMM_POLICY");
+    if (isNull((void *) env) || *env == '\0' || strcmp(env, "first") == 0) {
+        opt_policy = POLICY_FIRST;
+    } else if (strcmp(env, "wear") == 0) {
+        opt_policy = POLICY_WEAR;
+    } else {
+        set_msg("initialize_nvmmlib::Invalid NVMM_POLICY(%s)\n", env);
+        exit_stderr();
+    }
+
+    /* behavior on exhaustion (default: abort) */
+    env = getenv("NVMM_OOM");
+    if (isNull((void *) env) || *env == '\0' || strcmp(env, "abort") == 0) {
+        opt_oom = NVMM_OOM_ABORT;
+    } else if (strcmp(env, "null") == 0) {
+        opt_oom = NVMM_OOM_NULL;
+    } else {
+        set_msg("initialize_nvmmlib::Invalid NVMM_OOM(%s)\n", env);
+        exit_stderr();
+    }
+
+    /* wear tracking (default: disabled) */
+    opt_wear = getenv("NVMM_WEAR");
+    if (nonNull((void *) opt_wear) && *opt_wear == '\0')
+        opt_wear = NULL;
+
+    /* persistence check (default: disabled) */
+    opt_pmcheck = getenv("NVMM_PMCHECK");
+    if (nonNull((void *) opt_pmcheck) && *opt_pmcheck == '\0')
+        opt_pmcheck = NULL;
+    if (nonNull((void *) opt_pmcheck))
+        init_pmcheck();
+
+    /* pre-zeroing (default: disabled, every 10 ms) */
+    opt_prezero    = getenv_size("NVMM_PREZERO", 0);
+    opt_prezero_ms = (int64_t) getenv_size("NVMM_PREZERO_MS", 10);
+    if (opt_prezero_ms <= 0)
+        opt_prezero_ms = 1;
+
+    /* heap profile (default: disabled, sample every 512 KiB) */
+    opt_heapprof = getenv("NVMM_HEAPPROF");
+    if (nonNull((void *) opt_heapprof) && *opt_heapprof == '\0')
+        opt_heapprof = NULL;
+    opt_heapprof_rate = getenv_size("NVMM_HEAPPROF_RATE", 512*KiB);
+    if (isNull((void *) opt_heapprof) || opt_heapprof_rate == 0)
+        opt_heapprof_rate = 0;
+    env = getenv("NVMM_HEAPPROF_FORMAT");
+    if (isNull((void *) env) || *env == '\0' || strcmp(env, "pprof") == 0) {
+        opt_heapprof_folded = 0;
+    } else if (strcmp(env, "folded") == 0) {
+        opt_heapprof_folded = 1;
+    } else {
+        set_msg("initialize_nvmmlib::Invalid NVMM_HEAPPROF_FORMAT(%s)\n", env);
+        exit_stderr();
+    }
+    if (opt_heapprof_rate > 0)
+        init_heapprof();
+
+    /* heap statistics (default: disabled, only at finalize) */
+    opt_heapstat = getenv("NVMM_HEAPSTAT");
+    if (nonNull((void *) opt_heapstat) && *opt_heapstat == '\0')
+        opt_heapstat = NULL;
+    opt_heapstat_ms = (int64_t) getenv_size("NVMM_HEAPSTAT_MS", 0);
+    if (nonNull((void *) opt_heapstat)) {
+        heapstat_fp = (strcmp(opt_heapstat, "-") == 0) ? stderr : fopen(opt_heapstat, "w");
+        if (unlikely(isNull(heapstat_fp))) {
+            set_msg("initialize_nvmmlib::fopen(%.64s)", opt_heapstat);
+            exit_perror(errno);
+        }
+        heapstat_next = now_ms() + opt_heapstat_ms;
+    } else {
+        opt_heapstat_ms = 0;
+    }
+
+    env = getenv("NVMM_WINDOW");
+    if (isNull((void *) env) || *env == '\0')
+        create_nvmm_heap(NVMM_BEGIN, NVMM_SIZE);
+    else
+        create_nvmm_windows(env);
+
+    /* map and prefault NVMM of default heap in advance */
+    if (opt_reserve > 0) {
+        heap_lock(nvmm_heap_table[0]);
+        reserve_nvmm_block(nvmm_heap_table[0], opt_reserve);
+        heap_unlock(nvmm_heap_table[0]);
+    }
+
+#if defined(NVMM_MT)
+    /* zero free NVMM in background */
+    if (opt_prezero > 0) {
+        if (unlikely(pthread_create(&prezero_thread, NULL, prezero_main, NULL) != 0)) {
+            set_msg("initialize_nvmmlib::pthread_create(prezero)");
+            exit_perror(errno);
+        }
+    }
+#endif
+
+    return;
+}
+
+
+/**
+ * Finalize nvmmlib
+ *
+ * @param none
+ *
+ * @return none
+ *
+ */
+static inline void
+finalize_nvmmlib()
+{
+    int i;
+
+#if defined(NVMM_MT)
+    /* stop pre-zeroing before heaps are destroyed */
+    /* (on error exit, thread may wait for heap lock held by exiting thread) */
+    if (opt_prezero > 0) {
+        __atomic_store_n(&prezero_stop, 1, __ATOMIC_RELAXED);
+        if (!is_error_exit)
+            pthread_join(prezero_thread, NULL);
+    }
+#endif
+
+    /* export heatmap */
+    if (nonNull((void *) opt_wear))
+        NVMM_WearDump(opt_wear);
+
+    /* export report of persistence check */
+    if (nonNull((void *) opt_pmcheck))
+        NVMM_PmCheckDump(opt_pmcheck);
+
+    /* export heap profile */
+    if (opt_heapprof_rate > 0)
+        NVMM_HeapProfDump(opt_heapprof);
+
+    /* export heap statistics */
+    if (nonNull(heapstat_fp)) {
+        opt_heapstat_ms = 0;
+        dump_heaps(heapstat_fp);
+        if (heapstat_fp != stderr)
+            fclose(heapstat_fp);
+        heapstat_fp = NULL;
+    }
+
+    /* on error exit, other threads may still use heaps, leave them to exit() */
+    if (is_error_exit)
+        return;
+
+    /* destroy all heaps */
+    for (i = 0; i < NVMM_MAXN_HEAP; ++i) {
+        if (nonNull(nvmm_heap_table[i]))
+            destroy_nvmm_heap(nvmm_heap_table[i]);
+    }
+
+    return;
+}
+
+
+/**
+ * Initialize nvmmlib
+ *
+ * @param none
+ *
+ * @return none
+ *
+ */
+__attribute__((constructor))
+void
+NVMM_Initialize()
+{
+    /* if nvmmlib has been initialized already, do nothing */
+    if (likely(is_initialized != 0))
+        return;
+
+#if defined(ZC706)
+    fd_devmem    = open("/dev/mem", O_RDWR);           /* cacheable */
+    fd_devmem_s  = open("/dev/mem", O_RDWR | O_SYNC);  /* non-cacheable */
+    fd_devmem_wc = open("/dev/mem", O_RDWR | O_DSYNC); /* write-combining */
+    if (unlikely(fd_devmem == -1 || fd_devmem_s == -1 || fd_devmem_wc == -1)) {
+        set_msg("NVMM_Initialize::open(/dev/mem)");
+        exit_perror(errno);
+    }
+
+    fd_wbmod = open("/dev/wbmod", O_RDWR);
+    if (unlikely(fd_wbmod == -1)) {
+        set_msg("NVMM_Initialize::open(/dev/wbmod)");
+        exit_perror(errno);
+    }
+#endif /* ZC706 */
+
+    /* initialize free list */
+    initialize_nvmmlib();
+
+    /* set initalized flag */
+    is_initialized++;
+
+    return;
+}
+
+
+/**
+ * Finalize nvmmlib
+ *
+ * @param none
+ *
+ * @return none
+ *
+ */
+__attribute__((destructor))
+void
+NVMM_Finalize()
+{
+    /* if nvmlib has been finalized already, do nothing */
+    if (unlikely(is_finalized != 0))
+        return;
+
+#if defined(ZC706)
+    close(fd_devmem);
+    close(fd_devmem_s);
+    close(fd_devmem_wc);
+    close(fd_wbmod);
+#endif /* ZC706 */
+
+    /* clean all free list */
+    finalize_nvmmlib();
+
+    /* set finalized flag */
+    is_finalized++;
+
+    return;
+}
+
+
+/**
+ * Create heap for given physical window
+ *
+ * @param pa
+ *            physical address of window (begin)
+ * @param size
+ *            bytes of window
+ *
+ * @return handle of created heap
+ *
+ */
+nvmm_heap *
+NVMM_HeapCreate(unsigned long pa, size_t size)
+{
+    nvmm_heap *heap;
+
+    NVMM_Initialize();
+
+    table_lock();
+    heap = create_nvmm_heap(pa, size);
+    table_unlock();
+
+    return heap;
+}
+
+
+/**
+ * Destroy heap (all regions in heap are released)
+ * default heap (id = 0) cannot be destroyed
+ *
+ * @param heap
+ *            handle of heap
+ *
+ * @return none
+ *
+ */
+void
+NVMM_HeapDestroy(nvmm_heap *heap)
+{
+    if (unlikely(isNull(heap) || heap->id == 0)) {
+        set_msg("NVMM_HeapDestroy::Invalid heap(%p)\n", (void *) heap);
+        exit_stderr();
+    }
+
+    prezero_lock();
+    table_lock();
+    destroy_nvmm_heap(heap);
+    table_unlock();
+    prezero_unlock();
+
+    return;
+}
+
+
+/**
+ * Return heap by id
+ * heaps created from NVMM_WINDOW have id in order of windows
+ *
+ * @param id
+ *            id of heap
+ *
+ * @return handle of heap (NULL if not exist)
+ *
+ */
+nvmm_heap *
+NVMM_GetHeap(int id)
+{
+    NVMM_Initialize();
+
+    if (id < 0 || id >= NVMM_MAXN_HEAP)
+        return NULL;
+
+    return nvmm_heap_table[id];
+}
+
+
+/**
+ * Map and prefault NVMM of heap in advance
+ *
+ * @param heap
+ *            handle of heap
+ * @param size
+ *            bytes to reserve
+ *
+ * @return none
+ *
+ */
+void
+NVMM_HeapReserve(nvmm_heap *heap, size_t size)
+{
+    if (unlikely(isNull(heap))) {
+        set_msg("NVMM_HeapReserve::Invalid heap(%p)\n", (void *) heap);
+        exit_stderr();
+    }
+
+    if (size > 0) {
+        heap_lock(heap);
+        reserve_nvmm_block(heap, size);
+        heap_unlock(heap);
+    }
+
+    return;
+}
+
+
+/**
+ * Set behavior on exhaustion of NVMM (same as NVMM_OOM)
+ * NVMM_OOM_ABORT: report state of heap and exit (default)
+ * NVMM_OOM_NULL : allocation returns NULL and sets errno to ENOMEM
+ *
+ * @param mode
+ *            NVMM_OOM_ABORT or NVMM_OOM_NULL
+ *
+ * @return previous mode
+ *
+ */
+int
+NVMM_SetOomMode(int mode)
+{
+    int prev;
+
+    NVMM_Initialize();
+
+    if (unlikely(mode != NVMM_OOM_ABORT && mode != NVMM_OOM_NULL)) {
+        set_msg("NVMM_SetOomMode::Invalid mode(%d)\n", mode);
+        exit_stderr();
+    }
+
+    prev = opt_oom;
+    opt_oom = mode;
+
+    return prev;
+}
+
+
+/**
+ * Register callback to free NVMM on exhaustion (NULL to unregister)
+ * callback is called without lock after purge and reclaim of retained
+ * blocks failed, and allocation is retried if it returns non-zero
+ * (up to 8 times per allocation, allocation in callback never calls it)
+ *
+ * @param fn
+ *            callback (heap, required bytes, arg)
+ * @param arg
+ *            argument of callback
+ *
+ * @return none
+ *
+ */
+void
+NVMM_SetReclaim(nvmm_reclaim_fn fn, void *arg)
+{
+    NVMM_Initialize();
+
+    table_lock();
+    reclaim_fn  = fn;
+    reclaim_arg = arg;
+    table_unlock();
+
+    return;
+}
+
+
+/**
+ * Allocate NVMM
+ *
+ * @param size
+ *            size of region
+ *
+ * @return pointer to allocated region (NULL if exhausted and NVMM_OOM_NULL)
+ *
+ */
+void *
+NVMM_Malloc(size_t size)
+{
+    return NVMM_MallocEx(size, NVMM_ATTR_CACHED);
+}
+
+
+/**
+ * Allocate NVMM with mapping attribute
+ *
+ * @param size
+ *            size of region
+ * @param flags
+ *            mapping attribute (NVMM_ATTR_*)
+ *
+ * @return pointer to allocated region
+ *
+ */
+void *
+NVMM_MallocEx(size_t size, int flags)
+{
+    /* to allocate NVMM, nvmmlib must be initialized */
+    NVMM_Initialize();
+
+    return NVMM_HeapMalloc(nvmm_heap_table[0], size, flags);
+}
+
+
+/**
+ * Allocate NVMM from given heap
+ * nvmm_blocks are not shared between attributes, so each attribute
+ * has its own pool of nvmm_block
+ *
+ * @param heap
+ *            source nvmm_heap
+ * @param size
+ *            size of region
+ * @param flags
+ *            mapping attribute (NVMM_ATTR_*)
+ *
+ * @return pointer to allocated region
+ *
+ */
+void *
+NVMM_HeapMalloc(nvmm_heap *heap, size_t size, int flags)
+{
+    void *ptr;
+
+    /* check heap */
+    if (unlikely(isNull(heap))) {
+        set_msg("NVMM_HeapMalloc::Invalid heap(%p)\n", (void *) heap);
+        exit_stderr();
+    }
+
+    /* check attribute */
+    if (unlikely((flags & NVMM_ATTR_MASK) >= NVMM_NATTR || (flags & ~NVMM_FLAGS_MASK))) {
+        set_msg("NVMM_HeapMalloc::Invalid flags(0x%x)\n", flags);
+        exit_stderr();
+    }
+
+    heap_lock(heap);
+    ptr = heap_malloc(heap, size, flags);
+    heap_unlock(heap);
+
+    if (unlikely(nonNull(heap->wear_allocs)))
+        wear_alloc(heap, ptr);
+    if (unlikely(opt_heapprof_rate > 0))
+        prof_alloc(ptr, size, 1);
+    if (unlikely(opt_heapstat_ms > 0))
+        heapstat_tick();
+
+    return ptr;
+}
+
+
+/**
+ * Allocate NVMM from given heap (heap must be locked)
+ * on exhaustion, purge, reclaim retained nvmm_block and call reclaim callback
+ * in this order, then fail by NVMM_OOM mode
+ *
+ * @param heap
+ *            source nvmm_heap
+ * @param size
+ *            size of region
+ * @param flags
+ *            mapping attribute (NVMM_ATTR_*) and NVMM_PREFAULT
+ *
+ * @return pointer to allocated region (NULL if exhausted and NVMM_OOM_NULL)
+ *
+ */
+static void *
+heap_malloc(nvmm_heap *heap, size_t size, int flags)
+{
+    void *ptr;
+    int merged, tries;
+    int idx;
+    int attr;
+
+    attr = flags & NVMM_ATTR_MASK;
+
+    /* unmap nvmm_block idle over NVMM_DECAY_MS */
+    decay_nvmm_block(heap);
+
+    /* 4-byte alignment */
+    /* to use vector (NEON), pointer must be aligned by 4 */
+    size = align_size(size, 4);
+
+    /* try to allocate from previous used nvmm_block */
+    ptr = NULL;
+    if (nonNull(heap->nbb[attr]) && size <= heap->nbb[attr]->free &&
+        attr_match(heap->nbb[attr], attr))
+        ptr = new_nvmm_region(heap->nbb[attr], size, flags);
+
+    merged = 0;
+    tries  = 0;
+    if (isNull(ptr))
+        idx = get_nbt_idx(heap, size);
+
+    while(isNull(ptr)) {
+        /* look for enough block */
+        for (; idx < heap->num_nb; ++idx) {
+            if (size <= heap->nb_table[idx]->free &&
+                attr_match(heap->nb_table[idx], attr))
+                break;
+        }
+
+        /* if search is failed */
+        if (idx == heap->num_nb) {
+            if (merged == 0) {
+                /* if have not purged, unmap decayed nvmm_block and retry */
+                purge_nvmm_block(heap);
+            } else if (merged == 1 &&
+                       reclaim_nvmm_block(heap, size + sizeof(region_info))) {
+                /* unmapped retained nvmm_block, retry */
+            } else if (oom_retry(heap, size + sizeof(region_info), &tries)) {
+                /* user freed NVMM, search again */
+                merged = -1;
+            } else {
+                /* if purge and reclaim failed to search again, exhausted. */
+                oom_fail(heap, "NVMM_Malloc");
+                return NULL;
+            }
+            ++merged;
+            idx = get_nbt_idx(heap, size);
+            continue;
+        }
+
+        /* try to allocate region */
+        ptr = new_nvmm_region(heap->nb_table[idx], size, flags);
+
+        ++idx;
+    }
+
+
+    return ptr;
+}
+
+
+/**
+ * Allocate NVMM and ZERO-fill
+ *
+ * @param nmemb
+ *            number of elements
+ * @param size
+ *            bytes per elements
+ *
+ * @return pointer to allocated region
+ *
+ */
+void *
+NVMM_Calloc(size_t nmemb, size_t size)
+{
+    void *retptr = NVMM_Malloc(nmemb * size);
+    nvmm_region *nr;
+    size_t n, len;
+
+    if (unlikely(isNull(retptr)))
+        return retptr;
+
+    /* zero without filling cache (known-zero pages are skipped) */
+    nr = get_nvmm_region(retptr);
+    n  = nmemb * size;
+    if (nr->dirty_len > 0 && nr->dirty_off < n) {
+        len = n - nr->dirty_off;
+        if (len > nr->dirty_len)
+            len = nr->dirty_len;
+        NVMM_Memset((byte *) retptr + nr->dirty_off, 0, len);
+        NVMM_Fence();
+    }
+
+    return retptr;
+}
+
+
+/**
+ * Zero free NVMM of heap in advance, so that NVMM_Calloc need not zero it
+ * zeroed pages stay known-zero until they are allocated
+ *
+ * @param heap
+ *            target heap (NULL is default heap)
+ * @param bytes
+ *            bytes to zero at most
+ *
+ * @return bytes zeroed (0 if all free pages of mapped blocks are known-zero)
+ *
+ */
+size_t
+NVMM_Prezero(nvmm_heap *heap, size_t bytes)
+{
+    NVMM_Initialize();
+
+    if (isNull(heap))
+        heap = nvmm_heap_table[0];
+
+    return prezero_nvmm_heap(heap, bytes);
+}
+
+
+/**
+ * Reallocate ptr with given size
+ *
+ * @param ptr
+ *            original ptr
+ * @param size
+ *            bytes for new allocation
+ *
+ * @return pointer to reallocated region
+ *
+ */
+void *
+NVMM_Realloc(void *ptr, size_t size)
+{
+    void *oldptr, *newptr;
+    int oldsize, newsize;
+    nvmm_block *nb;
+
+    /* if ptr is NULL, work as NVMM_Malloc() */
+    if (unlikely(isNull(ptr)))
+        return NVMM_Malloc(size);
+
+    /* Get size */
+    oldsize = get_alloc_size(ptr);
+    newsize = size;
+
+    /* check ptr is valid or not */
+    if (unlikely(oldsize <= 0)) {
+        set_msg("NVMM_Realloc::Invalid pointer(%p)\n", ptr);
+        exit_stderr();
+    }
+
+    /* region size includes region_info, compare payload */
+    oldsize -= (int) sizeof(region_info);
+
+    /* if oldptr is enough for size, do nothing */
+    if (unlikely(oldsize >= newsize)) {
+        return ptr;
+    }
+
+    /* Set oldptr, newptr (keep heap & mapping attribute of oldptr) */
+    oldptr = ptr;
+    nb = get_nvmm_region(ptr)->nb;
+    newptr = NVMM_HeapMalloc(nb->heap, size, nb->attr);
+
+    /* if can't allocate newptr, return NULL */
+    if (unlikely(isNull(newptr))) {
+        return NULL;
+    }
+
+    /* Copy from oldptr to newptr (without filling cache) */
+    NVMM_MemcpyPersist(newptr, oldptr, oldsize);
+
+    /* Free oldptr */
+    NVMM_Free(oldptr);
+
+    return newptr;
+}
+
+
+/**
+ * Free NVMM region
+ *
+ * @param ptr
+ *            pointer to region
+ *
+ * @return none
+ *
+ */
+void
+NVMM_Free(void *ptr)
+{
+    nvmm_region *nr;
+    nvmm_heap *heap;
+
+    if (unlikely(isNull(ptr)))
+        return;
+
+    if (likely(is_finalized == 0)) {
+        nr   = get_nvmm_region(ptr);
+        heap = nr->nb->heap;
+
+        /* live bytes of heap profile */
+        if (unlikely(nr->sampled))
+            prof_free(ptr);
+
+        /* stores to freed region need not be flushed */
+        if (unlikely(nonNull((void *) opt_pmcheck)))
+            pm_keep(heap, ptr, ptr_to_ri(ptr)->size - sizeof(region_info));
+
+        heap_lock(heap);
+        free_nvmm_region(ptr);
+        heap_unlock(heap);
+    }
+
+    return;
+}
+
+
+/*
+ ********** Bank-aware placement **********
+ */
+
+/**
+ * Return physical address of va in heap
+ *
+ * @param heap
+ *            nvmm_heap which contains va
+ * @param va
+ *            virtual address
+ *
+ * @return physical address
+ *
+ */
+static inline addr_t
+va_to_pa(nvmm_heap *heap, const byte *va)
+{
+    return heap->pa + (addr_t) (va - heap->va_base);
+}
+
+
+/**
+ * Return head of region in nr whose pointer satisfies pa % align == offset
+ *
+ * @param nr
+ *            idle nvmm_region
+ * @param size
+ *            size of region (including region_info)
+ * @param align
+ *            alignment of physical address of pointer
+ * @param offset
+ *            offset from alignment
+ *
+ * @return head of region (NULL if nr is not enough)
+ *
+ */
+static inline byte *
+aligned_in_nvmm_region(nvmm_region *nr, size_t size, size_t align, size_t offset)
+{
+    addr_t pa;
+    size_t pad;
+
+    pa  = va_to_pa(nr->nb->heap, nr->ptr + sizeof(region_info));
+    pad = (offset + align - pa % align) % align;
+    if (pad + size > nr->size)
+        return NULL;
+
+    return nr->ptr + pad;
+}
+
+
+/**
+ * Allocate NVMM whose physical address satisfies pa % align == offset
+ * (heap must be locked)
+ *
+ * @param heap
+ *            source nvmm_heap
+ * @param size
+ *            size of region
+ * @param flags
+ *            mapping attribute (NVMM_ATTR_*) and NVMM_PREFAULT
+ * @param align
+ *            alignment of physical address
+ * @param offset
+ *            offset from alignment
+ *
+ * @return pointer to allocated region (NULL if exhausted and NVMM_OOM_NULL)
+ *
+ */
+static void *
+heap_malloc_aligned(nvmm_heap *heap, size_t size, int flags, size_t align, size_t offset)
+{
+    nvmm_block *nb;
+    nvmm_region *nr;
+    byte *at;
+    size_t need;
+    int attr, stage, tries, i;
+
+    attr  = flags & NVMM_ATTR_MASK;
+    tries = 0;
+    size = align_size(size, 4) + sizeof(region_info);
+
+    /* rest of nvmm_region stays aligned for next call (no padding fragment) */
+    if (align <= size)
+        size = align_size(size, align);
+    need = size + align;
+
+    /* unmap nvmm_block idle over NVMM_DECAY_MS */
+    decay_nvmm_block(heap);
+
+    for (stage = 0; ; ++stage) {
+        /* look for aligned position in mmaped nvmm_block */
+        for (i = 0; i < heap->num_nb; ++i) {
+            nb = heap->nb_table[i];
+            if (isNull(nb->va) || nb->attr != attr || nb->free < size)
+                continue;
+            for (nr = nb->nr; nr != NULL; nr = nr->next) {
+                at = aligned_in_nvmm_region(nr, size, align, offset);
+                if (nonNull(at))
+                    return cut_nvmm_region(nr, at, size);
+            }
+        }
+
+        /* map new nvmm_block (enough for any alignment) */
+        for (i = 0; i < heap->num_nb; ++i) {
+            nb = heap->nb_table[i];
+            if (isNull(nb->va) && need <= nb->free) {
+                nb = new_nvmm_block(nb, need, flags);
+                if (unlikely(isNull(nb)))
+                    break;
+                heap->nbb[attr] = nb;
+                at = aligned_in_nvmm_region(nb->nr, size, align, offset);
+                return cut_nvmm_region(nb->nr, at, size);
+            }
+        }
+
+        /* same as heap_malloc, purge then reclaim */
+        if (stage == 0) {
+            purge_nvmm_block(heap);
+        } else if (stage == 1 && reclaim_nvmm_block(heap, need)) {
+            /* unmapped retained nvmm_block, retry */
+        } else if (oom_retry(heap, need, &tries)) {
+            /* user freed NVMM, search again */
+            stage = -1;
+        } else {
+            oom_fail(heap, "NVMM_MallocAligned");
+            return NULL;
+        }
+    }
+}
+
+
+/**
+ * Allocate NVMM whose physical address satisfies pa % align == offset
+ * e.g. NVMM_MallocAligned(size, 4096, 0) returns page-aligned region
+ *
+ * @param size
+ *            size of region
+ * @param align
+ *            alignment of physical address (multiple of 4)
+ * @param offset
+ *            offset from alignment (multiple of 4, smaller than align)
+ *
+ * @return pointer to allocated region
+ *
+ */
+void *
+NVMM_MallocAligned(size_t size, size_t align, size_t offset)
+{
+    nvmm_heap *heap;
+    void *ptr;
+
+    /* to allocate NVMM, nvmmlib must be initialized */
+    NVMM_Initialize();
+    heap = nvmm_heap_table[0];
+
+    if (unlikely(align == 0 || align % 4 != 0 || offset % 4 != 0 || offset >= align)) {
+        set_msg("NVMM_MallocAligned::Invalid alignment(%zu, %zu)\n", align, offset);
+        exit_stderr();
+    }
+
+    heap_lock(heap);
+    ptr = heap_malloc_aligned(heap, size, NVMM_ATTR_CACHED, align, offset);
+    heap_unlock(heap);
+
+    if (unlikely(nonNull(heap->wear_allocs)))
+        wear_alloc(heap, ptr);
+    if (unlikely(opt_heapprof_rate > 0))
+        prof_alloc(ptr, size, 1);
+    if (unlikely(opt_heapstat_ms > 0))
+        heapstat_tick();
+
+    return ptr;
+}
+
+
+/**
+ * Allocate NVMM starting at next bank of previous call (round-robin)
+ * concurrent streams (arrays accessed together) should be allocated by this
+ * to avoid row conflicts in the same bank
+ *
+ * @param size
+ *            size of region
+ *
+ * @return pointer to allocated region
+ *
+ */
+void *
+NVMM_MallocSpread(size_t size)
+{
+    nvmm_heap *heap;
+    size_t period;
+    int bank;
+    void *ptr;
+
+    /* to allocate NVMM, nvmmlib must be initialized */
+    NVMM_Initialize();
+    heap = nvmm_heap_table[0];
+
+    period = (size_t) 1 << (opt_bank_shift + opt_bank_bits);
+
+    heap_lock(heap);
+    bank = heap->spread++ & ((1 << opt_bank_bits) - 1);
+    ptr  = heap_malloc_aligned(heap, size, NVMM_ATTR_CACHED, period,
+                               (size_t) bank << opt_bank_shift);
+    heap_unlock(heap);
+
+    if (unlikely(nonNull(heap->wear_allocs)))
+        wear_alloc(heap, ptr);
+    if (unlikely(opt_heapprof_rate > 0))
+        prof_alloc(ptr, size, 1);
+    if (unlikely(opt_heapstat_ms > 0))
+        heapstat_tick();
+
+    return ptr;
+}
+
+
+/**
+ * Allocate NVMM in the same row as hint if possible (co-location)
+ * if there is no space in the row, work as NVMM_Malloc in heap of hint
+ *
+ * @param hint
+ *            region allocated by NVMM_*Malloc
+ * @param size
+ *            size of region
+ *
+ * @return pointer to allocated region
+ *
+ */
+void *
+NVMM_MallocNear(void *hint, size_t size)
+{
+    nvmm_block *nb;
+    nvmm_heap *heap;
+    nvmm_region *nr;
+    byte *row, *lo, *hi;
+    size_t rowsize, need;
+    void *ptr;
+
+    if (unlikely(isNull(hint)))
+        return NVMM_Malloc(size);
+
+    nb   = get_nvmm_region(hint)->nb;
+    heap = nb->heap;
+
+    rowsize = (size_t) 1 << opt_bank_shift;
+    row     = (byte *) hint - va_to_pa(heap, (byte *) hint) % rowsize;
+    need    = align_size(size, 4) + sizeof(region_info);
+
+    heap_lock(heap);
+    ptr = NULL;
+    if (need <= rowsize) {
+        /* look for space in [row, row + rowsize) */
+        for (nr = nb->nr; nr != NULL && nr->ptr < row + rowsize; nr = nr->next) {
+            lo = (nr->ptr > row) ? nr->ptr : row;
+            hi = (nr->ptr + nr->size < row + rowsize) ? nr->ptr + nr->size : row + rowsize;
+            if (lo < hi && (size_t) (hi - lo) >= need) {
+                ptr = cut_nvmm_region(nr, lo, need);
+                break;
+            }
+        }
+    }
+    if (isNull(ptr))
+        ptr = heap_malloc(heap, size, nb->attr);
+    heap_unlock(heap);
+
+    if (unlikely(nonNull(heap->wear_allocs)))
+        wear_alloc(heap, ptr);
+    if (unlikely(opt_heapprof_rate > 0))
+        prof_alloc(ptr, size, 1);
+    if (unlikely(opt_heapstat_ms > 0))
+        heapstat_tick();
+
+    return ptr;
+}
+
+
+/**
+ * Return physical address of NVMM
+ *
+ * @param ptr
+ *            pointer to NVMM (not only head of region)
+ *
+ * @return physical address (0 if ptr is not NVMM)
+ *
+ */
+unsigned long
+NVMM_GetPhysAddr(void *ptr)
+{
+    nvmm_heap *heap = va_to_heap((byte *) ptr);
+
+    if (isNull(heap))
+        return 0;
+
+    return va_to_pa(heap, (byte *) ptr);
+}
+
+
+/**
+ * Return bank of NVMM
+ *
+ * @param ptr
+ *            pointer to NVMM
+ *
+ * @return bank (-1 if ptr is not NVMM)
+ *
+ */
+int
+NVMM_GetBank(void *ptr)
+{
+    nvmm_heap *heap = va_to_heap((byte *) ptr);
+
+    if (isNull(heap))
+        return -1;
+
+    return (int) ((va_to_pa(heap, (byte *) ptr) >> opt_bank_shift) &
+                  ((1 << opt_bank_bits) - 1));
+}
+
+
+/*
+ ********** Persistent pointer **********
+ */
+
+/**
+ * Convert pointer to persistent pointer (heap id and offset in window)
+ * use NVMM_PPTR_GET to convert back
+ *
+ * @param ptr
+ *            pointer to NVMM
+ *
+ * @return persistent pointer (NVMM_PPTR_NULL if ptr is NULL or not NVMM)
+ *
+ */
+nvmm_pptr
+NVMM_PPtr(void *ptr)
+{
+    nvmm_heap *heap = va_to_heap((byte *) ptr);
+
+    if (isNull(heap))
+        return NVMM_PPTR_NULL;
+
+    return ((uint64_t) (heap->id + 1) << NVMM_PPTR_SHIFT)
+        + (uint64_t) ((byte *) ptr - heap->va_base);
+}
+
+
+/*
+ ********** Arena **********
+ */
+
+/**
+ * Create arena
+ *
+ * @param heap
+ *            source heap (NULL for default heap)
+ * @param blocksize
+ *            bytes per block of arena (0 for default)
+ * @param flags
+ *            mapping attribute (NVMM_ATTR_*)
+ *
+ * @return handle of arena
+ *
+ */
+nvmm_arena *
+NVMM_ArenaCreate(nvmm_heap *heap, size_t blocksize, int flags)
+{
+    nvmm_arena *arena;
+
+    NVMM_Initialize();
+
+    if (isNull(heap))
+        heap = nvmm_heap_table[0];
+
+    if (unlikely((flags & NVMM_ATTR_MASK) >= NVMM_NATTR || (flags & ~NVMM_FLAGS_MASK))) {
+        set_msg("NVMM_ArenaCreate::Invalid flags(0x%x)\n", flags);
+        exit_stderr();
+    }
+
+    arena = (nvmm_arena *) malloc(sizeof(nvmm_arena));
+    if (unlikely(isNull(arena))) {
+        set_msg("NVMM_ArenaCreate::malloc(arena)");
+        exit_perror(errno);
+    }
+
+    arena->heap      = heap;
+    arena->flags     = flags;
+    arena->blocksize = to_mmapsize(blocksize);
+
+    arena->num_blocks  = 0;
+    arena->maxn_blocks = ARENA_BLOCKS_INIT;
+    arena->blocks = (nvmm_block **) malloc(sizeof(nvmm_block *) * arena->maxn_blocks);
+    if (unlikely(isNull(arena->blocks))) {
+        set_msg("NVMM_ArenaCreate::malloc(blocks)");
+        exit_perror(errno);
+    }
+
+    /* no block until first allocation */
+    arena->cur = -1;
+    arena->ptr = NULL;
+    arena->end = NULL;
+
+    return arena;
+}
+
+
+/**
+ * Move arena to next block which has enough bytes for size
+ * if no such block, acquire new block
+ *
+ * @param arena
+ *            target arena
+ * @param size
+ *            allocation size
+ *
+ * @return 0 if succeeded, -1 if NVMM is exhausted (NVMM_OOM_NULL)
+ *
+ */
+static int
+arena_next_block(nvmm_arena *arena, size_t size)
+{
+    nvmm_block *nb, **blocks;
+    int cur = arena->cur;
+
+    /* reuse retained blocks (after NVMM_ArenaReset) */
+    while (++arena->cur < arena->num_blocks) {
+        nb = arena->blocks[arena->cur];
+        if (size <= nb->size) {
+            arena->ptr = (byte *) nb->va;
+            arena->end = arena->ptr + nb->size;
+            return 0;
+        }
+    }
+
+    /* extend blocks if full */
+    if (unlikely(arena->num_blocks == arena->maxn_blocks)) {
+        blocks = (nvmm_block **) realloc(arena->blocks,
+                                         sizeof(nvmm_block *) * arena->maxn_blocks * 2);
+        if (unlikely(isNull(blocks))) {
+            set_msg("arena_next_block::realloc(blocks)");
+            exit_perror(errno);
+        }
+        arena->blocks = blocks;
+        arena->maxn_blocks *= 2;
+    }
+
+    /* acquire new block */
+    heap_lock(arena->heap);
+    nb = acquire_nvmm_block(arena->heap,
+                            (size > arena->blocksize) ? size : arena->blocksize,
+                            arena->flags);
+    heap_unlock(arena->heap);
+    if (unlikely(isNull(nb))) {
+        /* keep current block */
+        arena->cur = cur;
+        return -1;
+    }
+    if (unlikely(opt_heapprof_rate > 0))
+        prof_alloc(nb->va, nb->size, 0);
+    arena->blocks[arena->num_blocks] = nb;
+    arena->cur = arena->num_blocks++;
+    arena->ptr = (byte *) nb->va;
+    arena->end = arena->ptr + nb->size;
+
+    return 0;
+}
+
+
+/**
+ * Allocate region from arena (bump pointer)
+ * region from arena must not be passed to NVMM_Free/NVMM_Realloc
+ *
+ * @param arena
+ *            target arena
+ * @param size
+ *            size of region
+ *
+ * @return pointer to allocated region (NULL if exhausted and NVMM_OOM_NULL)
+ *
+ */
+void *
+NVMM_ArenaMalloc(nvmm_arena *arena, size_t size)
+{
+    byte *ptr;
+
+    size = align_size(size, ARENA_ALIGN);
+
+    if (unlikely(size > (size_t) (arena->end - arena->ptr)) &&
+        unlikely(arena_next_block(arena, size) != 0))
+        return NULL;
+
+    ptr = arena->ptr;
+    arena->ptr += size;
+
+    if (unlikely(nonNull(arena->heap->wear_allocs)))
+        wear_alloc(arena->heap, ptr);
+
+    return ptr;
+}
+
+
+/**
+ * Release all regions from arena
+ * blocks are retained for following allocation
+ *
+ * @param arena
+ *            target arena
+ *
+ * @return none
+ *
+ */
+void
+NVMM_ArenaReset(nvmm_arena *arena)
+{
+    arena->cur = -1;
+    arena->ptr = NULL;
+    arena->end = NULL;
+
+    return;
+}
+
+
+/**
+ * Destroy arena and return all blocks to heap
+ *
+ * @param arena
+ *            target arena
+ *
+ * @return none
+ *
+ */
+void
+NVMM_ArenaDestroy(nvmm_arena *arena)
+{
+    int i;
+
+    if (isNull(arena))
+        return;
+
+    if (likely(is_finalized == 0)) {
+        if (unlikely(opt_heapprof_rate > 0)) {
+            for (i = 0; i < arena->num_blocks; ++i)
+                prof_free(arena->blocks[i]->va);
+        }
+
+        heap_lock(arena->heap);
+        for (i = 0; i < arena->num_blocks; ++i)
+            release_nvmm_block(arena->blocks[i]);
+        heap_unlock(arena->heap);
+    }
+
+    free(arena->blocks);
+    free(arena);
+
+    return;
+}
+
+
+/**
+ * Write back cache lines in [va_base, va_base + size) to NVMM
+ * wbmod issues DSB before and after DCCMVACs
+ * (do nothing for emulation)
+ *
+ * @param va_base
+ *            start address
+ * @param size
+ *            bytes to be written back
+ *
+ * @return none
+ *
+ */
+void
+NVMM_FlushRange(void *va_base, size_t size)
+{
+#if defined(ZC706)
+    flush_range range = { (unsigned long) va_base, size };
+    ioctl(fd_wbmod, WBMOD_DCCMVAC_RANGE, &range);
+#endif /* ZC706 */
+    if (unlikely(nonNull((void *) opt_wear)))
+        wear_flush(va_base, size);
+    if (unlikely(nonNull((void *) opt_pmcheck)))
+        pm_flush(va_base, size, 1, (byte *) __builtin_return_address(0) - 1);
+#if defined(NVMM_CRASHSIM)
+    crash_flush(va_base, size, 1);
+#endif
+    return;
+}
+
+
+/**
+ * Same as NVMM_FlushRange, but without DSB
+ * (ordering must be ensured by NVMM_Fence)
+ *
+ * @param va_base
+ *            start address
+ * @param size
+ *            bytes to be written back
+ *
+ * @return none
+ *
+ */
+void
+NVMM_FlushRangeRelax(void *va_base, size_t size)
+{
+#if defined(ZC706)
+    flush_range range = { (unsigned long) va_base, size };
+    ioctl(fd_wbmod, WBMOD_DCCMVAC_RANGE_RELAX, &range);
+#endif /* ZC706 */
+    if (unlikely(nonNull((void *) opt_wear)))
+        wear_flush(va_base, size);
+    if (unlikely(nonNull((void *) opt_pmcheck)))
+        pm_flush(va_base, size, 0, (byte *) __builtin_return_address(0) - 1);
+#if defined(NVMM_CRASHSIM)
+    crash_flush(va_base, size, 0);
+#endif
+    return;
+}
+
+
+/**
+ * Wait for completion of preceding NVMM_FlushRangeRelax
+ * (DSB on ARM, full memory barrier on others)
+ *
+ * @param none
+ *
+ * @return none
+ *
+ */
+void
+NVMM_Fence()
+{
+#if defined(__arm__)
+    __asm__ __volatile__ ("dsb sy" : : : "memory");
+#else
+    __sync_synchronize();
+#endif
+#if defined(NVMM_CRASHSIM)
+    crash_fence();
+#endif
+    if (unlikely(nonNull((void *) opt_pmcheck)))
+        pm_fence();
+    return;
+}
+
 
-    /* try to merge nvmm_region */
-    merge_nvmm_region(nr);
+/*
+ ********** Streaming copy **********
+ */
 
-    /* all done */
-    return;
-}
+/* bytes copied between write backs (fits in L1 of Cortex-A9) */
+#define STREAM_CHUNK (16*KiB)
+
+/* shorter copy is done by memcpy/memset (streaming stores are slower for it) */
+#define STREAM_MIN (4*KiB)
 
 
 /**
- * Return index in nvmm_block_table
- * nvmm_block_table[idx] has enough region for size
+ * Copy n bytes by streaming (non-temporal) stores if available
+ * x86: SSE2 non-temporal stores (MOVNTDQ), which bypass cache
+ * ARM: NEON 64 B block copy (ARMv7 has no non-temporal store,
+ *      so lines are written back by caller per chunk)
  *
- * @param size
- *            allocation size
+ * @param dst
+ *            destination
+ * @param src
+ *            source
+ * @param n
+ *            bytes
  *
- * @return index in nvmm_block_table
+ * @return none
  *
  */
-static inline int
-get_nbt_idx(size_t size)
+static inline void
+stream_copy(byte *dst, const byte *src, size_t n)
 {
-
-    int left, right, mid;
-
-    /* quick sort nvmm_block_table by free */
-    if (!sorted_by_free) {
-        qsort(nvmm_block_table, num_nvmm_block, sizeof(nvmm_block *), cmp_by_free);
-        sorted_by_free = 1;
+#if defined(__SSE2__)
+    size_t head;
+
+    /* align dst by 16 B (n may be shorter than head) */
+    head = (16 - ((addr_t) dst & 15)) & 15;
+    if (head > n)
+        head = n;
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    n   -= head;
+
+    for (; n >= 64; dst += 64, src += 64, n -= 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (src +  0));
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *) (src + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *) (src + 48));
+        _mm_stream_si128((__m128i *) (dst +  0), a);
+        _mm_stream_si128((__m128i *) (dst + 16), b);
+        _mm_stream_si128((__m128i *) (dst + 32), c);
+        _mm_stream_si128((__m128i *) (dst + 48), d);
     }
-
-    /* binary search */
-    left = 0;
-    right = num_nvmm_block - 1;
-    while(left != right) {
-        mid = (left + right) / 2;
-        if (nvmm_block_table[mid]->free <= size)
-            return mid; //right = mid;
-        else
-            left = mid + 1;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; n >= 64; dst += 64, src += 64, n -= 64) {
+        uint8x16_t a = vld1q_u8(src +  0);
+        uint8x16_t b = vld1q_u8(src + 16);
+        uint8x16_t c = vld1q_u8(src + 32);
+        uint8x16_t d = vld1q_u8(src + 48);
+        vst1q_u8(dst +  0, a);
+        vst1q_u8(dst + 16, b);
+        vst1q_u8(dst + 32, c);
+        vst1q_u8(dst + 48, d);
     }
+#endif
 
-    return left;
+    memcpy(dst, src, n);
+    return;
 }
 
 
 /**
- * Initialize nb_list
+ * Fill n bytes with c by streaming (non-temporal) stores if available
+ * (same as stream_copy)
  *
- * @param none
+ * @param dst
+ *            destination
+ * @param c
+ *            value
+ * @param n
+ *            bytes
  *
  * @return none
  *
  */
 static inline void
-initialize_nvmmlib()
+stream_set(byte *dst, int c, size_t n)
 {
-    nvmm_block *nb;
-
-    /* clear */
-    num_nvmm_block = 0;
+#if defined(__SSE2__)
+    __m128i v = _mm_set1_epi8((char) c);
+    size_t head;
+
+    /* align dst by 16 B (n may be shorter than head) */
+    head = (16 - ((addr_t) dst & 15)) & 15;
+    if (head > n)
+        head = n;
+    memset(dst, c, head);
+    dst += head;
+    n   -= head;
+
+    for (; n >= 64; dst += 64, n -= 64) {
+        _mm_stream_si128((__m128i *) (dst +  0), v);
+        _mm_stream_si128((__m128i *) (dst + 16), v);
+        _mm_stream_si128((__m128i *) (dst + 32), v);
+        _mm_stream_si128((__m128i *) (dst + 48), v);
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    uint8x16_t v = vdupq_n_u8((uint8_t) c);
+
+    for (; n >= 64; dst += 64, n -= 64) {
+        vst1q_u8(dst +  0, v);
+        vst1q_u8(dst + 16, v);
+        vst1q_u8(dst + 32, v);
+        vst1q_u8(dst + 48, v);
+    }
+#endif
 
-    nb = alloc_nvmm_block();
-    nb->pa   = NVMM_BEGIN;
-    nb->va   = NULL;
-    nb->size = 0;
-    nb->free = 1 * GiB;
-    nb->nr   = NULL;
+    memset(dst, c, n);
+    return;
+}
 
-    /* set cache */
-    nbb = nb;
 
-    /* no nvmm_region in pool */
-    nvmm_region_pool = NULL;
+/**
+ * Copy n bytes to NVMM, and write back dst without DSB
+ * (data is copied and written back per STREAM_CHUNK, so cache is not filled
+ *  with dst, ordering must be ensured by NVMM_Fence)
+ *
+ * @param dst
+ *            destination (NVMM)
+ * @param src
+ *            source
+ * @param n
+ *            bytes
+ *
+ * @return dst
+ *
+ */
+void *
+NVMM_Memcpy(void *dst, const void *src, size_t n)
+{
+    byte *d = (byte *) dst;
+    const byte *s = (const byte *) src;
+    size_t len;
+
+    if (n < STREAM_MIN) {
+        memcpy(d, s, n);
+        NVMM_FlushRangeRelax(d, n);
+        return dst;
+    }
 
-    /* nvmm_region_table is not sorted by free */
-    sorted_by_free = 0;
+    for (; n > 0; d += len, s += len, n -= len) {
+        len = (n < STREAM_CHUNK) ? n : STREAM_CHUNK;
+        stream_copy(d, s, len);
+        NVMM_FlushRangeRelax(d, len);
+    }
 
-    return;
+    return dst;
 }
 
 
 /**
- * Finalize nvmmlib
+ * Fill n bytes of NVMM with c, and write back dst without DSB
+ * (same as NVMM_Memcpy)
  *
- * @param none
+ * @param dst
+ *            destination (NVMM)
+ * @param c
+ *            value
+ * @param n
+ *            bytes
  *
- * @return none
+ * @return dst
  *
  */
-static inline void
-finalize_nvmmlib()
+void *
+NVMM_Memset(void *dst, int c, size_t n)
 {
-    nvmm_region *nr, *nrn;
-    int i;
+    byte *d = (byte *) dst;
+    size_t len;
 
-    /* free all allocated nvmm_block */
-    for (i = 0; i < num_nvmm_block; ++i)
-        del_nvmm_block(nvmm_block_table[i]);
+    if (n < STREAM_MIN) {
+        memset(d, c, n);
+        NVMM_FlushRangeRelax(d, n);
+        return dst;
+    }
 
-    /* free all pooled nvmm_region */
-    for (nr = nvmm_region_pool; nr != NULL; nr = nrn) {
-        nrn = nr->next;
-        free(nr);
+    for (; n > 0; d += len, n -= len) {
+        len = (n < STREAM_CHUNK) ? n : STREAM_CHUNK;
+        stream_set(d, c, len);
+        NVMM_FlushRangeRelax(d, len);
     }
 
-    return;
+    return dst;
 }
 
 
 /**
- * Initialize nvmmlib
+ * Copy n bytes to NVMM, and wait for completion of write back
+ * (NVMM_Memcpy and NVMM_Fence)
  *
- * @param none
+ * @param dst
+ *            destination (NVMM)
+ * @param src
+ *            source
+ * @param n
+ *            bytes
+ *
+ * @return dst
+ *
+ */
+void *
+NVMM_MemcpyPersist(void *dst, const void *src, size_t n)
+{
+    NVMM_Memcpy(dst, src, n);
+    NVMM_Fence();
+
+    return dst;
+}
+
+
+/**
+ * Write heatmap of wear (flushed cache lines and allocations per page)
+ * to file, if NVMM_WEAR is set.  "-" is stderr
+ * (also called at finalize with path of NVMM_WEAR)
+ *
+ * @param path
+ *            output file
  *
  * @return none
  *
  */
-__attribute__((constructor))
 void
-NVMM_Initialize()
+NVMM_WearDump(const char *path)
 {
-    /* if nvmmlib has been initialized already, do nothing */
-    if (likely(is_initialized != 0))
-        return;
+    FILE *fp;
 
-#if defined(ZC706)
-    fd_devmem   = open("/dev/mem", O_RDWR);          /* cacheable */
-    fd_devmem_s = open("/dev/mem", O_RDWR | O_SYNC); /* non-cacheable */
-    if (unlikely(fd_devmem == -1 || fd_devmem_s == -1)) {
-        set_msg("NVMM_Initialize::open(/dev/mem)");
-        exit_perror(errno);
-    }
+    if (isNull((void *) opt_wear))
+        return;
 
-    fd_wbmod = open("/dev/wbmod", O_RDWR);
-    if (unlikely(fd_wbmod == -1)) {
-        set_msg("NVMM_Initialize::open(/dev/wbmod)");
-        exit_perror(errno);
+    if (strcmp(path, "-") == 0) {
+        fp = stderr;
+    } else {
+        fp = fopen(path, "w");
+        if (unlikely(isNull(fp))) {
+            set_msg("NVMM_WearDump::fopen(%s)", path);
+            exit_perror(errno);
+        }
     }
-#endif /* ZC706 */
 
-    /* initialize free list */
-    initialize_nvmmlib();
+    table_lock();
+    dump_wear(fp);
+    table_unlock();
 
-    /* set initalized flag */
-    is_initialized++;
+    if (fp != stderr)
+        fclose(fp);
 
     return;
 }
 
 
 /**
- * Finalize nvmmlib
+ * Write report of persistence check (redundant/unfenced flushes and
+ * unflushed lines per site) to file, if NVMM_PMCHECK is set.  "-" is stderr
+ * (also called at finalize with path of NVMM_PMCHECK)
  *
- * @param none
+ * @param path
+ *            output file
  *
  * @return none
  *
  */
-__attribute__((destructor))
 void
-NVMM_Finalize()
+NVMM_PmCheckDump(const char *path)
 {
-    /* if nvmlib has been finalized already, do nothing */
-    if (unlikely(is_finalized != 0))
+    FILE *fp;
+
+    if (isNull((void *) opt_pmcheck))
         return;
 
-#if defined(ZC706)
-    close(fd_devmem);
-    close(fd_devmem_s);
-    close(fd_wbmod);
-#endif /* ZC706 */
+    if (strcmp(path, "-") == 0) {
+        fp = stderr;
+    } else {
+        fp = fopen(path, "w");
+        if (unlikely(isNull(fp))) {
+            set_msg("NVMM_PmCheckDump::fopen(%s)", path);
+            exit_perror(errno);
+        }
+    }
 
-    /* clean all free list */
-    finalize_nvmmlib();
+    table_lock();
+    pm_lock();
+    dump_pmcheck(fp);
+    pm_unlock();
+    table_unlock();
 
-    /* set finalized flag */
-    is_finalized++;
+    if (fp != stderr)
+        fclose(fp);
 
     return;
 }
 
 
 /**
- * Allocate NVMM
+ * Write heap profile (live and total bytes per allocation site) to file,
+ * if NVMM_HEAPPROF is set.  "-" is stderr
+ * (also called at finalize with path of NVMM_HEAPPROF, and at allocation
+ *  after SIGUSR2 with NULL)
  *
- * @param size
- *            size of region
+ * @param path
+ *            output file (NULL is NVMM_HEAPPROF with sequence number)
  *
- * @return pointer to allocated region
+ * @return none
  *
  */
-void *
-NVMM_Malloc(size_t size)
+void
+NVMM_HeapProfDump(const char *path)
 {
-    void *ptr;
-    byte merged;
-    int idx;
-
-    /* to allocate NVMM, nvmmlib must be initialized */
-    NVMM_Initialize();
-
-    /* 4-byte alignment */
-    /* to use vector (NEON), pointer must be aligned by 4 */
-    size = align_size(size, 4);
-
-    /* try to allocate from previous used nvmm_block */
-    ptr = NULL;
-    if (nonNull(nbb) && size <= nbb->free)
-        ptr = new_nvmm_region(nbb, size);
+    char name[512];
+    FILE *fp;
 
-    merged = 0;
-    if (isNull(ptr))
-        idx = get_nbt_idx(size);
+    if (opt_heapprof_rate == 0)
+        return;
 
-    while(isNull(ptr)) {
-        /* look for enough block */
-        for (; idx < num_nvmm_block; ++idx) {
-            if (size <= nvmm_block_table[idx]->free)
-                break;
+    if (isNull((void *) path)) {
+        path = opt_heapprof;
+        if (strcmp(path, "-") != 0) {
+            snprintf(name, sizeof(name), "%s.%d", opt_heapprof,
+                     __atomic_add_fetch(&prof_ndump, 1, __ATOMIC_RELAXED));
+            path = name;
         }
+    }
 
-        /* if search is failed */
-        if (idx == num_nvmm_block) {
-            if (!merged) {
-                /* if have not merged, try merge and retry */
-                merge_nvmm_block();
-                ++merged;
-                idx = get_nbt_idx(size);
-                continue;
-            } else {
-                /* if try merge and failed to search again, exhausted. */
-                set_msg("NVMM_Malloc::No Available NVMM\n");
-                exit_stderr();
-            }
+    if (strcmp(path, "-") == 0) {
+        fp = stderr;
+    } else {
+        fp = fopen(path, "w");
+        if (unlikely(isNull(fp))) {
+            set_msg("NVMM_HeapProfDump::fopen(%.64s)", path);
+            exit_perror(errno);
         }
-
-        /* try to allocate region */
-        ptr = new_nvmm_region(nvmm_block_table[idx], size);
-
-        ++idx;
     }
 
+    prof_lock();
+    if (opt_heapprof_folded)
+        dump_heapprof_folded(fp);
+    else
+        dump_heapprof_pprof(fp);
+    prof_unlock();
+
+    if (fp != stderr)
+        fclose(fp);
 
-    return ptr;
+    return;
 }
 
 
 /**
- * Allocate NVMM and ZERO-fill
+ * Get statistics of heap (mapped/used/free bytes, free extents and
+ * fragmentation)
  *
- * @param nmemb
- *            number of elements
- * @param size
- *            bytes per elements
+ * @param heap
+ *            target heap (NULL is default heap)
+ * @param stats
+ *            statistics (output)
  *
- * @return pointer to allocated region
+ * @return none
  *
  */
-void *
-NVMM_Calloc(size_t nmemb, size_t size)
+void
+NVMM_GetStats(nvmm_heap *heap, nvmm_stats *stats)
 {
-    void *retptr = NVMM_Malloc(nmemb * size);
-    memset(retptr, 0, nmemb * size);
+    NVMM_Initialize();
 
-    return retptr;
+    if (isNull(heap))
+        heap = nvmm_heap_table[0];
+
+    heap_lock(heap);
+    heap_stats(heap, stats);
+    heap_unlock(heap);
+
+    return;
 }
 
 
 /**
- * Reallocate ptr with given size
+ * Write statistics and nvmm_blocks of all heaps to file.  "-" is stderr
+ * (also written to NVMM_HEAPSTAT at finalize and every NVMM_HEAPSTAT_MS)
  *
- * @param ptr
- *            original ptr
- * @param size
- *            bytes for new allocation
+ * @param path
+ *            output file
  *
- * @return pointer to reallocated region
+ * @return none
  *
  */
-void *
-NVMM_Realloc(void *ptr, size_t size)
+void
+NVMM_DumpHeap(const char *path)
 {
-    void *oldptr, *newptr;
-    int oldsize, newsize;
-
-    /* if ptr is NULL, work as NVMM_Malloc() */
-    if (unlikely(isNull(ptr)))
-        return NVMM_Malloc(size);
-
-    /* Get size */
-    oldsize = get_alloc_size(ptr);
-    newsize = size;
-
-    /* check ptr is valid or not */
-    if (unlikely(oldsize <= 0)) {
-        set_msg("NVMM_Realloc::Invalid pointer(%p)\n", ptr);
-        exit_stderr();
-    }
-
-    /* if oldptr is enough for size, do nothing */
-    if (unlikely(oldsize > newsize)) {
-        return ptr;
-    }
+    FILE *fp;
 
-    /* Set oldptr, newptr */
-    oldptr = ptr;
-    newptr = NVMM_Malloc(size);
+    NVMM_Initialize();
 
-    /* if can't allocate newptr, return NULL */
-    if (unlikely(isNull(newptr))) {
-        return NULL;
+    if (strcmp(path, "-") == 0) {
+        fp = stderr;
+    } else {
+        fp = fopen(path, "w");
+        if (unlikely(isNull(fp))) {
+            set_msg("NVMM_DumpHeap::fopen(%.64s)", path);
+            exit_perror(errno);
+        }
     }
 
-    /* Copy from oldptr to newptr */
-    memcpy(newptr, oldptr, oldsize);
+    dump_heaps(fp);
 
-    /* Free oldptr */
-    NVMM_Free(oldptr);
+    if (fp != stderr)
+        fclose(fp);
 
-    return newptr;
+    return;
 }
 
 
+#if defined(NVMM_CRASHSIM)
 /**
- * Free NVMM region
+ * Simulate power failure now: contents of all mapped nvmm_blocks are
+ * replaced with persisted image (lines written back and fenced)
  *
- * @param ptr
- *            pointer to region
+ * @param seed
+ *            seed of random choices (0 is fixed default)
+ * @param flags
+ *            NVMM_CRASH_REORDER: any subset of unfenced lines is persisted
+ *            NVMM_CRASH_EVICT:   any subset of dirty lines is persisted
  *
  * @return none
  *
  */
 void
-NVMM_Free(void *ptr)
+NVMM_CrashSimulate(unsigned int seed, int flags)
 {
-    if (unlikely(isNull(ptr)))
-        return;
-
-    if (likely(is_finalized == 0))
-        free_nvmm_region(ptr);
+    crash_lock();
+    crash_materialize(seed, flags);
+    crash_unlock();
 
     return;
 }
 
 
+/**
+ * Arm simulated power failure at n-th NVMM_FlushRange/FlushRangeRelax/Fence
+ * from now.  At that point (before the flush or fence takes effect),
+ * NVMM_CrashSimulate(seed, flags) is done and handler(arg) is called
+ * (typically longjmp() to recovery code)
+ *
+ * @param n
+ *            number of events from now (0 disarms)
+ * @param seed
+ *            seed of random choices
+ * @param flags
+ *            same as NVMM_CrashSimulate
+ * @param handler
+ *            called after crash (NULL continues execution)
+ * @param arg
+ *            argument of handler
+ *
+ * @return none
+ *
+ */
 void
-NVMM_FlushRange(void *va_base, size_t size)
+NVMM_CrashPoint(long n, unsigned int seed, int flags, void (*handler)(void *), void *arg)
 {
-    flush_range range = { (unsigned long) va_base, size };
-    ioctl(fd_wbmod, WBMOD_DCCMVAC_RANGE, &range);
+    crash_lock();
+    crash_point   = (n > 0) ? crash_events + n : 0;
+    crash_seed    = seed;
+    crash_flags   = flags;
+    crash_handler = handler;
+    crash_arg     = arg;
+    crash_unlock();
+
     return;
 }
 
-void
-NVMM_FlushRangeRelax(void *va_base, size_t size)
+
+/**
+ * Return number of NVMM_FlushRange/FlushRangeRelax/Fence so far
+ *
+ * @param none
+ *
+ * @return number of events
+ *
+ */
+long
+NVMM_CrashEvents()
 {
-    flush_range range = { (unsigned long) va_base, size };
-    ioctl(fd_wbmod, WBMOD_DCCMVAC_RANGE_RELAX, &range);
-    return;
-}
+    long n;
 
+    crash_lock();
+    n = crash_events;
+    crash_unlock();
+
+    return n;
+}
+#endif /* NVMM_CRASHSIM */
 
 /*
  ********** Memory Request **********
@@ -1263,6 +6362,13 @@ set_memreq(memreq *req, int is_end)
 void
 NVMM_StartRequestStat(memreq *start)
 {
+#if !defined(ZC706)
+    /* no counter for emulation */
+    memset(start, 0, sizeof(memreq));
+    start->clock = clock();
+    return;
+#endif /* !ZC706 */
+
     /* if open() and mmap() has not been called, call */
     if (isNull(mrr_base)) {
         mrr_base = (byte *) mmap(0, 4 * KiB, PROT_READ | PROT_WRITE, MAP_SHARED,
@@ -1293,6 +6399,12 @@ NVMM_StartRequestStat(memreq *start)
 void
 NVMM_EndRequestStat(memreq *end)
 {
+#if !defined(ZC706)
+    memset(end, 0, sizeof(memreq));
+    end->clock = clock();
+    return;
+#endif /* !ZC706 */
+
     set_memreq(end, 1);
     return;
 }
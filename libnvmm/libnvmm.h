@@ -41,24 +41,149 @@ typedef struct _memreq {
     clock_t clock;
 } memreq;
 
+/* mapping attributes (flags of NVMM_MallocEx) */
+#define NVMM_ATTR_CACHED   (0x0) /* cacheable, write-allocate (default) */
+#define NVMM_ATTR_WC       (0x1) /* write-combining (bufferable, non-cacheable) */
+#define NVMM_ATTR_UNCACHED (0x2) /* non-cacheable (strongly-ordered) */
+#define NVMM_ATTR_MASK     (0x3)
+#define NVMM_NATTR         (3)   /* number of attribute classes */
+
+/* allocation flags (flags of NVMM_MallocEx, ORed with NVMM_ATTR_*) */
+#define NVMM_PREFAULT      (0x4) /* prefault new block (MAP_POPULATE) */
+#define NVMM_FLAGS_MASK    (NVMM_ATTR_MASK | NVMM_PREFAULT)
+
+/* crash simulation flags (flags of NVMM_CrashSimulate, NVMM_CRASHSIM only) */
+#define NVMM_CRASH_REORDER (0x1) /* persist random subset of unfenced flushes */
+#define NVMM_CRASH_EVICT   (0x2) /* persist random subset of dirty lines */
+
+/* allocator instance for one physical window of NVMM */
+typedef struct _nvmm_heap nvmm_heap;
+#define NVMM_MAXN_HEAP (8) /* maximum number of heaps */
+
+/* bump-pointer allocator with bulk free */
+typedef struct _nvmm_arena nvmm_arena;
+
+/* behavior on exhaustion of NVMM (NVMM_SetOomMode) */
+#define NVMM_OOM_ABORT (0) /* report state of heap and exit (default) */
+#define NVMM_OOM_NULL  (1) /* return NULL with errno = ENOMEM */
+
+/* callback to free NVMM on exhaustion, returns non-zero if freed (NVMM_SetReclaim) */
+typedef int (*nvmm_reclaim_fn)(nvmm_heap *heap, size_t size, void *arg);
+
+/* state of heap (NVMM_GetStats), bytes of region/extent include region header */
+#define NVMM_STATS_NHIST (32) /* size classes of free extents */
+typedef struct _nvmm_stats {
+    size_t window;           /* bytes of window */
+    size_t mapped;           /* bytes of mapped blocks */
+    size_t used;             /* bytes of allocated regions and arena blocks */
+    size_t free;             /* free bytes in mapped blocks */
+    size_t retained;         /* bytes of fully free mapped blocks */
+    size_t unmapped;         /* bytes of window not mapped */
+    size_t largest_free;     /* largest free extent in mapped blocks */
+    size_t largest_unmapped; /* largest contiguous not mapped extent */
+    size_t blocks;           /* mapped blocks */
+    size_t arena_blocks;     /* blocks acquired by arenas */
+    size_t regions;          /* allocated regions */
+    size_t free_extents;     /* free extents in mapped blocks */
+    size_t meta_nvmm;        /* bytes of region headers in NVMM */
+    size_t meta_dram;        /* bytes of allocator metadata in DRAM */
+    double frag;             /* external fragmentation, 1 - largest / (free + unmapped) */
+    size_t hist[NVMM_STATS_NHIST]; /* free extents in [2^i, 2^(i+1)) bytes */
+} nvmm_stats;
+
+/*
+ * persistent pointer (position-independent, valid after remap)
+ * heap id + 1 (upper 16 bits) and offset in window (lower 48 bits), 0 is NULL
+ * va = nvmm_pptr_bias[heap id + 1] + pptr, so translation is one add
+ * if bias is cached (NVMM_PPTR_AT)
+ */
+typedef uint64_t nvmm_pptr;
+#define NVMM_PPTR_NULL        ((nvmm_pptr) 0)
+#define NVMM_PPTR_SHIFT       (48)
+#define NVMM_PPTR_ID(p)       ((int) ((p) >> NVMM_PPTR_SHIFT) - 1)
+#define NVMM_PPTR_OFF(p)      ((p) & ((1ULL << NVMM_PPTR_SHIFT) - 1))
+#define NVMM_PPTR_BIAS(p)     (nvmm_pptr_bias[(p) >> NVMM_PPTR_SHIFT])
+#define NVMM_PPTR_AT(bias, p) ((void *) (uintptr_t) ((bias) + (p)))
+#define NVMM_PPTR_GET(p)      NVMM_PPTR_AT(NVMM_PPTR_BIAS(p), (p))
+
 
 #if defined(__cplusplus)
 extern "C" {
 #endif
+extern uint64_t nvmm_pptr_bias[NVMM_MAXN_HEAP + 1];
 void  NVMM_Initialize();
 void  NVMM_Finalize();
 void *NVMM_Malloc(size_t size);
+void *NVMM_MallocEx(size_t size, int flags);
+void *NVMM_MallocAligned(size_t size, size_t align, size_t offset);
+void *NVMM_MallocSpread(size_t size);
+void *NVMM_MallocNear(void *hint, size_t size);
+unsigned long NVMM_GetPhysAddr(void *ptr);
+int   NVMM_GetBank(void *ptr);
+nvmm_pptr NVMM_PPtr(void *ptr);
+nvmm_heap *NVMM_HeapCreate(unsigned long pa, size_t size);
+void  NVMM_HeapDestroy(nvmm_heap *heap);
+nvmm_heap *NVMM_GetHeap(int id);
+void *NVMM_HeapMalloc(nvmm_heap *heap, size_t size, int flags);
+void  NVMM_HeapReserve(nvmm_heap *heap, size_t size);
+int   NVMM_SetOomMode(int mode);
+void  NVMM_SetReclaim(nvmm_reclaim_fn fn, void *arg);
+nvmm_arena *NVMM_ArenaCreate(nvmm_heap *heap, size_t blocksize, int flags);
+void *NVMM_ArenaMalloc(nvmm_arena *arena, size_t size);
+void  NVMM_ArenaReset(nvmm_arena *arena);
+void  NVMM_ArenaDestroy(nvmm_arena *arena);
 void *NVMM_Calloc(size_t nmemb, size_t size);
+size_t NVMM_Prezero(nvmm_heap *heap, size_t bytes);
 void *NVMM_Realloc(void *ptr, size_t size);
 void  NVMM_Free(void *ptr);
 void  NVMM_FlushRange(void *va_base, size_t bytes);
 void  NVMM_FlushRangeRelax(void *va_base, size_t bytes);
+void  NVMM_Fence();
+void *NVMM_Memcpy(void *dst, const void *src, size_t n);
+void *NVMM_Memset(void *dst, int c, size_t n);
+void *NVMM_MemcpyPersist(void *dst, const void *src, size_t n);
+void  NVMM_WearDump(const char *path);
+void  NVMM_PmCheckDump(const char *path);
+void  NVMM_HeapProfDump(const char *path);
+void  NVMM_GetStats(nvmm_heap *heap, nvmm_stats *stats);
+void  NVMM_DumpHeap(const char *path);
 void  NVMM_StartRequestStat(memreq *start);
 void  NVMM_EndRequestStat(memreq *start);
+#if defined(NVMM_CRASHSIM)
+void  NVMM_CrashSimulate(unsigned int seed, int flags);
+void  NVMM_CrashPoint(long n, unsigned int seed, int flags, void (*handler)(void *), void *arg);
+long  NVMM_CrashEvents();
+#endif
 #if defined(__cplusplus)
 }
 #endif
 
+#if defined(__cplusplus)
+/* typed persistent pointer (same layout as nvmm_pptr) */
+template <typename T>
+class nvmm_ptr {
+public:
+    nvmm_ptr() : p_(NVMM_PPTR_NULL) {}
+    nvmm_ptr(T *ptr) : p_(NVMM_PPtr(ptr)) {}
+
+    static nvmm_ptr from_raw(nvmm_pptr p) { nvmm_ptr r; r.p_ = p; return r; }
+    nvmm_pptr raw() const { return p_; }
+
+    T *get() const { return (T *) NVMM_PPTR_GET(p_); }
+    T *get(uint64_t bias) const { return (T *) NVMM_PPTR_AT(bias, p_); }
+    T &operator*() const { return *get(); }
+    T *operator->() const { return get(); }
+    T &operator[](size_t i) const { return get()[i]; }
+
+    bool isNull() const { return p_ == NVMM_PPTR_NULL; }
+    bool operator==(const nvmm_ptr &o) const { return p_ == o.p_; }
+    bool operator!=(const nvmm_ptr &o) const { return p_ != o.p_; }
+
+private:
+    nvmm_pptr p_;
+};
+#endif
+
 
 /******************** Flags *************************/
 /**
@@ -71,8 +196,35 @@ void  NVMM_EndRequestStat(memreq *start);
  *   If this flag is     defined, do DCCMVAC in NVM_FlashRange()
  *   If this flag is NOT defined, do NOTHING in NVM_FlashRange()
  *
+ * - NVMM_HUGEPAGE
+ *   If this flag is     defined, align nvmm_block by 2 MiB (pa & va) and
+ *   request transparent huge page (madvise) for emulation
+ *   If this flag is NOT defined, align nvmm_block by 4 KiB
+ *
+ * - NVMM_HUGETLB
+ *   If this flag is     defined, same as NVMM_HUGEPAGE but map nvmm_block
+ *   from hugetlbfs (MAP_HUGETLB) for emulation
+ *
+ * - NVMM_MT
+ *   If this flag is     defined, each heap is protected by pthread mutex
+ *   (link with -lpthread)
+ *   If this flag is NOT defined, libnvmm is NOT thread-safe
+ *
+ * - NVMM_CRASHSIM
+ *   If this flag is     defined, keep persisted image of NVMM (written back
+ *   and fenced lines) and enable NVMM_Crash* to simulate power failure
+ *   (emulation only, not with ZC706)
+ *
  */
 //#define ZC706         /* use NVMM */
+//#define NVMM_HUGEPAGE /* 2 MiB aligned nvmm_block */
+//#define NVMM_HUGETLB  /* 2 MiB aligned nvmm_block from hugetlbfs */
+//#define NVMM_MT       /* thread-safe */
+//#define NVMM_CRASHSIM /* simulated power failure */
+
+#if defined(ZC706) && defined(NVMM_CRASHSIM)
+#error "NVMM_CRASHSIM is for emulation only"
+#endif
 
 /* wbmod & mrr is enable on only ZC706 */
 #if !defined(ZC706)
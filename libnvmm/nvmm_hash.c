@@ -0,0 +1,823 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>     /* perror() */
+#include <stdlib.h>    /* malloc(), free() */
+#include <string.h>    /* memset() */
+#include <stdint.h>    /* uint32_t, uint64_t */
+#include <pthread.h>   /* pthread_mutex_* */
+
+#include "libnvmm.h"
+#include "nvmm_hash.h"
+
+#define HASH_MAGIC   (0x4E564D4D48534801ULL) /* "NVMMHSH" + version */
+#define LINE         (32)                    /* cache line */
+#define SLOTS        (2)                     /* slots per bucket */
+#define MIN_TOP      (4)                     /* min buckets of top level */
+#define MIGRATE_STEP (4)                     /* buckets migrated per insert */
+#define EMPTY        (0)                     /* key of empty slot */
+
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+/* bucket (persistent, one line) */
+typedef struct _slot {
+    uint64_t key;   /* committed by 8-byte store */
+    uint64_t val;
+} slot;
+
+typedef struct _bucket {
+    slot s[SLOTS];
+} bucket;
+
+/* levels (persistent, replaced at once by root->desc) */
+typedef struct _hash_desc {
+    nvmm_pptr top;    /* ntop buckets */
+    nvmm_pptr bottom; /* ntop / 2 buckets */
+    nvmm_pptr old;    /* ntop / 4 buckets under migration (or NULL) */
+    uint64_t ntop;
+} hash_desc;
+
+/* translated hash_desc (volatile) */
+typedef struct _levels {
+    hash_desc *desc;
+    bucket *top;
+    bucket *bottom;
+    bucket *old;
+    uint64_t ntop;
+} levels;
+
+/* root (persistent, one line) */
+typedef struct _hash_root {
+    uint64_t magic;
+    nvmm_pptr desc;
+    uint64_t migrate; /* next bucket of old to migrate */
+    uint64_t seed;
+} hash_root;
+
+/* handle of table (volatile) */
+struct _nvmm_hash {
+    hash_root *root;
+    pthread_mutex_t lock; /* writers */
+    uint32_t seq;         /* odd while items are moved (readers retry on miss) */
+    int depth;            /* nest of seq_begin */
+    size_t count;
+    void **retired;       /* levels and descs replaced (freed at close) */
+    size_t nretired, capretired;
+};
+
+
+/*
+ ********** Helper **********
+ */
+static inline uint64_t
+mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/* 2 hash values of key */
+static inline void
+hash2(hash_root *r, uint64_t key, uint64_t *h)
+{
+    h[0] = mix(key ^ r->seed);
+    h[1] = mix(key ^ ~r->seed);
+}
+
+static inline void
+persist(void *p, size_t size)
+{
+    NVMM_FlushRangeRelax(p, size);
+    NVMM_Fence();
+}
+
+static void *
+xmalloc(size_t size)
+{
+    void *p = malloc(size);
+
+    if (unlikely(p == NULL)) {
+        perror("NVMM_Hash::malloc");
+        exit(1);
+    }
+
+    return p;
+}
+
+/* zero-cleared level of n buckets */
+static bucket *
+new_level(uint64_t n)
+{
+    bucket *b;
+
+    b = (bucket *) NVMM_MallocAligned(sizeof(bucket) * n, LINE, 0);
+    memset(b, 0, sizeof(bucket) * n);
+    persist(b, sizeof(bucket) * n);
+
+    return b;
+}
+
+static hash_desc *
+new_desc(bucket *top, bucket *bottom, bucket *old, uint64_t ntop)
+{
+    hash_desc *d;
+
+    d = (hash_desc *) NVMM_MallocAligned(sizeof(hash_desc), LINE, 0);
+    d->top    = NVMM_PPtr(top);
+    d->bottom = NVMM_PPtr(bottom);
+    d->old    = NVMM_PPtr(old);
+    d->ntop   = ntop;
+    persist(d, sizeof(hash_desc));
+
+    return d;
+}
+
+/* current levels (persistent pointers are translated) */
+static inline void
+get_levels(hash_root *r, levels *lv)
+{
+    hash_desc *d;
+
+    d = (hash_desc *) NVMM_PPTR_GET(__atomic_load_n(&r->desc, __ATOMIC_ACQUIRE));
+    lv->desc   = d;
+    lv->top    = (bucket *) NVMM_PPTR_GET(d->top);
+    lv->bottom = (bucket *) NVMM_PPTR_GET(d->bottom);
+    lv->old    = (bucket *) NVMM_PPTR_GET(d->old);
+    lv->ntop   = d->ntop;
+}
+
+static inline void
+set_desc(hash_root *r, hash_desc *d)
+{
+    __atomic_store_n(&r->desc, NVMM_PPtr(d), __ATOMIC_RELEASE);
+    persist(r, sizeof(hash_root));
+}
+
+static void
+retire(nvmm_hash *hash, void *p)
+{
+    if (hash->nretired == hash->capretired) {
+        hash->capretired = (hash->capretired == 0) ? 16 : hash->capretired * 2;
+        hash->retired = (void **) realloc(hash->retired, sizeof(void *) * hash->capretired);
+        if (unlikely(hash->retired == NULL)) {
+            perror("NVMM_Hash::realloc");
+            exit(1);
+        }
+    }
+    hash->retired[hash->nretired++] = p;
+}
+
+/*
+ * readers see odd seq (or changed seq) and retry if key is not found,
+ * because an item may be in flight between buckets
+ */
+static inline void
+seq_begin(nvmm_hash *hash)
+{
+    if (hash->depth++ == 0)
+        __atomic_store_n(&hash->seq, hash->seq + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void
+seq_end(nvmm_hash *hash)
+{
+    if (--hash->depth == 0)
+        __atomic_store_n(&hash->seq, hash->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ ********** Bucket **********
+ */
+
+/*
+ * candidate buckets: [0,1] in top, [2,3] in bottom, [4,5] in old
+ * index in level of n buckets is h % n, so top buckets i and i + n / 2 share
+ * bottom bucket i, and current top keeps positions when it becomes bottom
+ */
+static inline int
+candidates(levels *d, const uint64_t *h, bucket **c)
+{
+    uint64_t mask = d->ntop - 1;
+
+    c[0] = &d->top[h[0] & mask];
+    c[1] = &d->top[h[1] & mask];
+    c[2] = &d->bottom[h[0] & (mask >> 1)];
+    c[3] = &d->bottom[h[1] & (mask >> 1)];
+    if (d->old == NULL)
+        return 4;
+
+    c[4] = &d->old[h[0] & (mask >> 2)];
+    c[5] = &d->old[h[1] & (mask >> 2)];
+    return 6;
+}
+
+/* slot of key in d (NULL if not found) */
+static slot *
+find_slot(levels *d, const uint64_t *h, uint64_t key)
+{
+    bucket *c[6];
+    int nc, i, j;
+
+    nc = candidates(d, h, c);
+    for (i = 0; i < nc; ++i) {
+        for (j = 0; j < SLOTS; ++j) {
+            if (__atomic_load_n(&c[i]->s[j].key, __ATOMIC_ACQUIRE) == key)
+                return &c[i]->s[j];
+        }
+    }
+
+    return NULL;
+}
+
+static inline slot *
+empty_slot(bucket *b)
+{
+    int j;
+
+    for (j = 0; j < SLOTS; ++j) {
+        if (b->s[j].key == EMPTY)
+            return &b->s[j];
+    }
+
+    return NULL;
+}
+
+/* write value, then commit by key (one line) */
+static inline void
+write_slot(bucket *b, slot *s, uint64_t key, uint64_t val)
+{
+    s->val = val;
+    __atomic_store_n(&s->key, key, __ATOMIC_RELEASE);
+    persist(b, sizeof(bucket));
+}
+
+static inline void
+erase_slot(slot *s)
+{
+    __atomic_store_n(&s->key, EMPTY, __ATOMIC_RELEASE);
+    persist(s, sizeof(uint64_t));
+}
+
+/**
+ * Move one item of b to its alternative bucket in the same level
+ *
+ * @param level
+ *            first bucket of level
+ * @param mask
+ *            index mask of level
+ *
+ * @return freed slot of b (NULL if no item can be moved)
+ *
+ */
+static slot *
+move_out(nvmm_hash *hash, bucket *level, uint64_t mask, bucket *b)
+{
+    uint64_t h[2];
+    bucket *a0, *a1, *alt;
+    slot *s, *e;
+    int j;
+
+    for (j = 0; j < SLOTS; ++j) {
+        s = &b->s[j];
+        hash2(hash->root, s->key, h);
+        a0  = &level[h[0] & mask];
+        a1  = &level[h[1] & mask];
+        alt = (a0 == b) ? a1 : a0;
+        if (alt == b || (e = empty_slot(alt)) == NULL)
+            continue;
+
+        /* copy, then erase (duplicate is removed by recovery) */
+        seq_begin(hash);
+        write_slot(alt, e, s->key, s->val);
+        erase_slot(s);
+        seq_end(hash);
+        return s;
+    }
+
+    return NULL;
+}
+
+/**
+ * Place new item in top or bottom level of d
+ * empty slot of top, bottom, then one movement in top, bottom
+ *
+ * @return 1 if placed, 0 if no space (resize is needed)
+ *
+ */
+static int
+place(nvmm_hash *hash, levels *d, const uint64_t *h, uint64_t key, uint64_t val)
+{
+    bucket *c[6];
+    slot *s;
+    int i;
+
+    candidates(d, h, c);
+    for (i = 0; i < 4; ++i) {
+        if ((s = empty_slot(c[i])) != NULL) {
+            write_slot(c[i], s, key, val);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < 4; ++i) {
+        s = (i < 2) ? move_out(hash, d->top, d->ntop - 1, c[i])
+                    : move_out(hash, d->bottom, (d->ntop - 1) >> 1, c[i]);
+        if (s != NULL) {
+            write_slot(c[i], s, key, val);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ ********** Resize **********
+ */
+
+/**
+ * Migrate up to n buckets of old level into top/bottom
+ * replace desc when migration is completed
+ *
+ * @return 1 if done or in progress, 0 if item of old cannot be placed
+ *         (item stays in old, table must be rebuilt)
+ *
+ */
+static int
+migrate(nvmm_hash *hash, uint64_t n)
+{
+    hash_root *r = hash->root;
+    levels d, cur;
+    uint64_t nold, h[2];
+    bucket *ob;
+    slot *s;
+    int j;
+
+    get_levels(r, &d);
+    if (d.old == NULL)
+        return 1;
+
+    /* destination is top/bottom only */
+    cur = d;
+    cur.old = NULL;
+
+    nold = d.ntop / 4;
+    for (; n > 0 && r->migrate < nold; --n) {
+        ob = &d.old[r->migrate];
+
+        seq_begin(hash);
+        for (j = 0; j < SLOTS; ++j) {
+            s = &ob->s[j];
+            if (s->key == EMPTY)
+                continue;
+
+            /* item may be copied already before crash */
+            hash2(r, s->key, h);
+            if (find_slot(&cur, h, s->key) == NULL && !place(hash, &cur, h, s->key, s->val)) {
+                seq_end(hash);
+                return 0;
+            }
+            erase_slot(s);
+        }
+        seq_end(hash);
+
+        r->migrate++;
+        persist(&r->migrate, sizeof(uint64_t));
+    }
+
+    if (r->migrate < nold)
+        return 1;
+
+    /* all done */
+    set_desc(r, new_desc(d.top, d.bottom, NULL, d.ntop));
+
+    retire(hash, d.old);
+    retire(hash, d.desc);
+    return 1;
+}
+
+/**
+ * Copy items of level (n buckets) into to
+ * items already in to are skipped (copy in upper level is the latest)
+ *
+ * @return 1 if copied, 0 if no space
+ *
+ */
+static int
+copy_level(nvmm_hash *hash, levels *to, bucket *level, uint64_t n)
+{
+    uint64_t h[2], i;
+    slot *s;
+    int j;
+
+    for (i = 0; i < n; ++i) {
+        for (j = 0; j < SLOTS; ++j) {
+            s = &level[i].s[j];
+            if (s->key == EMPTY)
+                continue;
+
+            hash2(hash->root, s->key, h);
+            if (find_slot(to, h, s->key) == NULL && !place(hash, to, h, s->key, s->val))
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Copy all items into new top (ntop) and bottom levels, and replace desc
+ * (ntop is doubled until all items are placed)
+ * table is intact until desc is replaced, so crash leaves current levels
+ *
+ * @return none
+ *
+ */
+static void
+rebuild(nvmm_hash *hash, uint64_t ntop)
+{
+    hash_root *r = hash->root;
+    levels d, nd;
+
+    get_levels(r, &d);
+
+    for (;; ntop *= 2) {
+        nd.top    = new_level(ntop);
+        nd.bottom = new_level(ntop / 2);
+        nd.old    = NULL;
+        nd.ntop   = ntop;
+
+        /* same order as find_slot */
+        if (copy_level(hash, &nd, d.top, d.ntop) &&
+            copy_level(hash, &nd, d.bottom, d.ntop / 2) &&
+            (d.old == NULL || copy_level(hash, &nd, d.old, d.ntop / 4)))
+            break;
+
+        NVMM_Free(nd.top);
+        NVMM_Free(nd.bottom);
+    }
+
+    seq_begin(hash);
+    set_desc(r, new_desc(nd.top, nd.bottom, NULL, ntop));
+    seq_end(hash);
+
+    retire(hash, d.top);
+    retire(hash, d.bottom);
+    if (d.old != NULL)
+        retire(hash, d.old);
+    retire(hash, d.desc);
+}
+
+/**
+ * Add new top level (2N), current top becomes bottom and current bottom
+ * becomes old (migrated by following inserts)
+ * if previous migration cannot be completed, table is rebuilt into 2N levels
+ *
+ * @return none
+ *
+ */
+static void
+grow(nvmm_hash *hash)
+{
+    hash_root *r = hash->root;
+    hash_desc *nd;
+    levels d;
+
+    /* previous resize must be done */
+    if (!migrate(hash, UINT64_MAX)) {
+        get_levels(r, &d);
+        rebuild(hash, d.ntop * 2);
+        return;
+    }
+
+    get_levels(r, &d);
+    nd = new_desc(new_level(d.ntop * 2), d.top, d.bottom, d.ntop * 2);
+
+    r->migrate = 0;
+    persist(&r->migrate, sizeof(uint64_t));
+
+    seq_begin(hash);
+    set_desc(r, nd);
+    seq_end(hash);
+
+    retire(hash, d.desc);
+}
+
+
+/*
+ ********** Table **********
+ */
+static nvmm_hash *
+new_handle(hash_root *r)
+{
+    nvmm_hash *hash;
+
+    hash = (nvmm_hash *) xmalloc(sizeof(nvmm_hash));
+    hash->root  = r;
+    hash->seq   = 0;
+    hash->depth = 0;
+    hash->count = 0;
+    hash->retired    = NULL;
+    hash->nretired   = 0;
+    hash->capretired = 0;
+    pthread_mutex_init(&hash->lock, NULL);
+
+    return hash;
+}
+
+/**
+ * Create empty table
+ *
+ * @param capacity
+ *            expected number of items (table grows beyond this)
+ *
+ * @return handle of table
+ *
+ */
+nvmm_hash *
+NVMM_HashCreate(size_t capacity)
+{
+    hash_root *r;
+    uint64_t ntop;
+
+    /* 3 * ntop slots in top and bottom */
+    ntop = MIN_TOP;
+    while (ntop * 3 < capacity)
+        ntop *= 2;
+
+    r = (hash_root *) NVMM_MallocAligned(sizeof(hash_root), LINE, 0);
+    r->desc    = NVMM_PPtr(new_desc(new_level(ntop), new_level(ntop / 2), NULL, ntop));
+    r->migrate = 0;
+    r->seed    = 0x2545F4914F6CDD1DULL;
+    r->magic   = HASH_MAGIC;
+    persist(r, sizeof(hash_root));
+
+    return new_handle(r);
+}
+
+/**
+ * Recover table from root (NVMM_HashRoot)
+ * items duplicated by interrupted move/migration are removed,
+ * and interrupted migration is continued by following inserts
+ *
+ * @param root
+ *            persistent root of table
+ *
+ * @return handle of table (NULL if root is not table)
+ *
+ */
+nvmm_hash *
+NVMM_HashRecover(void *root)
+{
+    hash_root *r = (hash_root *) root;
+    nvmm_hash *hash;
+    levels d;
+    bucket *level[3], *c[6];
+    uint64_t n[3], h[2], i;
+    slot *s;
+    int l, j, k, m, nc;
+
+    if (r->magic != HASH_MAGIC)
+        return NULL;
+
+    hash = new_handle(r);
+    get_levels(r, &d);
+
+    /* old level first, so copy in new level survives */
+    level[0] = d.old;    n[0] = d.ntop / 4;
+    level[1] = d.bottom; n[1] = d.ntop / 2;
+    level[2] = d.top;    n[2] = d.ntop;
+    for (l = 0; l < 3; ++l) {
+        if (level[l] == NULL)
+            continue;
+        for (i = 0; i < n[l]; ++i) {
+            for (j = 0; j < SLOTS; ++j) {
+                s = &level[l][i].s[j];
+                if (s->key == EMPTY)
+                    continue;
+
+                hash2(r, s->key, h);
+                nc = candidates(&d, h, c);
+                for (k = 0; k < nc; ++k) {
+                    for (m = 0; m < SLOTS; ++m) {
+                        if (&c[k]->s[m] != s && c[k]->s[m].key == s->key)
+                            break;
+                    }
+                    if (m < SLOTS)
+                        break;
+                }
+
+                if (k < nc)
+                    erase_slot(s);
+                else
+                    hash->count++;
+            }
+        }
+    }
+
+    return hash;
+}
+
+/* persistent root of table (pass to NVMM_HashRecover) */
+void *
+NVMM_HashRoot(nvmm_hash *hash)
+{
+    return hash->root;
+}
+
+/**
+ * Close handle of table (table in NVMM is kept)
+ *
+ * @return none
+ *
+ */
+void
+NVMM_HashClose(nvmm_hash *hash)
+{
+    size_t i;
+
+    for (i = 0; i < hash->nretired; ++i)
+        NVMM_Free(hash->retired[i]);
+    free(hash->retired);
+    pthread_mutex_destroy(&hash->lock);
+    free(hash);
+}
+
+/**
+ * Destroy table and free all levels
+ *
+ * @return none
+ *
+ */
+void
+NVMM_HashDestroy(nvmm_hash *hash)
+{
+    hash_root *r = hash->root;
+    levels d;
+
+    get_levels(r, &d);
+    r->magic = 0;
+    persist(r, sizeof(hash_root));
+
+    NVMM_Free(d.top);
+    NVMM_Free(d.bottom);
+    if (d.old != NULL)
+        NVMM_Free(d.old);
+    NVMM_Free(d.desc);
+    NVMM_Free(r);
+
+    NVMM_HashClose(hash);
+}
+
+/**
+ * Insert or update key (writers are serialized)
+ * each insert also migrates a few buckets of old level
+ *
+ * @param hash
+ *            target table
+ * @param key
+ *            key (not 0)
+ * @param val
+ *            value
+ *
+ * @return 1 if inserted, 0 if updated
+ *
+ */
+int
+NVMM_HashInsert(nvmm_hash *hash, uint64_t key, uint64_t val)
+{
+    uint64_t h[2];
+    levels d;
+    slot *s;
+
+    hash2(hash->root, key, h);
+
+    pthread_mutex_lock(&hash->lock);
+    if (!migrate(hash, MIGRATE_STEP))
+        grow(hash);
+
+    get_levels(hash->root, &d);
+    s = find_slot(&d, h, key);
+    if (s != NULL) {
+        __atomic_store_n(&s->val, val, __ATOMIC_RELEASE);
+        persist(&s->val, sizeof(uint64_t));
+        pthread_mutex_unlock(&hash->lock);
+        return 0;
+    }
+
+    while (!place(hash, &d, h, key, val)) {
+        grow(hash);
+        get_levels(hash->root, &d);
+    }
+    hash->count++;
+
+    pthread_mutex_unlock(&hash->lock);
+    return 1;
+}
+
+/**
+ * Lookup key (lock-free)
+ *
+ * @param hash
+ *            target table
+ * @param key
+ *            key
+ * @param val
+ *            value is stored if found (may be NULL)
+ *
+ * @return 1 if found, 0 if not found
+ *
+ */
+int
+NVMM_HashLookup(nvmm_hash *hash, uint64_t key, uint64_t *val)
+{
+    uint64_t h[2], v;
+    uint32_t seq;
+    levels d;
+    slot *s;
+
+    hash2(hash->root, key, h);
+
+    for (;;) {
+        seq = __atomic_load_n(&hash->seq, __ATOMIC_ACQUIRE);
+
+        get_levels(hash->root, &d);
+        s = find_slot(&d, h, key);
+        if (s != NULL) {
+            v = __atomic_load_n(&s->val, __ATOMIC_ACQUIRE);
+            /* slot may be reused by other key */
+            if (__atomic_load_n(&s->key, __ATOMIC_ACQUIRE) == key) {
+                if (val != NULL)
+                    *val = v;
+                return 1;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((seq & 1) == 0 && __atomic_load_n(&hash->seq, __ATOMIC_RELAXED) == seq && s == NULL)
+            return 0;
+    }
+}
+
+/**
+ * Delete key (one line is flushed)
+ *
+ * @return 1 if deleted, 0 if not found
+ *
+ */
+int
+NVMM_HashDelete(nvmm_hash *hash, uint64_t key)
+{
+    uint64_t h[2];
+    levels d;
+    slot *s;
+
+    hash2(hash->root, key, h);
+
+    pthread_mutex_lock(&hash->lock);
+    get_levels(hash->root, &d);
+    s = find_slot(&d, h, key);
+    if (s != NULL) {
+        erase_slot(s);
+        hash->count--;
+    }
+    pthread_mutex_unlock(&hash->lock);
+
+    return s != NULL;
+}
+
+/* number of items */
+size_t
+NVMM_HashCount(nvmm_hash *hash)
+{
+    return __atomic_load_n(&hash->count, __ATOMIC_RELAXED);
+}
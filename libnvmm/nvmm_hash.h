@@ -0,0 +1,62 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _NVMM_HASH_H_INCLUDED
+#define _NVMM_HASH_H_INCLUDED
+
+#include <stddef.h>   /* size_t */
+#include <inttypes.h> /* uint64_t */
+
+/*
+ * Persistent hash table (level hashing)
+ *
+ * - 2 levels (top: N buckets, bottom: N / 2 buckets), bucket is one cache line
+ * - key has 2 candidate buckets in each level
+ * - insert/update/delete is committed by one 8-byte store of key or value,
+ *   and flushes one line
+ * - readers are lock-free, writers are serialized by lock
+ * - resize is incremental: new top level (2N) is added and old bottom level
+ *   is migrated into it by following inserts
+ * - key 0 is reserved (empty slot)
+ */
+
+typedef struct _nvmm_hash nvmm_hash;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+nvmm_hash *NVMM_HashCreate(size_t capacity);
+nvmm_hash *NVMM_HashRecover(void *root);
+void      *NVMM_HashRoot(nvmm_hash *hash);
+void       NVMM_HashClose(nvmm_hash *hash);
+void       NVMM_HashDestroy(nvmm_hash *hash);
+int        NVMM_HashInsert(nvmm_hash *hash, uint64_t key, uint64_t val);
+int        NVMM_HashLookup(nvmm_hash *hash, uint64_t key, uint64_t *val);
+int        NVMM_HashDelete(nvmm_hash *hash, uint64_t key);
+size_t     NVMM_HashCount(nvmm_hash *hash);
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
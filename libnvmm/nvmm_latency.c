@@ -0,0 +1,531 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/types.h> /* open() */
+#include <sys/stat.h>  /* open() */
+#include <fcntl.h>     /* open() */
+#include <unistd.h>    /* close() */
+#include <sys/mman.h>  /* mmap(), munmap() */
+#include <stdio.h>     /* perror() */
+#include <stdlib.h>    /* exit() */
+#include <string.h>    /* memset() */
+#include <time.h>      /* clock_gettime(), nanosleep() */
+#include <pthread.h>   /* pthread_create(), pthread_join() */
+
+#include "nvmm_latency.h"
+
+#define LATSET_BASE (0x43C00000)
+#define MRR_BASE    (0x43C10000)
+#define REG_SIZE    (4 * 1024)
+
+#define LATSET_UNIT (5) /* [ns] per register value */
+
+/* offset of rlat/wlat registers in each mode */
+#define LATSET_RLAT(mode) ((mode) == NVMM_LAT_COARSE ? 0x00000000 : 0x00000008)
+#define LATSET_WLAT(mode) ((mode) == NVMM_LAT_COARSE ? 0x00000004 : 0x0000000C)
+
+/* write counter in MemoryRequestRegister */
+#define MRR_WRITE_LO (0x00000010)
+#define MRR_WRITE_HI (0x00000014)
+
+
+/*
+ ********** Register backend **********
+ */
+
+/* /dev/mem (ZC706) */
+static volatile unsigned int *latset_base = NULL;
+static volatile unsigned int *mrr_base = NULL;
+
+/**
+ * Map 4 KiB of registers at pa
+ *
+ * @param pa
+ *            physical address of registers
+ *
+ * @return mapped address
+ *
+ */
+static volatile unsigned int *
+map_reg(unsigned long pa)
+{
+    int fd;
+    void *base;
+
+    fd = open("/dev/mem", O_RDWR | O_SYNC);
+    if (fd == -1) {
+        perror("NVMM_Latency::open(/dev/mem)");
+        exit(1);
+    }
+
+    base = mmap(0, REG_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, pa);
+    if (base == MAP_FAILED) {
+        perror("NVMM_Latency::mmap(registers)");
+        exit(1);
+    }
+    close(fd);
+
+    return (volatile unsigned int *) base;
+}
+
+static unsigned int
+devmem_read(void *ctx, unsigned int offset)
+{
+    (void) ctx;
+
+    if (latset_base == NULL)
+        latset_base = map_reg(LATSET_BASE);
+    return latset_base[offset / sizeof(unsigned int)];
+}
+
+static void
+devmem_write(void *ctx, unsigned int offset, unsigned int val)
+{
+    (void) ctx;
+
+    if (latset_base == NULL)
+        latset_base = map_reg(LATSET_BASE);
+    latset_base[offset / sizeof(unsigned int)] = val;
+}
+
+static int64_t
+devmem_writes(void *ctx)
+{
+    int64_t lo, hi;
+
+    (void) ctx;
+
+    if (mrr_base == NULL)
+        mrr_base = map_reg(MRR_BASE);
+
+    /* re-read if lower half wrapped between reads */
+    do {
+        hi = mrr_base[MRR_WRITE_HI / sizeof(unsigned int)];
+        lo = mrr_base[MRR_WRITE_LO / sizeof(unsigned int)];
+    } while (hi != mrr_base[MRR_WRITE_HI / sizeof(unsigned int)]);
+
+    return (hi << 32) | lo;
+}
+
+static const nvmm_latency_ops devmem_ops = {
+    devmem_read, devmem_write, devmem_writes, NULL
+};
+
+
+/* fake (in memory) */
+static unsigned int
+fake_read(void *ctx, unsigned int offset)
+{
+    return ((nvmm_latency_fake *) ctx)->reg[offset / sizeof(unsigned int)];
+}
+
+static void
+fake_write(void *ctx, unsigned int offset, unsigned int val)
+{
+    ((nvmm_latency_fake *) ctx)->reg[offset / sizeof(unsigned int)] = val;
+}
+
+static int64_t
+fake_writes(void *ctx)
+{
+    return ((nvmm_latency_fake *) ctx)->writes;
+}
+
+
+/* current backend (fake for emulation) */
+#if defined(ZC706)
+static nvmm_latency_ops latency_ops = {
+    devmem_read, devmem_write, devmem_writes, NULL
+};
+#else
+static nvmm_latency_fake latency_emu;
+static nvmm_latency_ops latency_ops = {
+    fake_read, fake_write, fake_writes, &latency_emu
+};
+#endif
+
+#define read_latset(offset) \
+    latency_ops.read(latency_ops.ctx, (offset))
+#define write_latset(offset, val) \
+    latency_ops.write(latency_ops.ctx, (offset), (val))
+
+
+/**
+ * Return backend over fake register file
+ *
+ * @param fake
+ *            register file (zero-cleared by caller)
+ *
+ * @return backend
+ *
+ */
+nvmm_latency_ops
+NVMM_LatencyFakeOps(nvmm_latency_fake *fake)
+{
+    nvmm_latency_ops ops = { fake_read, fake_write, fake_writes, fake };
+    return ops;
+}
+
+
+/**
+ * Replace register backend
+ * must not be called while controller is running
+ *
+ * @param ops
+ *            new backend (if NULL, /dev/mem)
+ *
+ * @return none
+ *
+ */
+void
+NVMM_LatencySetOps(const nvmm_latency_ops *ops)
+{
+    latency_ops = (ops != NULL) ? *ops : devmem_ops;
+    return;
+}
+
+
+/*
+ ********** Latency **********
+ */
+
+/**
+ * Set additional latency of NVMM
+ * registers of the other mode are reset to 0 (same as latset)
+ *
+ * @param rlat
+ *            additional read latency [ns] (tRCD)
+ * @param wlat
+ *            additional write latency [ns] (tRP)
+ * @param mode
+ *            NVMM_LAT_COARSE or NVMM_LAT_FINE
+ *
+ * @return none
+ *
+ */
+void
+NVMM_LatencySet(int rlat, int wlat, int mode)
+{
+    int other = (mode == NVMM_LAT_COARSE) ? NVMM_LAT_FINE : NVMM_LAT_COARSE;
+
+    /* reset the other mode first, so that both modes are never set together */
+    write_latset(LATSET_RLAT(other), 0);
+    write_latset(LATSET_WLAT(other), 0);
+
+    /* overwrite latency (no window of zero latency in this mode) */
+    write_latset(LATSET_RLAT(mode), rlat / LATSET_UNIT);
+    write_latset(LATSET_WLAT(mode), wlat / LATSET_UNIT);
+
+    return;
+}
+
+
+/**
+ * Get additional latency of NVMM
+ *
+ * @param rlat
+ *            additional read latency [ns] (tRCD) is stored (if not NULL)
+ * @param wlat
+ *            additional write latency [ns] (tRP) is stored (if not NULL)
+ * @param mode
+ *            NVMM_LAT_COARSE or NVMM_LAT_FINE
+ *
+ * @return none
+ *
+ */
+void
+NVMM_LatencyGet(int *rlat, int *wlat, int mode)
+{
+    if (rlat != NULL)
+        *rlat = read_latset(LATSET_RLAT(mode)) * LATSET_UNIT;
+    if (wlat != NULL)
+        *wlat = read_latset(LATSET_WLAT(mode)) * LATSET_UNIT;
+
+    return;
+}
+
+
+/**
+ * Unmap registers (latency is kept)
+ *
+ * @param none
+ *
+ * @return none
+ *
+ */
+void
+NVMM_LatencyClose()
+{
+    if (latset_base != NULL) {
+        munmap((void *) latset_base, REG_SIZE);
+        latset_base = NULL;
+    }
+    if (mrr_base != NULL) {
+        munmap((void *) mrr_base, REG_SIZE);
+        mrr_base = NULL;
+    }
+
+    return;
+}
+
+
+/*
+ ********** Controller **********
+ */
+
+/**
+ * Initialize state of controller
+ *
+ * @param ctl
+ *            controller (configuration must be set)
+ * @param now_ms
+ *            current time [ms]
+ * @param writes
+ *            current value of write request counter
+ *
+ * @return none
+ *
+ */
+void
+NVMM_LatencyStepInit(nvmm_latctl *ctl, int64_t now_ms, int64_t writes)
+{
+    ctl->phase        = 0;
+    ctl->phase_start  = now_ms;
+    ctl->last_ms      = now_ms;
+    ctl->last_writes  = writes;
+    ctl->total_writes = 0;
+    ctl->temp         = 0.0;
+    ctl->slow         = 0;
+
+    if (ctl->model == NVMM_LATCTL_SCHEDULE && ctl->nphase > 0) {
+        ctl->cur_rlat = ctl->phases[0].rlat;
+        ctl->cur_wlat = ctl->phases[0].wlat;
+    } else {
+        ctl->cur_rlat = ctl->rlat;
+        ctl->cur_wlat = ctl->wlat;
+    }
+
+    return;
+}
+
+
+/* x^n (n >= 0) */
+static inline double
+pow_int(double x, int64_t n)
+{
+    double r = 1.0;
+
+    for (; n > 0; n >>= 1, x *= x) {
+        if (n & 1)
+            r *= x;
+    }
+
+    return r;
+}
+
+
+/**
+ * Update hysteresis state by value and threshold
+ *
+ * @return 1 if slow, else 0
+ *
+ */
+static inline int
+update_slow(nvmm_latctl *ctl, double val)
+{
+    double release = (ctl->release > 0.0) ? ctl->release : 1.0;
+
+    if (val > ctl->threshold)
+        return 1;
+    if (val < ctl->threshold * release)
+        return 0;
+    return ctl->slow;
+}
+
+
+/**
+ * Step controller (pure, no register access)
+ * new latency is stored in ctl->cur_rlat and ctl->cur_wlat
+ *
+ * @param ctl
+ *            controller
+ * @param now_ms
+ *            current time [ms]
+ * @param writes
+ *            current value of write request counter
+ *            (if counter goes back, e.g. reset by NVMM_StartRequestStat,
+ *             it is treated as no writes)
+ *
+ * @return 1 if latency is changed, else 0
+ *
+ */
+int
+NVMM_LatencyStep(nvmm_latctl *ctl, int64_t now_ms, int64_t writes)
+{
+    int64_t dt, dw;
+    int rlat, wlat;
+
+    dt = now_ms - ctl->last_ms;
+    dw = writes - ctl->last_writes;
+    if (dw < 0)
+        dw = 0;
+    ctl->last_ms      = now_ms;
+    ctl->last_writes  = writes;
+    ctl->total_writes += dw;
+
+    rlat = ctl->cur_rlat;
+    wlat = ctl->cur_wlat;
+
+    switch (ctl->model) {
+    case NVMM_LATCTL_SCHEDULE:
+        if (ctl->nphase <= 0)
+            break;
+        while (now_ms - ctl->phase_start >= ctl->phases[ctl->phase].duration_ms) {
+            ctl->phase_start += ctl->phases[ctl->phase].duration_ms;
+            ctl->phase = (ctl->phase + 1) % ctl->nphase;
+            if (ctl->phases[ctl->phase].duration_ms <= 0)
+                break;
+        }
+        rlat = ctl->phases[ctl->phase].rlat;
+        wlat = ctl->phases[ctl->phase].wlat;
+        break;
+
+    case NVMM_LATCTL_THROTTLE:
+        if (dt > 0)
+            ctl->slow = update_slow(ctl, (double) dw / dt);
+        rlat = ctl->slow ? ctl->rlat_slow : ctl->rlat;
+        wlat = ctl->slow ? ctl->wlat_slow : ctl->wlat;
+        break;
+
+    case NVMM_LATCTL_THERMAL:
+        if (dt > 0)
+            ctl->temp *= pow_int(1.0 - ctl->cool, dt);
+        ctl->temp += ctl->heat * dw;
+        ctl->slow = update_slow(ctl, ctl->temp);
+        rlat = ctl->slow ? ctl->rlat_slow : ctl->rlat;
+        wlat = ctl->slow ? ctl->wlat_slow : ctl->wlat;
+        break;
+
+    case NVMM_LATCTL_WEAR:
+        rlat = ctl->rlat;
+        wlat = ctl->wlat + (int) (ctl->wear * ctl->total_writes / 1e6);
+        if (wlat > ctl->wlat_slow)
+            wlat = ctl->wlat_slow;
+        break;
+    }
+
+    if (rlat == ctl->cur_rlat && wlat == ctl->cur_wlat)
+        return 0;
+
+    ctl->cur_rlat = rlat;
+    ctl->cur_wlat = wlat;
+    return 1;
+}
+
+
+static pthread_t latctl_thread;
+static volatile int latctl_running = 0;
+
+static inline int64_t
+now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void *
+latctl_main(void *arg)
+{
+    nvmm_latctl *ctl = (nvmm_latctl *) arg;
+    struct timespec ts;
+
+    ts.tv_sec  = ctl->period_ms / 1000;
+    ts.tv_nsec = (ctl->period_ms % 1000) * 1000000;
+
+    while (latctl_running) {
+        nanosleep(&ts, NULL);
+        if (NVMM_LatencyStep(ctl, now_ms(), latency_ops.writes(latency_ops.ctx)))
+            NVMM_LatencySet(ctl->cur_rlat, ctl->cur_wlat, ctl->mode);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Start background controller
+ * only one controller can run at a time
+ *
+ * @param ctl
+ *            controller (must be alive until NVMM_LatencyStop)
+ *
+ * @return none
+ *
+ */
+void
+NVMM_LatencyStart(nvmm_latctl *ctl)
+{
+    if (latctl_running) {
+        fprintf(stderr, "NVMM_LatencyStart: controller is already running\n");
+        exit(1);
+    }
+    if (ctl->period_ms <= 0) {
+        fprintf(stderr, "NVMM_LatencyStart: period_ms must be positive\n");
+        exit(1);
+    }
+
+    NVMM_LatencyStepInit(ctl, now_ms(), latency_ops.writes(latency_ops.ctx));
+    NVMM_LatencySet(ctl->cur_rlat, ctl->cur_wlat, ctl->mode);
+
+    latctl_running = 1;
+    if (pthread_create(&latctl_thread, NULL, latctl_main, ctl) != 0) {
+        perror("NVMM_LatencyStart::pthread_create");
+        exit(1);
+    }
+
+    return;
+}
+
+
+/**
+ * Stop background controller (latency is kept)
+ *
+ * @param none
+ *
+ * @return none
+ *
+ */
+void
+NVMM_LatencyStop()
+{
+    if (!latctl_running)
+        return;
+
+    latctl_running = 0;
+    pthread_join(latctl_thread, NULL);
+
+    return;
+}
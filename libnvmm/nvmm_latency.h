@@ -0,0 +1,130 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _NVMM_LATENCY_H_INCLUDED
+#define _NVMM_LATENCY_H_INCLUDED
+
+#include <inttypes.h> /* int64_t */
+
+/*
+ * Additional latency of NVMM on our NVMM emulator (LATSET registers)
+ *   rlat : inserted into tRCD [ns]
+ *   wlat : inserted into tRP  [ns]
+ * both are rounded down to multiple of 5 [ns]
+ */
+
+/* latency modes (register sets) */
+#define NVMM_LAT_COARSE (1) /* "v1" (offset 0x0, 0x4) */
+#define NVMM_LAT_FINE   (2) /* "v2" (offset 0x8, 0xC) */
+
+#define NVMM_LAT_NREG   (4) /* LATSET registers (offset 0x0 - 0xC) */
+
+
+/******************** Register backend **************/
+/*
+ * backend of LATSET registers and write request counter
+ * - read/write : access register at offset (0x0 - 0xC)
+ * - writes     : monotonic count of write requests to NVMM
+ */
+typedef struct _nvmm_latency_ops {
+    unsigned int (*read)(void *ctx, unsigned int offset);
+    void         (*write)(void *ctx, unsigned int offset, unsigned int val);
+    int64_t      (*writes)(void *ctx);
+    void *ctx;
+} nvmm_latency_ops;
+
+/* register file in memory (e.g. for testing controller on x86) */
+typedef struct _nvmm_latency_fake {
+    unsigned int reg[NVMM_LAT_NREG];
+    int64_t writes; /* advanced by test */
+} nvmm_latency_fake;
+
+
+/******************** Controller ********************/
+/* controller models */
+#define NVMM_LATCTL_SCHEDULE (0) /* switch phases on timer */
+#define NVMM_LATCTL_THROTTLE (1) /* slow down while write rate is over threshold */
+#define NVMM_LATCTL_THERMAL  (2) /* slow down while temperature is over threshold */
+#define NVMM_LATCTL_WEAR     (3) /* wlat grows with total writes */
+
+typedef struct _nvmm_latency_phase {
+    int64_t duration_ms;
+    int rlat;
+    int wlat;
+} nvmm_latency_phase;
+
+typedef struct _nvmm_latctl {
+    /* configuration */
+    int     model;     /* NVMM_LATCTL_* */
+    int     mode;      /* NVMM_LAT_COARSE or NVMM_LAT_FINE */
+    int64_t period_ms; /* interval of steps */
+
+    /* SCHEDULE: phases are looped */
+    const nvmm_latency_phase *phases;
+    int nphase;
+
+    /* THROTTLE/THERMAL: nominal and slow latency, WEAR: initial and maximum latency */
+    int rlat, wlat;
+    int rlat_slow, wlat_slow;
+
+    /* THROTTLE: writes per ms, THERMAL: temperature */
+    double threshold;
+    double release; /* slow -> nominal under threshold * release (0 is same as 1) */
+
+    /* THERMAL: temperature += heat * writes, and decays by cool per ms */
+    double heat;
+    double cool;
+
+    /* WEAR: wlat += wear * (writes / 1M) */
+    double wear;
+
+    /* state (initialized by NVMM_LatencyStepInit) */
+    int     cur_rlat, cur_wlat;
+    int     phase;
+    int64_t phase_start;
+    int64_t last_ms;
+    int64_t last_writes;
+    int64_t total_writes;
+    double  temp;
+    int     slow;
+} nvmm_latctl;
+
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+void NVMM_LatencySet(int rlat, int wlat, int mode);
+void NVMM_LatencyGet(int *rlat, int *wlat, int mode);
+void NVMM_LatencyClose();
+void NVMM_LatencySetOps(const nvmm_latency_ops *ops);
+nvmm_latency_ops NVMM_LatencyFakeOps(nvmm_latency_fake *fake);
+void NVMM_LatencyStepInit(nvmm_latctl *ctl, int64_t now_ms, int64_t writes);
+int  NVMM_LatencyStep(nvmm_latctl *ctl, int64_t now_ms, int64_t writes);
+void NVMM_LatencyStart(nvmm_latctl *ctl);
+void NVMM_LatencyStop();
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,581 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>     /* perror() */
+#include <stdlib.h>    /* malloc(), free() */
+#include <string.h>    /* memcpy(), memset() */
+#include <errno.h>     /* errno */
+#include <stdint.h>    /* uint32_t, uint64_t */
+
+#include "libnvmm.h"
+#include "nvmm_log.h"
+
+#define LOG_MAGIC    (0x4E564D4D4C4F4701ULL) /* "NVMMLOG" + version */
+#define LOG_ALIGN    (32)                    /* cache line */
+#define LOG_HDRSIZE  (64)                    /* log header (2 cache lines) */
+
+/* tag of entry: epoch (lower 16 bits) | LSN (48 bits) */
+#define LSN_BITS     (48)
+#define LSN_MASK     ((1ULL << LSN_BITS) - 1)
+#define EPOCH_MASK   ((1U << (64 - LSN_BITS)) - 1)
+#define TAG(epoch, lsn) (((uint64_t) ((epoch) & EPOCH_MASK) << LSN_BITS) | ((lsn) & LSN_MASK))
+#define TAG_EPOCH(tag)  ((uint32_t) ((tag) >> LSN_BITS))
+#define TAG_LSN(tag)    ((tag) & LSN_MASK)
+
+/*
+ * epoch in tag wraps around, so epochs are compared by distance from current
+ * epoch (serial number arithmetic), and live entries span less than EPOCH_WINDOW
+ */
+#define EPOCH_WINDOW (1U << (64 - LSN_BITS - 1))
+#define EPOCH_AGE(log, e) (((log)->epoch - (e)) & EPOCH_MASK)
+
+/* len of padding entry (skip to end of ring) */
+#define LEN_PAD      (0x80000000U)
+
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+typedef unsigned char byte;
+
+/* header of log (persistent) */
+typedef struct _log_header {
+    uint64_t magic;
+    uint64_t capacity; /* bytes of ring */
+    uint64_t head;     /* LSN of oldest entry */
+    uint32_t epoch;    /* incremented at each open */
+    uint32_t reserved;
+} log_header;
+
+/* header of entry (persistent) */
+typedef struct _log_entry {
+    uint32_t csum; /* checksum of len, tag and payload */
+    uint32_t len;  /* bytes of payload (LEN_PAD for padding) */
+    uint64_t tag;  /* epoch and LSN of this entry */
+} log_entry;
+
+/* handle of log (volatile) */
+struct _nvmm_log {
+    log_header *hdr;   /* header in NVMM */
+    byte *ring;        /* ring in NVMM */
+    uint64_t capacity; /* bytes of ring */
+    uint32_t epoch;    /* current epoch */
+    uint64_t tail;     /* LSN of next entry (updated by CAS) */
+};
+
+
+/*
+ ********** Helper **********
+ */
+static inline uint64_t
+align_up(uint64_t x, uint64_t a)
+{
+    return (x + a - 1) / a * a;
+}
+
+/* bytes of entry (including log_entry) for payload of len */
+static inline uint64_t
+entry_size(size_t len)
+{
+    return align_up(sizeof(log_entry) + len, LOG_ALIGN);
+}
+
+static inline log_entry *
+lsn_to_entry(nvmm_log *log, uint64_t lsn)
+{
+    return (log_entry *) (log->ring + lsn % log->capacity);
+}
+
+
+/**
+ * Checksum (FNV-1a on 32-bit words, tail is padded by zero)
+ *
+ * @param seed
+ *            initial value
+ * @param p
+ *            data
+ * @param len
+ *            bytes of data
+ *
+ * @return checksum
+ *
+ */
+static inline uint32_t
+checksum(uint32_t seed, const void *p, size_t len)
+{
+    const byte *b = (const byte *) p;
+    uint32_t h = seed, w;
+    size_t i;
+
+    for (i = 0; i + 4 <= len; i += 4) {
+        memcpy(&w, b + i, 4);
+        h = (h ^ w) * 0x01000193U;
+    }
+    if (i < len) {
+        w = 0;
+        memcpy(&w, b + i, len - i);
+        h = (h ^ w) * 0x01000193U;
+    }
+
+    return h;
+}
+
+static inline uint32_t
+entry_csum(const log_entry *e, size_t len)
+{
+    uint32_t h;
+
+    h = checksum(0x811C9DC5U, &e->len, sizeof(e->len) + sizeof(e->tag));
+    return checksum(h, e + 1, len);
+}
+
+
+/**
+ * Flush [first, last) of LSN (wrap around is handled)
+ * no fence
+ *
+ * @return none
+ *
+ */
+static void
+flush_lsn(nvmm_log *log, uint64_t first, uint64_t last)
+{
+    uint64_t off, n;
+
+    while (first < last) {
+        off = first % log->capacity;
+        n = log->capacity - off;
+        if (n > last - first)
+            n = last - first;
+        NVMM_FlushRangeRelax(log->ring + off, n);
+        first += n;
+    }
+}
+
+
+/**
+ * Persist log header
+ * each field is updated by one store, so header needs no checksum
+ *
+ * @return none
+ *
+ */
+static void
+persist_header(nvmm_log *log)
+{
+    NVMM_FlushRangeRelax(log->hdr, sizeof(log_header));
+    NVMM_Fence();
+}
+
+
+/* oldest epoch of live entries */
+static inline uint32_t
+oldest_epoch(nvmm_log *log)
+{
+    return log->epoch - (EPOCH_WINDOW - 1);
+}
+
+
+/**
+ * Return length of valid entry at lsn
+ *
+ * @param log
+ *            target log
+ * @param lsn
+ *            position of entry
+ * @param min_epoch
+ *            entry older than this epoch is invalid (epoch in tag)
+ *
+ * @return length of payload (LEN_PAD for padding, -1 if invalid)
+ *
+ */
+static int64_t
+valid_entry(nvmm_log *log, uint64_t lsn, uint32_t min_epoch)
+{
+    log_entry *e = lsn_to_entry(log, lsn);
+    uint32_t len, epoch;
+
+    len   = e->len;
+    epoch = TAG_EPOCH(e->tag);
+    if (TAG_LSN(e->tag) != (lsn & LSN_MASK) || EPOCH_AGE(log, epoch) > EPOCH_AGE(log, min_epoch))
+        return -1;
+
+    if (len == LEN_PAD) {
+        if (e->csum != entry_csum(e, 0))
+            return -1;
+        return LEN_PAD;
+    }
+
+    if (entry_size(len) > log->capacity - lsn % log->capacity ||
+        e->csum != entry_csum(e, len))
+        return -1;
+
+    return len;
+}
+
+
+/**
+ * Zero free part of ring [tail, head + capacity), so that no stale entry
+ * remains after tail
+ *
+ * @return none
+ *
+ */
+static void
+erase_free(nvmm_log *log)
+{
+    uint64_t first, last, off, n;
+
+    first = log->tail;
+    last  = log->hdr->head + log->capacity;
+    while (first < last) {
+        off = first % log->capacity;
+        n = log->capacity - off;
+        if (n > last - first)
+            n = last - first;
+        memset(log->ring + off, 0, n);
+        first += n;
+    }
+
+    flush_lsn(log, log->tail, log->hdr->head + log->capacity);
+    NVMM_Fence();
+}
+
+
+/**
+ * Set address of header and ring in buf
+ *
+ * @return handle (NULL if buf is too small)
+ *
+ */
+static nvmm_log *
+new_log(void *buf, size_t size)
+{
+    nvmm_log *log;
+    uint64_t base, end;
+
+    base = align_up((uint64_t) (uintptr_t) buf, LOG_ALIGN);
+    end  = (uint64_t) (uintptr_t) buf + size;
+    if (end < base + LOG_HDRSIZE + LOG_ALIGN)
+        return NULL;
+
+    log = (nvmm_log *) malloc(sizeof(nvmm_log));
+    if (unlikely(log == NULL)) {
+        perror("NVMM_Log::malloc(log)");
+        exit(1);
+    }
+
+    log->hdr      = (log_header *) (uintptr_t) base;
+    log->ring     = (byte *) (uintptr_t) (base + LOG_HDRSIZE);
+    log->capacity = (end - base - LOG_HDRSIZE) / LOG_ALIGN * LOG_ALIGN;
+
+    return log;
+}
+
+
+/*
+ ********** Log **********
+ */
+
+/**
+ * Create (format) log on buf
+ *
+ * @param buf
+ *            NVMM for log
+ * @param size
+ *            bytes of buf
+ *
+ * @return handle of log (NULL if buf is too small)
+ *
+ */
+nvmm_log *
+NVMM_LogCreate(void *buf, size_t size)
+{
+    nvmm_log *log;
+
+    log = new_log(buf, size);
+    if (log == NULL)
+        return NULL;
+
+    /* invalidate first entry */
+    memset(log->ring, 0, LOG_ALIGN);
+    NVMM_FlushRangeRelax(log->ring, LOG_ALIGN);
+
+    log->hdr->magic    = LOG_MAGIC;
+    log->hdr->capacity = log->capacity;
+    log->hdr->head     = 0;
+    log->hdr->epoch    = 1;
+    persist_header(log);
+
+    log->epoch = log->hdr->epoch;
+    log->tail  = 0;
+
+    return log;
+}
+
+
+/**
+ * Open log on buf, and recover tail
+ * tail is the first invalid entry from head, so entries after a hole
+ * (not committed when crashed) are discarded
+ * new epoch is given to entries appended after open, unless oldest entry
+ * would be out of EPOCH_WINDOW (then free part of ring is zeroed instead)
+ *
+ * @param buf
+ *            NVMM for log (same as NVMM_LogCreate)
+ * @param size
+ *            bytes of buf (same as NVMM_LogCreate)
+ *
+ * @return handle of log (NULL if buf has no log)
+ *
+ */
+nvmm_log *
+NVMM_LogOpen(void *buf, size_t size)
+{
+    nvmm_log *log;
+    uint64_t lsn;
+    uint32_t epoch, head_epoch;
+    int64_t len;
+
+    log = new_log(buf, size);
+    if (log == NULL)
+        return NULL;
+
+    if (log->hdr->magic != LOG_MAGIC || log->hdr->capacity != log->capacity) {
+        free(log);
+        return NULL;
+    }
+
+    /* scan from head (epoch must not decrease) */
+    log->epoch = log->hdr->epoch;
+    lsn   = log->hdr->head;
+    epoch = oldest_epoch(log);
+    head_epoch = log->epoch;
+    while (lsn - log->hdr->head < log->capacity) {
+        len = valid_entry(log, lsn, epoch);
+        if (len < 0)
+            break;
+        epoch = TAG_EPOCH(lsn_to_entry(log, lsn)->tag);
+        if (lsn == log->hdr->head)
+            head_epoch = epoch;
+        lsn += (len == LEN_PAD) ? log->capacity - lsn % log->capacity : entry_size(len);
+    }
+    log->tail = lsn;
+
+    /*
+     * entries written after this open have new epoch
+     * (if head entry would be too old, stale entries are zeroed and epoch is kept)
+     */
+    if (EPOCH_AGE(log, head_epoch) + 1 < EPOCH_WINDOW) {
+        log->hdr->epoch++;
+        persist_header(log);
+        log->epoch = log->hdr->epoch;
+    } else {
+        erase_free(log);
+    }
+
+    return log;
+}
+
+
+/**
+ * Close log (log in NVMM is kept)
+ *
+ * @param log
+ *            target log
+ *
+ * @return none
+ *
+ */
+void
+NVMM_LogClose(nvmm_log *log)
+{
+    free(log);
+    return;
+}
+
+
+/**
+ * Append entry to log (lock-free)
+ * entry is NOT persistent until NVMM_LogCommit
+ *
+ * @param log
+ *            target log
+ * @param data
+ *            payload
+ * @param len
+ *            bytes of payload
+ *
+ * @return LSN of entry (NVMM_LOG_FULL if no space)
+ *
+ */
+uint64_t
+NVMM_LogAppend(nvmm_log *log, const void *data, size_t len)
+{
+    log_entry *e;
+    uint64_t pos, next, esize, off, pad;
+
+    esize = entry_size(len);
+    if (unlikely(len >= LEN_PAD || esize > log->capacity)) {
+        errno = EINVAL;
+        return NVMM_LOG_FULL;
+    }
+
+    /* reserve [pos, next), skip to head of ring if entry straddles end */
+    pos = __atomic_load_n(&log->tail, __ATOMIC_RELAXED);
+    do {
+        off  = pos % log->capacity;
+        pad  = (off + esize > log->capacity) ? log->capacity - off : 0;
+        next = pos + pad + esize;
+        if (unlikely(next - __atomic_load_n(&log->hdr->head, __ATOMIC_ACQUIRE) > log->capacity)) {
+            errno = ENOSPC;
+            return NVMM_LOG_FULL;
+        }
+    } while (!__atomic_compare_exchange_n(&log->tail, &pos, next, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    /* padding entry is persisted at once (rare) */
+    if (unlikely(pad > 0)) {
+        e = lsn_to_entry(log, pos);
+        e->len  = LEN_PAD;
+        e->tag  = TAG(log->epoch, pos);
+        e->csum = entry_csum(e, 0);
+        NVMM_FlushRangeRelax(e, sizeof(log_entry));
+        pos += pad;
+    }
+
+    /* payload, then header (checksum covers both) */
+    e = lsn_to_entry(log, pos);
+    memcpy(e + 1, data, len);
+    memset((byte *) (e + 1) + len, 0, esize - sizeof(log_entry) - len);
+    e->len  = (uint32_t) len;
+    e->tag  = TAG(log->epoch, pos);
+    e->csum = entry_csum(e, len);
+
+    return pos;
+}
+
+
+/**
+ * Make entries in [first, last] persistent (group commit)
+ * one ranged flush and one fence for all entries
+ *
+ * @param log
+ *            target log
+ * @param first
+ *            LSN of first entry (returned by NVMM_LogAppend)
+ * @param last
+ *            LSN of last entry (returned by NVMM_LogAppend)
+ *
+ * @return none
+ *
+ */
+void
+NVMM_LogCommit(nvmm_log *log, uint64_t first, uint64_t last)
+{
+    flush_lsn(log, first, last + entry_size(lsn_to_entry(log, last)->len));
+    NVMM_Fence();
+    return;
+}
+
+
+/**
+ * Read entry and advance lsn to next entry
+ * iteration stops at tail or at an entry which is not completely written
+ *
+ * @param log
+ *            target log
+ * @param lsn
+ *            LSN of entry (start from NVMM_LogHead), updated to next entry
+ * @param len
+ *            bytes of payload is stored
+ *
+ * @return pointer to payload (NULL at end)
+ *
+ */
+const void *
+NVMM_LogNext(nvmm_log *log, uint64_t *lsn, size_t *len)
+{
+    uint64_t pos = *lsn;
+    int64_t n;
+
+    for (;;) {
+        if (pos >= __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE))
+            return NULL;
+
+        n = valid_entry(log, pos, oldest_epoch(log));
+        if (n < 0)
+            return NULL;
+        if (n != LEN_PAD)
+            break;
+
+        pos += log->capacity - pos % log->capacity;
+    }
+
+    *lsn = pos + entry_size(n);
+    *len = (size_t) n;
+    return lsn_to_entry(log, pos) + 1;
+}
+
+
+/**
+ * Discard entries before lsn (space is reused by NVMM_LogAppend)
+ *
+ * @param log
+ *            target log
+ * @param lsn
+ *            new head (LSN of entry or tail)
+ *
+ * @return none
+ *
+ */
+void
+NVMM_LogTruncate(nvmm_log *log, uint64_t lsn)
+{
+    uint64_t head;
+
+    head = __atomic_load_n(&log->hdr->head, __ATOMIC_ACQUIRE);
+    do {
+        if (lsn <= head || lsn > __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE))
+            return;
+    } while (!__atomic_compare_exchange_n(&log->hdr->head, &head, lsn, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    persist_header(log);
+    return;
+}
+
+
+/* LSN of oldest entry */
+uint64_t
+NVMM_LogHead(nvmm_log *log)
+{
+    return __atomic_load_n(&log->hdr->head, __ATOMIC_ACQUIRE);
+}
+
+/* LSN of next entry */
+uint64_t
+NVMM_LogTail(nvmm_log *log)
+{
+    return __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,63 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _NVMM_LOG_H_INCLUDED
+#define _NVMM_LOG_H_INCLUDED
+
+#include <stddef.h>   /* size_t */
+#include <inttypes.h> /* uint64_t */
+
+/*
+ * Append-only log (ring buffer) on NVMM
+ *
+ * - entries are aligned by cache line (32 B) and never straddle the end of ring
+ * - producers reserve space by CAS on tail (lock-free, multi-producer)
+ * - NVMM_LogAppend writes entry, NVMM_LogCommit flushes a group of entries
+ *   and issues only one fence (group commit)
+ * - each entry has checksum and its position (LSN), so tail is recovered by
+ *   scanning from head until invalid entry
+ */
+
+typedef struct _nvmm_log nvmm_log;
+
+/* returned by NVMM_LogAppend when log is full */
+#define NVMM_LOG_FULL (UINT64_MAX)
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+nvmm_log   *NVMM_LogCreate(void *buf, size_t size);
+nvmm_log   *NVMM_LogOpen(void *buf, size_t size);
+void        NVMM_LogClose(nvmm_log *log);
+uint64_t    NVMM_LogAppend(nvmm_log *log, const void *data, size_t len);
+void        NVMM_LogCommit(nvmm_log *log, uint64_t first, uint64_t last);
+const void *NVMM_LogNext(nvmm_log *log, uint64_t *lsn, size_t *len);
+void        NVMM_LogTruncate(nvmm_log *log, uint64_t lsn);
+uint64_t    NVMM_LogHead(nvmm_log *log);
+uint64_t    NVMM_LogTail(nvmm_log *log);
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,688 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>     /* perror() */
+#include <stdlib.h>    /* malloc(), free(), qsort() */
+#include <string.h>    /* memcpy(), memset() */
+#include <stdint.h>    /* uint8_t, uint16_t, uint64_t */
+
+#include "libnvmm.h"
+#include "nvmm_tree.h"
+
+#define TREE_MAGIC   (0x4E564D4D54524501ULL) /* "NVMMTRE" + version */
+#define LINE         (32)                    /* cache line */
+
+#define LEAF_SLOTS   (16)                    /* header fits in one line */
+#define LEAF_FULL    ((uint16_t) 0xFFFF)
+#define INNER_FANOUT (32)                    /* max keys in inner node */
+
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+/* leaf (persistent, 32 + 16 * 16 = 288 B) */
+typedef struct _kv {
+    uint64_t key;
+    uint64_t val;
+} kv;
+
+typedef struct _leaf {
+    /* line 0: updated by one store of bitmap after entry is persistent */
+    nvmm_pptr next;              /* next leaf in key order */
+    uint16_t bitmap;             /* valid slots */
+    uint8_t  pad[6];
+    uint8_t  fp[LEAF_SLOTS];     /* fingerprints of keys */
+    /* line 1-8: entries (2 per line) */
+    kv ent[LEAF_SLOTS];
+} leaf;
+
+/* root (persistent, one line) */
+typedef struct _tree_root {
+    uint64_t magic;
+    nvmm_pptr head;              /* first leaf (never removed) */
+    nvmm_pptr split_old;         /* redo log of split */
+    nvmm_pptr split_new;
+} tree_root;
+
+/* inner node (volatile), n keys and n + 1 children (1 extra for split) */
+typedef struct _inner {
+    int n;
+    uint64_t key[INNER_FANOUT + 1];
+    void *child[INNER_FANOUT + 2];
+} inner;
+
+/* handle of tree (volatile) */
+struct _nvmm_tree {
+    tree_root *root;
+    void *top;                   /* root node (leaf if height == 0) */
+    int height;                  /* levels of inner nodes */
+};
+
+
+/* leaves are linked by persistent pointers (valid after remap) */
+#define LEAF(p) ((leaf *) NVMM_PPTR_GET(p))
+
+/*
+ ********** Helper **********
+ */
+static inline uint8_t
+fingerprint(uint64_t key)
+{
+    return (uint8_t) ((key * 0x9E3779B97F4A7C15ULL) >> 56);
+}
+
+static inline void
+persist(void *p, size_t size)
+{
+    NVMM_FlushRangeRelax(p, size);
+    NVMM_Fence();
+}
+
+static void *
+xmalloc(size_t size)
+{
+    void *p = malloc(size);
+
+    if (unlikely(p == NULL)) {
+        perror("NVMM_Tree::malloc");
+        exit(1);
+    }
+
+    return p;
+}
+
+static int
+cmp_kv(const void *a, const void *b)
+{
+    uint64_t x = ((const kv *) a)->key, y = ((const kv *) b)->key;
+    return (x > y) - (x < y);
+}
+
+
+/*
+ ********** Leaf **********
+ */
+static leaf *
+new_leaf()
+{
+    leaf *l;
+
+    l = (leaf *) NVMM_MallocAligned(sizeof(leaf), LINE, 0);
+    memset(l, 0, sizeof(leaf));
+
+    return l;
+}
+
+/* slot of key (-1 if not found) */
+static int
+find_in_leaf(leaf *l, uint64_t key)
+{
+    uint16_t bm = l->bitmap;
+    uint8_t fp = fingerprint(key);
+    int i;
+
+    while (bm != 0) {
+        i = __builtin_ctz(bm);
+        bm &= bm - 1;
+        if (l->fp[i] == fp && l->ent[i].key == key)
+            return i;
+    }
+
+    return -1;
+}
+
+/* entries of leaf sorted by key, return number of entries */
+static int
+sorted_leaf(leaf *l, kv *out)
+{
+    uint16_t bm = l->bitmap;
+    int i, n;
+
+    n = 0;
+    while (bm != 0) {
+        i = __builtin_ctz(bm);
+        bm &= bm - 1;
+        out[n++] = l->ent[i];
+    }
+    qsort(out, n, sizeof(kv), cmp_kv);
+
+    return n;
+}
+
+/* min key of leaf (leaf must not be empty) */
+static uint64_t
+min_key(leaf *l)
+{
+    uint16_t bm = l->bitmap;
+    uint64_t min = UINT64_MAX;
+    int i;
+
+    while (bm != 0) {
+        i = __builtin_ctz(bm);
+        bm &= bm - 1;
+        if (l->ent[i].key < min)
+            min = l->ent[i].key;
+    }
+
+    return min;
+}
+
+/**
+ * Remove entries of old which are in new (2nd half of split)
+ *
+ * @return none
+ *
+ */
+static void
+finish_split(tree_root *r, leaf *old, leaf *new)
+{
+    uint16_t bm = old->bitmap;
+    int i;
+
+    old->next = NVMM_PPtr(new);
+    persist(old, LINE);
+
+    while (bm != 0) {
+        i = __builtin_ctz(bm);
+        bm &= bm - 1;
+        if (find_in_leaf(new, old->ent[i].key) >= 0)
+            old->bitmap &= ~(1U << i);
+    }
+    persist(old, LINE);
+
+    r->split_old = NVMM_PPTR_NULL;
+    r->split_new = NVMM_PPTR_NULL;
+    persist(r, sizeof(tree_root));
+}
+
+/**
+ * Split full leaf, upper half is moved to new leaf
+ * redo log: new leaf is persistent -> log -> link -> bitmap of old leaf
+ *
+ * @param sep
+ *            keys >= *sep are in new leaf
+ *
+ * @return new leaf
+ *
+ */
+static leaf *
+split_leaf(tree_root *r, leaf *old, uint64_t *sep)
+{
+    kv s[LEAF_SLOTS];
+    leaf *new;
+    int i, n;
+
+    n = sorted_leaf(old, s);
+
+    new = new_leaf();
+    for (i = n / 2; i < n; ++i) {
+        new->ent[i - n / 2] = s[i];
+        new->fp[i - n / 2]  = fingerprint(s[i].key);
+    }
+    new->bitmap = (uint16_t) ((1U << (n - n / 2)) - 1);
+    new->next   = old->next;
+    /* free slots are not read, so only header and moved entries */
+    persist(new, (char *) &new->ent[n - n / 2] - (char *) new);
+
+    r->split_old = NVMM_PPtr(old);
+    r->split_new = NVMM_PPtr(new);
+    persist(r, sizeof(tree_root));
+
+    finish_split(r, old, new);
+
+    *sep = s[n / 2].key;
+    return new;
+}
+
+
+/*
+ ********** Inner node **********
+ */
+
+/* index of child for key */
+static inline int
+child_index(inner *in, uint64_t key)
+{
+    int lo = 0, hi = in->n, mid;
+
+    /* upper bound: first key[i] > key */
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (key >= in->key[mid])
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/**
+ * Find leaf for key
+ *
+ * @param path
+ *            inner nodes and child indexes are stored (NULL if not needed)
+ *
+ * @return leaf
+ *
+ */
+static leaf *
+find_leaf(nvmm_tree *tree, uint64_t key, inner **path, int *idx)
+{
+    void *node = tree->top;
+    int h, i;
+
+    for (h = tree->height; h > 0; --h) {
+        i = child_index((inner *) node, key);
+        if (path != NULL) {
+            path[h - 1] = (inner *) node;
+            idx[h - 1]  = i;
+        }
+        node = ((inner *) node)->child[i];
+    }
+
+    return (leaf *) node;
+}
+
+/**
+ * Insert (sep, right) to inner nodes after leaf split
+ *
+ * @return none
+ *
+ */
+static void
+insert_inner(nvmm_tree *tree, inner **path, int *idx, uint64_t sep, void *right)
+{
+    inner *in, *rin, *top;
+    int h, i, mid;
+
+    for (h = 0; h < tree->height; ++h) {
+        in = path[h];
+        i  = idx[h];
+
+        memmove(&in->key[i + 1], &in->key[i], sizeof(uint64_t) * (in->n - i));
+        memmove(&in->child[i + 2], &in->child[i + 1], sizeof(void *) * (in->n - i));
+        in->key[i] = sep;
+        in->child[i + 1] = right;
+        in->n++;
+        if (in->n <= INNER_FANOUT)
+            return;
+
+        /* split: key[mid] goes up */
+        mid = in->n / 2;
+        rin = (inner *) xmalloc(sizeof(inner));
+        rin->n = in->n - mid - 1;
+        memcpy(rin->key, &in->key[mid + 1], sizeof(uint64_t) * rin->n);
+        memcpy(rin->child, &in->child[mid + 1], sizeof(void *) * (rin->n + 1));
+        in->n = mid;
+
+        sep   = in->key[mid];
+        right = rin;
+    }
+
+    /* new root */
+    top = (inner *) xmalloc(sizeof(inner));
+    top->n = 1;
+    top->key[0]   = sep;
+    top->child[0] = tree->top;
+    top->child[1] = right;
+    tree->top = top;
+    tree->height++;
+}
+
+static void
+free_inner(void *node, int height)
+{
+    inner *in = (inner *) node;
+    int i;
+
+    if (height == 0)
+        return;
+
+    for (i = 0; i <= in->n; ++i)
+        free_inner(in->child[i], height - 1);
+    free(in);
+}
+
+/**
+ * Build inner nodes from leaf list (bulk load)
+ * empty leaves (except head) are kept in list but not indexed
+ *
+ * @return none
+ *
+ */
+static void
+build_inner(nvmm_tree *tree)
+{
+    void **child;
+    uint64_t *sep;
+    inner *in;
+    leaf *l;
+    size_t m, cap, nn, j, k, lo, hi;
+
+    cap   = 1024;
+    child = (void **) xmalloc(sizeof(void *) * cap);
+    sep   = (uint64_t *) xmalloc(sizeof(uint64_t) * cap);
+
+    m = 0;
+    for (l = LEAF(tree->root->head); l != NULL; l = LEAF(l->next)) {
+        if (l != LEAF(tree->root->head) && l->bitmap == 0)
+            continue;
+        if (m == cap) {
+            cap  *= 2;
+            child = (void **) realloc(child, sizeof(void *) * cap);
+            sep   = (uint64_t *) realloc(sep, sizeof(uint64_t) * cap);
+            if (unlikely(child == NULL || sep == NULL)) {
+                perror("NVMM_Tree::realloc");
+                exit(1);
+            }
+        }
+        child[m] = l;
+        sep[m]   = (m == 0) ? 0 : min_key(l);
+        m++;
+    }
+
+    /* sep[i] is lower bound of child[i] (sep[0] is unused) */
+    tree->height = 0;
+    while (m > 1) {
+        nn = (m + INNER_FANOUT) / (INNER_FANOUT + 1);
+        for (j = 0; j < nn; ++j) {
+            lo = j * m / nn;
+            hi = (j + 1) * m / nn;
+
+            in = (inner *) xmalloc(sizeof(inner));
+            in->n = (int) (hi - lo - 1);
+            for (k = lo; k < hi; ++k) {
+                in->child[k - lo] = child[k];
+                if (k > lo)
+                    in->key[k - lo - 1] = sep[k];
+            }
+
+            child[j] = in;
+            sep[j]   = sep[lo];
+        }
+        m = nn;
+        tree->height++;
+    }
+    tree->top = child[0];
+
+    free(child);
+    free(sep);
+}
+
+
+/*
+ ********** Tree **********
+ */
+
+/**
+ * Create empty tree
+ *
+ * @return handle of tree
+ *
+ */
+nvmm_tree *
+NVMM_TreeCreate(void)
+{
+    nvmm_tree *tree;
+    tree_root *r;
+
+    r = (tree_root *) NVMM_MallocAligned(sizeof(tree_root), LINE, 0);
+    r->head      = NVMM_PPtr(new_leaf());
+    r->split_old = NVMM_PPTR_NULL;
+    r->split_new = NVMM_PPTR_NULL;
+    persist(LEAF(r->head), sizeof(leaf));
+    r->magic     = TREE_MAGIC;
+    persist(r, sizeof(tree_root));
+
+    tree = (nvmm_tree *) xmalloc(sizeof(nvmm_tree));
+    tree->root   = r;
+    tree->top    = LEAF(r->head);
+    tree->height = 0;
+
+    return tree;
+}
+
+/**
+ * Recover tree from root (NVMM_TreeRoot)
+ * interrupted split is completed, then inner nodes are rebuilt from leaves
+ *
+ * @param root
+ *            persistent root of tree
+ *
+ * @return handle of tree (NULL if root is not tree)
+ *
+ */
+nvmm_tree *
+NVMM_TreeRecover(void *root)
+{
+    nvmm_tree *tree;
+    tree_root *r = (tree_root *) root;
+
+    if (r->magic != TREE_MAGIC)
+        return NULL;
+
+    if (r->split_old != NVMM_PPTR_NULL) {
+        if (r->split_new != NVMM_PPTR_NULL) {
+            finish_split(r, LEAF(r->split_old), LEAF(r->split_new));
+        } else {
+            /* new leaf was not logged yet (it is leaked) */
+            r->split_old = NVMM_PPTR_NULL;
+            persist(r, sizeof(tree_root));
+        }
+    }
+
+    tree = (nvmm_tree *) xmalloc(sizeof(nvmm_tree));
+    tree->root = r;
+    build_inner(tree);
+
+    return tree;
+}
+
+/* persistent root of tree (pass to NVMM_TreeRecover) */
+void *
+NVMM_TreeRoot(nvmm_tree *tree)
+{
+    return tree->root;
+}
+
+/**
+ * Close handle of tree (tree in NVMM is kept)
+ *
+ * @return none
+ *
+ */
+void
+NVMM_TreeClose(nvmm_tree *tree)
+{
+    free_inner(tree->top, tree->height);
+    free(tree);
+}
+
+/**
+ * Destroy tree and free all leaves
+ *
+ * @return none
+ *
+ */
+void
+NVMM_TreeDestroy(nvmm_tree *tree)
+{
+    leaf *l, *next;
+
+    tree->root->magic = 0;
+    persist(tree->root, sizeof(tree_root));
+
+    for (l = LEAF(tree->root->head); l != NULL; l = next) {
+        next = LEAF(l->next);
+        NVMM_Free(l);
+    }
+    NVMM_Free(tree->root);
+
+    NVMM_TreeClose(tree);
+}
+
+/**
+ * Insert or update key
+ * insert: entry is persisted, then fingerprint and bitmap (one line)
+ * update: value is updated by one 8-byte store
+ *
+ * @param tree
+ *            target tree
+ * @param key
+ *            key
+ * @param val
+ *            value
+ *
+ * @return 1 if inserted, 0 if updated
+ *
+ */
+int
+NVMM_TreeInsert(nvmm_tree *tree, uint64_t key, uint64_t val)
+{
+    inner *path[64];
+    int idx[64];
+    leaf *l, *new;
+    uint64_t sep;
+    int i;
+
+    l = find_leaf(tree, key, path, idx);
+
+    i = find_in_leaf(l, key);
+    if (i >= 0) {
+        __atomic_store_n(&l->ent[i].val, val, __ATOMIC_RELAXED);
+        persist(&l->ent[i].val, sizeof(uint64_t));
+        return 0;
+    }
+
+    if (unlikely(l->bitmap == LEAF_FULL)) {
+        new = split_leaf(tree->root, l, &sep);
+        insert_inner(tree, path, idx, sep, new);
+        if (key >= sep)
+            l = new;
+    }
+
+    i = __builtin_ctz(~(uint32_t) l->bitmap);
+    l->ent[i].key = key;
+    l->ent[i].val = val;
+    persist(&l->ent[i], sizeof(kv));
+
+    l->fp[i] = fingerprint(key);
+    __atomic_store_n(&l->bitmap, l->bitmap | (1U << i), __ATOMIC_RELEASE);
+    persist(l, LINE);
+
+    return 1;
+}
+
+/**
+ * Lookup key
+ *
+ * @param tree
+ *            target tree
+ * @param key
+ *            key
+ * @param val
+ *            value is stored if found (may be NULL)
+ *
+ * @return 1 if found, 0 if not found
+ *
+ */
+int
+NVMM_TreeLookup(nvmm_tree *tree, uint64_t key, uint64_t *val)
+{
+    leaf *l;
+    int i;
+
+    l = find_leaf(tree, key, NULL, NULL);
+    i = find_in_leaf(l, key);
+    if (i < 0)
+        return 0;
+
+    if (val != NULL)
+        *val = l->ent[i].val;
+    return 1;
+}
+
+/**
+ * Delete key (one line is flushed, empty leaf is not freed)
+ *
+ * @return 1 if deleted, 0 if not found
+ *
+ */
+int
+NVMM_TreeDelete(nvmm_tree *tree, uint64_t key)
+{
+    leaf *l;
+    int i;
+
+    l = find_leaf(tree, key, NULL, NULL);
+    i = find_in_leaf(l, key);
+    if (i < 0)
+        return 0;
+
+    __atomic_store_n(&l->bitmap, l->bitmap & ~(1U << i), __ATOMIC_RELEASE);
+    persist(l, LINE);
+
+    return 1;
+}
+
+/**
+ * Range scan: up to n entries whose key >= lo in key order
+ *
+ * @param tree
+ *            target tree
+ * @param lo
+ *            lower bound of key
+ * @param n
+ *            max number of entries
+ * @param keys
+ *            keys are stored
+ * @param vals
+ *            values are stored (may be NULL)
+ *
+ * @return number of entries
+ *
+ */
+size_t
+NVMM_TreeScan(nvmm_tree *tree, uint64_t lo, size_t n, uint64_t *keys, uint64_t *vals)
+{
+    kv s[LEAF_SLOTS];
+    leaf *l;
+    size_t cnt;
+    int i, m;
+
+    cnt = 0;
+    for (l = find_leaf(tree, lo, NULL, NULL); l != NULL && cnt < n; l = LEAF(l->next)) {
+        m = sorted_leaf(l, s);
+        for (i = 0; i < m && cnt < n; ++i) {
+            if (s[i].key < lo)
+                continue;
+            keys[cnt] = s[i].key;
+            if (vals != NULL)
+                vals[cnt] = s[i].val;
+            cnt++;
+        }
+    }
+
+    return cnt;
+}
@@ -0,0 +1,60 @@
+/*
+ * The MIT License (MIT)
+
+ * Copyright (c) 2019 Yu Omori
+
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is furnis-
+ * hed to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABI-
+ * LITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+ * OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _NVMM_TREE_H_INCLUDED
+#define _NVMM_TREE_H_INCLUDED
+
+#include <stddef.h>   /* size_t */
+#include <inttypes.h> /* uint64_t */
+
+/*
+ * Persistent B+-tree (selective persistence)
+ *
+ * - leaves are in NVMM, inner nodes are in DRAM and rebuilt at recovery
+ * - entries in leaf are unsorted, and found by 1-byte fingerprints
+ * - insert flushes 2 lines (entry, then bitmap/fingerprint line)
+ * - split is made failure-atomic by redo log in root
+ * - NOT thread-safe (caller must lock)
+ */
+
+typedef struct _nvmm_tree nvmm_tree;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+nvmm_tree *NVMM_TreeCreate(void);
+nvmm_tree *NVMM_TreeRecover(void *root);
+void      *NVMM_TreeRoot(nvmm_tree *tree);
+void       NVMM_TreeClose(nvmm_tree *tree);
+void       NVMM_TreeDestroy(nvmm_tree *tree);
+int        NVMM_TreeInsert(nvmm_tree *tree, uint64_t key, uint64_t val);
+int        NVMM_TreeLookup(nvmm_tree *tree, uint64_t key, uint64_t *val);
+int        NVMM_TreeDelete(nvmm_tree *tree, uint64_t key);
+size_t     NVMM_TreeScan(nvmm_tree *tree, uint64_t lo, size_t n,
+                         uint64_t *keys, uint64_t *vals);
+#if defined(__cplusplus)
+}
+#endif
+
+#endif